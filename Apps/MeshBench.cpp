@@ -0,0 +1,491 @@
+// MeshBench.cpp: headless timings of the mesh library on a given OBJ file
+// usage: MeshBench file.obj [test...] (tests: read, write, normals, layout, rays, batch; all if none given)
+// read generates its own grid OBJ (next to file.obj) rather than using file.obj
+
+#include "Mesh.h"
+#include "MeshBvh.h"
+#include "MeshIO.h"
+#include "MeshProcess.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <random>
+#include <string.h>
+
+double Now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double Time(std::function<void()> f, int reps = 3) {
+	// best of reps runs, in seconds
+	double best = 1e30;
+	for (int i = 0; i < reps; i++) {
+		double t = Now();
+		f();
+		t = Now()-t;
+		if (t < best) best = t;
+	}
+	return best;
+}
+
+long long FileSize(const char *name) {
+	FILE *f = fopen(name, "rb");
+	if (!f) return 0;
+	fseek(f, 0, SEEK_END);
+	long long size = ftell(f);
+	fclose(f);
+	return size;
+}
+
+template<class T>
+bool SameBits(vector<T> &a, vector<T> &b) {
+	return a.size() == b.size() && (a.empty() || !memcmp(a.data(), b.data(), a.size()*sizeof(T)));
+}
+
+// Readers
+
+bool WriteGridObj(const char *filename, int n) {
+	// n by n grid of v, vt, vn records on a gentle wave; faces alternate rows of quads and of
+	// triangle pairs, with a new integer group every 64 rows
+	FILE *file = fopen(filename, "wb");
+	if (!file) return false;
+	vector<char> buf(1 << 20);
+	size_t used = 0;
+	auto Flush = [&](size_t room) {
+		if (used+room > buf.size()) {
+			fwrite(buf.data(), 1, used, file);
+			used = 0;
+		}
+	};
+	auto Floats = [&](const char *key, const float *f, int count) {
+		Flush(100);
+		used += sprintf(&buf[used], "%s", key);
+		for (int k = 0; k < count; k++) {
+			buf[used++] = ' ';
+			used += FormatFloat(&buf[used], f[k]);
+		}
+		buf[used++] = '\n';
+	};
+	for (int y = 0; y < n; y++)
+		for (int x = 0; x < n; x++) {
+			float u = (float) x/(n-1), v = (float) y/(n-1), h = .05f*sinf(20*u)*cosf(20*v);
+			vec3 p(u, v, h), nrm = normalize(vec3(-cosf(20*u)*cosf(20*v), sinf(20*u)*sinf(20*v), 1));
+			vec2 uv(u, v);
+			Floats("v", &p.x, 3);
+			Floats("vt", &uv.x, 2);
+			Floats("vn", &nrm.x, 3);
+		}
+	for (int y = 0; y < n-1; y++) {
+		if (y%64 == 0) {
+			Flush(100);
+			used += sprintf(&buf[used], "g %d\n", y/64);
+		}
+		for (int x = 0; x < n-1; x++) {
+			int a = 1+y*n+x, b = a+1, c = b+n, d = a+n;
+			Flush(200);
+			if (y%2 == 0)
+				used += sprintf(&buf[used], "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+			else
+				used += sprintf(&buf[used], "f %d/%d/%d %d/%d/%d %d/%d/%d\nf %d/%d/%d %d/%d/%d %d/%d/%d\n",
+								a, a, a, b, b, b, c, c, c, a, a, a, c, c, c, d, d, d);
+		}
+	}
+	fwrite(buf.data(), 1, used, file);
+	return fclose(file) == 0;
+}
+
+struct ObjRead {
+	vector<vec3> points, normals;
+	vector<vec2> uvs;
+	vector<int3> triangles;
+	vector<int> groups;
+	vector<int4> quads;
+	bool Same(ObjRead &r) {
+		return SameBits(points, r.points) && SameBits(normals, r.normals) && SameBits(uvs, r.uvs) &&
+			   SameBits(triangles, r.triangles) && SameBits(groups, r.groups) && SameBits(quads, r.quads);
+	}
+};
+
+void BenchRead(const char *base, int n) {
+	// baseline ReadAsciiObj against the mapped and parallel readers on a generated grid
+	string name = string(base)+".bench.read.obj";
+	double t = Now();
+	if (!WriteGridObj(name.c_str(), n)) {
+		printf("read: can't write %s\n", name.c_str());
+		return;
+	}
+	printf("read (%d by %d grid, %.1f MB, written in %.2f s; hardware threads: %d):\n",
+		   n, n, FileSize(name.c_str())/(1024.*1024.), Now()-t, NumThreads());
+	const char *f = name.c_str();
+	ObjRead ascii, mapped, parallel;
+	auto Run = [&](const char *label, ObjRead &r, std::function<bool(ObjRead &)> read) {
+		bool ok = true;
+		double t = Time([&]() { r = ObjRead(); ok = read(r) && ok; }, 1);
+		printf("  %-28s %7.3f s %7.1f MB/s%s\n", label, t, FileSize(f)/(1024.*1024.)/t, ok? "" : " (failed)");
+	};
+	Run("ReadAsciiObj", ascii, [&](ObjRead &r) {
+		return ReadAsciiObj(f, r.points, r.triangles, &r.normals, &r.uvs, &r.groups, &r.quads); });
+	Run("ReadObjMapped", mapped, [&](ObjRead &r) {
+		return ReadObjMapped(f, r.points, r.triangles, &r.normals, &r.uvs, &r.groups, &r.quads); });
+	printf("  %d points, %d triangles, %d quads; mapped %s ReadAsciiObj\n", (int) ascii.points.size(),
+		   (int) ascii.triangles.size(), (int) ascii.quads.size(), ascii.Same(mapped)? "identical to" : "DIFFERS from");
+	// ReadObjParallel on 1 thread is ReadObjMapped; beyond NumThreads() (at least to 4) threads share cores,
+	// which times the parallel passes' overhead on small machines
+	int maxThreads = std::max(4, NumThreads());
+	for (int nThreads = 1; ; nThreads = std::min(2*nThreads, maxThreads)) {
+		string label = "ReadObjParallel, "+std::to_string(nThreads)+(nThreads > 1? " threads" : " thread");
+		Run(label.c_str(), parallel, [&](ObjRead &r) {
+			return ReadObjParallel(f, r.points, r.triangles, &r.normals, &r.uvs, &r.groups, &r.quads, NULL, nThreads); });
+		if (!ascii.Same(parallel))
+			printf("  (DIFFERS from ReadAsciiObj)\n");
+		if (nThreads == maxThreads)
+			break;
+	}
+	remove(f);
+}
+
+// Writers
+
+bool WriteObjPrintf(const char *filename, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles) {
+	// WriteAsciiObj as it was, one fprintf per record
+	FILE *file = fopen(filename, "w");
+	if (!file) return false;
+	for (size_t i = 0; i < points.size(); i++)
+		fprintf(file, "v %f %f %f \n", points[i].x, points[i].y, points[i].z);
+	fprintf(file, "\n");
+	for (size_t i = 0; i < normals.size(); i++)
+		fprintf(file, "vn %f %f %f \n", normals[i].x, normals[i].y, normals[i].z);
+	fprintf(file, "\n");
+	for (size_t i = 0; i < uvs.size(); i++)
+		fprintf(file, "vt %f %f \n", uvs[i].x, uvs[i].y);
+	fprintf(file, "\n");
+	for (size_t i = 0; i < triangles.size(); i++)
+		fprintf(file, "f %d %d %d \n", 1+triangles[i].i1, 1+triangles[i].i2, 1+triangles[i].i3);
+	fclose(file);
+	return true;
+}
+
+void BenchWrite(const char *base, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles) {
+	string obj = string(base)+".bench.obj", ply = string(base)+".bench.ply", stl = string(base)+".bench.stl";
+	struct Writer { const char *label; string &name; std::function<bool()> write; } writers[] = {
+		{"obj fprintf", obj, [&]() { return WriteObjPrintf(obj.c_str(), points, normals, uvs, triangles); }},
+		{"obj buffered, 1 thread", obj, [&]() { return WriteObjBuffered(obj.c_str(), points, normals, uvs, &triangles, NULL, 1); }},
+		{"obj buffered", obj, [&]() { return WriteObjBuffered(obj.c_str(), points, normals, uvs, &triangles); }},
+		{"binary ply", ply, [&]() { return WritePly(ply.c_str(), points, &normals, &uvs, triangles); }},
+		{"binary stl", stl, [&]() { return WriteSTL(stl.c_str(), points, triangles); }}
+	};
+	printf("write (hardware threads: %d):\n", NumThreads());
+	for (Writer &w : writers) {
+		bool ok = true;
+		double t = Time([&]() { ok = w.write() && ok; });
+		double mb = FileSize(w.name.c_str())/(1024.*1024.);
+		printf("  %-24s %7.3f s %8.1f MB %7.1f MB/s%s\n", w.label, t, mb, mb/t, ok? "" : " (failed)");
+	}
+	// buffered output must reload bit for bit
+	WriteObjBuffered(obj.c_str(), points, normals, uvs, &triangles);
+	vector<vec3> p, n;
+	vector<vec2> u;
+	vector<int3> t;
+	bool same = ReadObjMapped(obj.c_str(), p, t, &n, &u) && SameBits(p, points) && SameBits(t, triangles) &&
+						 SameBits(n, normals) && SameBits(u, uvs);
+	printf("  buffered obj reloads %s\n", same? "identical" : "DIFFERENT");
+	remove(obj.c_str());
+	remove(ply.c_str());
+	remove(stl.c_str());
+}
+
+// Vertex Normals
+
+void SetVertexNormalsSerial(vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals) {
+	// SetVertexNormals as it was: unit face normals summed serially
+	normals.assign(points.size(), vec3(0, 0, 0));
+	for (size_t i = 0; i < triangles.size(); i++) {
+		int3 &t = triangles[i];
+		vec3 &p1 = points[t.i1], &p2 = points[t.i2], &p3 = points[t.i3];
+		vec3 a(p2-p1), b(p3-p2), n(normalize(cross(a, b)));
+		normals[t.i1] += n;
+		normals[t.i2] += n;
+		normals[t.i3] += n;
+	}
+	for (size_t i = 0; i < normals.size(); i++)
+		normals[i] = normalize(normals[i]);
+}
+
+float MaxDifference(vector<vec3> &a, vector<vec3> &b) {
+	float d = 0;
+	for (size_t i = 0; i < a.size() && i < b.size(); i++)
+		for (int k = 0; k < 3; k++)
+			d = std::max(d, fabsf(a[i][k]-b[i][k]));
+	return d;
+}
+
+void BenchNormals(vector<vec3> &points, vector<int3> &triangles, const char *order) {
+	const char *weights[] = {"uniform", "area", "angle"};
+	vector<vec3> serial, normals;
+	printf("normals, %s vertex order:\n", order);
+	printf("  %-24s %7.3f s\n", "old serial", Time([&]() { SetVertexNormalsSerial(points, triangles, serial); }));
+	for (int w = 0; w < 3; w++)
+		for (int nThreads = 1; ; nThreads = std::min(2*nThreads, NumThreads())) {
+			double t = Time([&]() { ComputeVertexNormals(points, triangles, normals, (NormalWeight) w, nThreads); });
+			printf("  %-7s %2d threads       %7.3f s", weights[w], nThreads, t);
+			if (w == 0)
+				printf("  (max difference from old %g)", MaxDifference(normals, serial));
+			printf("\n");
+			if (nThreads == NumThreads())
+				break;
+		}
+}
+
+void Shuffle(vector<vec3> &points, vector<int3> &triangles) {
+	// renumber vertices at random, so nearby triangles no longer use nearby vertex ids
+	vector<int> ids(points.size());
+	for (size_t i = 0; i < ids.size(); i++)
+		ids[i] = (int) i;
+	std::shuffle(ids.begin(), ids.end(), std::mt19937(1));
+	vector<vec3> shuffled(points.size());
+	for (size_t i = 0; i < ids.size(); i++)
+		shuffled[ids[i]] = points[i];
+	points.swap(shuffled);
+	for (size_t t = 0; t < triangles.size(); t++)
+		triangles[t] = int3(ids[triangles[t].i1], ids[triangles[t].i2], ids[triangles[t].i3]);
+}
+
+// Layouts
+
+double FetchBlocked(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles) {
+	// CPU stand-in for vertex fetch: read every attribute of every corner through the index buffer
+	double sum = 0;
+	for (size_t t = 0; t < triangles.size(); t++)
+		for (int k = 0; k < 3; k++) {
+			int v = triangles[t][k];
+			vec3 &p = points[v], &n = normals[v];
+			vec2 &u = uvs[v];
+			sum += p.x+p.y+p.z+n.x+n.y+n.z+u.x+u.y;
+		}
+	return sum;
+}
+
+double FetchInterleaved(vector<float> &vertices, vector<int3> &triangles) {
+	double sum = 0;
+	for (size_t t = 0; t < triangles.size(); t++)
+		for (int k = 0; k < 3; k++) {
+			float *f = &vertices[(size_t) triangles[t][k]*interleavedFloats];
+			sum += f[0]+f[1]+f[2]+f[3]+f[4]+f[5]+f[6]+f[7];
+		}
+	return sum;
+}
+
+void BenchFetch(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<float> &vertices,
+				vector<int3> &triangles, const char *order) {
+	double blocked = 0, interleaved = 0;
+	double tb = Time([&]() { blocked = FetchBlocked(points, normals, uvs, triangles); });
+	double ti = Time([&]() { interleaved = FetchInterleaved(vertices, triangles); });
+	printf("  fetch, %-8s blocked  %7.3f s  interleaved %7.3f s%s\n", order, tb, ti, blocked == interleaved? "" : " (sums differ)");
+}
+
+void BenchLayout(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles) {
+	// transform and bounds on AoS vs SoA points, and attribute fetch from blocked vs interleaved vertices
+	vector<vec3> n(normals), aos(points);
+	vector<vec2> u(uvs);
+	if (n.size() != points.size())
+		ComputeVertexNormals(points, triangles, n);
+	if (u.size() != points.size())
+		u.assign(points.size(), vec2(0, 0));
+	PointsSoA soa;
+	mat4 m = RotateY(30);
+	vec3 min, max;
+	printf("layout:\n");
+	printf("  %-24s %7.3f s\n", "ToSoA", Time([&]() { ToSoA(points, soa); }));
+	printf("  %-24s %7.3f s\n", "transform AoS", Time([&]() { TransformPoints(m, aos); }));
+	printf("  %-24s %7.3f s\n", "transform SoA", Time([&]() { TransformPoints(m, soa); }));
+	printf("  %-24s %7.3f s\n", "bounds AoS", Time([&]() { ComputeBounds(aos, min, max); }));
+	printf("  %-24s %7.3f s\n", "bounds SoA", Time([&]() { ComputeBounds(soa, min, max); }));
+	vector<float> vertices(points.size()*interleavedFloats);
+	int nPoints = (int) points.size();
+	printf("  %-24s %7.3f s\n", "InterleaveVertices", Time([&]() {
+		InterleaveVertices(points, n, u, 0, nPoints, vertices.data()); }));
+	BenchFetch(points, n, u, vertices, triangles, "file");
+	vector<int3> shuffled(triangles);
+	std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+	BenchFetch(points, n, u, vertices, shuffled, "shuffled");
+}
+
+// Rays
+
+void CameraRays(vec3 min, vec3 max, int width, vector<vec3> &origins, vector<vec3> &directions) {
+	// width*width rays from an eye outside the bounds, through a grid spanning the middle of the view
+	vec3 center = .5f*(min+max);
+	float r = length(max-min);
+	vec3 eye = center+vec3(.3f*r, .4f*r, 1.5f*r), forward = normalize(center-eye);
+	vec3 right = normalize(cross(forward, vec3(0, 1, 0))), up = cross(right, forward);
+	for (int y = 0; y < width; y++)
+		for (int x = 0; x < width; x++) {
+			origins.push_back(eye);
+			directions.push_back(forward+(.6f*(x+.5f)/width-.3f)*right+(.6f*(y+.5f)/width-.3f)*up);
+		}
+}
+
+void RandomRays(vector<vec3> &points, vector<int3> &triangles, vec3 min, vec3 max, int n,
+				vector<vec3> &origins, vector<vec3> &directions) {
+	// rays from around the mesh, aimed in turn at a vertex, an edge midpoint (shared edges test
+	// watertightness), and a random point within the bounds
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> u(0, 1);
+	vec3 center = .5f*(min+max), size = max-min;
+	float r = length(size);
+	for (int i = 0; i < n; i++) {
+		int3 t = triangles[rng()%triangles.size()];
+		vec3 target = i%3 == 0? points[t.i1] : i%3 == 1? .5f*(points[t.i1]+points[t.i2]) :
+					  vec3(min.x+size.x*u(rng), min.y+size.y*u(rng), min.z+size.z*u(rng));
+		vec3 origin = center+2*r*normalize(vec3(u(rng)-.5f, u(rng)-.5f, u(rng)-.5f));
+		origins.push_back(origin);
+		directions.push_back(target-origin);
+	}
+}
+
+void BenchRaySet(MeshBvh &bvh, TriInfos &triInfos, vector<vec3> &origins, vector<vec3> &directions, const char *label) {
+	int n = (int) origins.size(), agree = 0;
+	vector<RayHit> ray(n), packet(n);
+	vector<int> line(n);
+	vector<float> alpha(n);
+	double tLine = Time([&]() {
+		for (int i = 0; i < n; i++)
+			line[i] = IntersectWithLine(origins[i], origins[i]+directions[i], triInfos, alpha[i]);
+	});
+	double tRay = Time([&]() {
+		for (int i = 0; i < n; i++)
+			bvh.IntersectRay(origins[i], directions[i], ray[i]);
+	});
+	double tPacket = Time([&]() {
+		for (int i = 0; i < n; i += 8)
+			bvh.IntersectPacket(&origins[i], &directions[i], std::min(8, n-i), &packet[i]);
+	});
+	for (int i = 0; i < n; i++)
+		agree += line[i] == ray[i].triangle;
+	printf("  %-10s %6d rays, Mrays/s: IntersectWithLine %5.2f, IntersectRay %5.2f, IntersectPacket %5.2f\n",
+		   label, n, n/tLine/1e6, n/tRay/1e6, n/tPacket/1e6);
+	printf("  %-10s packet %s ray; line and ray hit the same triangle for %d rays\n", "",
+		   memcmp(ray.data(), packet.data(), n*sizeof(RayHit))? "DIFFERS from" : "equals", agree);
+}
+
+void BenchRays(vector<vec3> &points, vector<int3> &triangles) {
+	// picks through the hierarchy against the linear search, then each kernel on coherent and incoherent
+	// rays, then the kernels alone (a tree of one leaf, so every ray tests every triangle)
+	vector<TriInfo> linear;
+	TriInfos triInfos;
+	vec3 min, max;
+	ComputeBounds(points, min, max);
+	printf("rays:\n");
+	printf("  %-24s %7.3f s\n", "BuildTriInfos (linear)", Time([&]() { BuildTriInfos(points, triangles, linear); }, 1));
+	printf("  %-24s %7.3f s\n", "BuildTriInfos (TriInfos)", Time([&]() { BuildTriInfos(points, triangles, triInfos); }, 1));
+	MeshBvh &bvh = *triInfos.bvh;
+	vector<vec3> origins, directions;
+	CameraRays(min, max, 256, origins, directions);
+	int nLinear = 64, same = 0;
+	double tLinear = Time([&]() {
+		same = 0;
+		for (int i = 0; i < nLinear; i++) {
+			float a, b;
+			vec3 p2 = origins[i*1021]+directions[i*1021];
+			same += IntersectWithLine(origins[i*1021], p2, linear, a) == IntersectWithLine(origins[i*1021], p2, triInfos, b) && a == b;
+		}
+	}, 1);
+	printf("  %-24s %7.3f ms/pick (%d of %d picks the same through TriInfos)\n", "linear pick", 1000*tLinear/nLinear, same, nLinear);
+	BenchRaySet(bvh, triInfos, origins, directions, "coherent");
+	vector<vec3> o, d;
+	RandomRays(points, triangles, min, max, 65536, o, d);
+	BenchRaySet(bvh, triInfos, o, d, "incoherent");
+	MeshBvh leaf = bvh;
+	BvhNode root = leaf.nodes[0];
+	root.first = 0;
+	root.count = (int) triangles.size();
+	leaf.nodes = {root};
+	vector<vec3> o8, d8;                    // the 8 by 8 camera rays around the center of the view
+	for (int i = 0; i < 64; i++) {
+		o8.push_back(origins[(124+i/8)*256+124+i%8]);
+		d8.push_back(directions[(124+i/8)*256+124+i%8]);
+	}
+	double nTests = 64.*triangles.size()/1e6;
+	double tTri = Time([&]() { for (int i = 0; i < 64; i++) { float a; leaf.Intersect(o8[i], o8[i]+d8[i], a); } }, 1);
+	double tRay = Time([&]() { for (int i = 0; i < 64; i++) { RayHit h; leaf.IntersectRay(o8[i], d8[i], h); } }, 1);
+	double tPacket = Time([&]() { RayHit h[8]; for (int i = 0; i < 64; i += 8) leaf.IntersectPacket(&o8[i], &d8[i], 8, h); }, 1);
+	printf("  kernel alone, M tests/s: TriInfo %.0f, watertight %.0f, packet %.0f\n", nTests/tTri, nTests/tRay, nTests/tPacket);
+}
+
+void BenchBatch(vector<vec3> &points, vector<int3> &triangles) {
+	// IntersectRays over a 512 by 512 camera view, on the shared pool and on new threads, then the
+	// dispatch cost of small batches
+	TriInfos triInfos;
+	BuildTriInfos(points, triangles, triInfos);
+	MeshBvh &bvh = *triInfos.bvh;
+	vec3 min, max;
+	ComputeBounds(points, min, max);
+	vector<vec3> origins, directions;
+	CameraRays(min, max, 512, origins, directions);
+	int n = (int) origins.size();
+	vector<RayHit> single(n), batch(n);
+	printf("batch (hardware threads: %d, pool threads: %d):\n", NumThreads(), SharedPool().Size());
+	double t = Time([&]() { for (int i = 0; i < n; i++) bvh.IntersectRay(origins[i], directions[i], single[i]); });
+	printf("  %-24s %6.2f Mrays/s\n", "IntersectRay per ray", n/t/1e6);
+	for (int nThreads = 0; ; nThreads = std::min(nThreads? 2*nThreads : 1, NumThreads())) {
+		t = Time([&]() { bvh.IntersectRays(origins.data(), directions.data(), n, batch.data(), false, -HUGE_VALF, FLT_MAX, nThreads); });
+		bool same = !memcmp(single.data(), batch.data(), n*sizeof(RayHit));
+		string label = nThreads? "IntersectRays, "+std::to_string(nThreads)+(nThreads > 1? " threads" : " thread") : "IntersectRays, pool";
+		printf("  %-24s %6.2f Mrays/s%s\n", label.c_str(), n/t/1e6, same? "" : " (hits DIFFER)");
+		if (nThreads == NumThreads())
+			break;
+	}
+	int m = 256, reps = 1000, nNew = std::max(4, NumThreads());
+	auto PerBatch = [&](int nThreads) {
+		return 1e6*Time([&]() {
+			for (int k = 0; k < reps; k++)
+				bvh.IntersectRays(origins.data(), directions.data(), m, batch.data(), false, -HUGE_VALF, FLT_MAX, nThreads);
+		})/reps;
+	};
+	printf("  256-ray batch, us: 1 thread %.1f, pool %.1f, %d new threads %.1f\n", PerBatch(1), PerBatch(0), nNew, PerBatch(nNew));
+}
+
+// Main
+
+bool Want(int ac, char **av, const char *test) {
+	if (ac < 3) return true;
+	for (int i = 2; i < ac; i++)
+		if (!strcmp(av[i], test)) return true;
+	return false;
+}
+
+int main(int ac, char **av) {
+	if (ac < 2) {
+		printf("usage: MeshBench file.obj [read] [write] [normals] [layout] [rays] [batch]\n");
+		return 1;
+	}
+	if (Want(ac, av, "read"))
+		BenchRead(av[1], 1536);
+	vector<vec3> points, normals;
+	vector<vec2> uvs;
+	vector<int3> triangles;
+	double t = Now();
+	if (!ReadObjParallel(av[1], points, triangles, &normals, &uvs)) {
+		printf("can't read %s\n", av[1]);
+		return 1;
+	}
+	printf("%s: %d points, %d triangles, read in %.3f s\n", av[1], (int) points.size(), (int) triangles.size(), Now()-t);
+	if (Want(ac, av, "write"))
+		BenchWrite(av[1], points, normals, uvs, triangles);
+	if (Want(ac, av, "normals")) {
+		BenchNormals(points, triangles, "file");
+		vector<vec3> p(points);
+		vector<int3> t(triangles);
+		Shuffle(p, t);
+		BenchNormals(p, t, "shuffled");
+	}
+	if (Want(ac, av, "layout"))
+		BenchLayout(points, normals, uvs, triangles);
+	if (Want(ac, av, "rays"))
+		BenchRays(points, triangles);
+	if (Want(ac, av, "batch"))
+		BenchBatch(points, triangles);
+	return 0;
+}
@@ -0,0 +1,30 @@
+// MeshSplit.cpp: split a large OBJ file into spatially coherent cells, each small enough to load on its own
+// usage: MeshSplit file.obj outputPrefix [budgetMB] (default 256 MB; cells written as outputPrefix_<n>.obj)
+
+#include "MeshIO.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int ac, char **av) {
+	if (ac < 3) {
+		printf("usage: MeshSplit file.obj outputPrefix [budgetMB]\n");
+		return 1;
+	}
+	int budget = ac > 3? atoi(av[3]) : 256;
+	if (budget <= 0) {
+		printf("bad memory budget %s\n", av[3]);
+		return 1;
+	}
+	vector<string> names;
+	auto start = std::chrono::steady_clock::now();
+	if (!SplitObj(av[1], av[2], (size_t) budget << 20, &names)) {
+		printf("can't split %s\n", av[1]);
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	printf("%s: %d cells in %.2f s (budget %d MB)\n", av[1], (int) names.size(), seconds, budget);
+	for (size_t i = 0; i < names.size(); i++)
+		printf("  %s\n", names[i].c_str());
+	return 0;
+}
@@ -5,8 +5,12 @@
 
 #include <glad.h>
 #include <stdio.h>
+#include <future>
+#include <memory>
 #include <vector>
 #include "CameraArcball.h"
+#include "MeshOptimize.h"
+#include "MeshProcess.h"
 #include "VecMat.h"
 
 using std::string;
@@ -17,6 +21,32 @@ using std::vector;
 GLuint GetMeshShader();
 GLuint UseMeshShader();
 
+struct MeshLoad;
+
+struct MeshMaterial {
+    string name, textureFile;               // textureFile empty if none
+    vec3 ambient, diffuse = vec3(1, 1, 1), specular;
+    float shininess = 0, opacity = 1;
+    GLuint textureName = 0;
+    int firstTriangle = 0, nTriangles = 0;  // contiguous range of Mesh::triangles
+    int firstMeshlet = 0, nMeshlets = 0;    // contiguous range of Mesh::meshlets, covering the above
+};
+
+struct MeshLod {
+    // a simplified detail level, drawn from a range of Mesh::lodTriangles (see MeshSimplify.h)
+    int firstTriangle = 0, nTriangles = 0;
+    float error = 0;                        // largest distance (in point units) from the full-detail surface
+    vector<int2> materialRanges;            // first triangle and count per Mesh::materials entry
+};
+
+struct MeshDrawStats {
+    // set by each Mesh::Display
+    int level = 0;                          // 0: full detail, i: Mesh::lods[i-1]
+    int triangles = 0, fullTriangles = 0;   // submitted, and at full detail
+    float pixelError = 0;                   // level's error projected to the viewport
+    int meshlets = 0, meshletsDrawn = 0;    // at full detail, meshlets tested and not culled
+};
+
 class Mesh {
 public:
 	Mesh() { };
@@ -26,19 +56,85 @@ public:
     vector<vec3> normals;
     vector<vec2> uvs;
     vector<int3> triangles;
+    // if buildTangents, Read (or ReadAsync) sets tangents (see ComputeTangents in MeshProcess.h), which Buffer
+    // uploads after the vertices; with tangents, a normal map (encoded as by GetNormals, in Misc.h) bound to
+    // normalMapName and normalMapUnit (distinct from textureUnit) perturbs normals in Display
+    bool buildTangents = false;
+    vector<vec4> tangents;
+    GLuint normalMapName = 0, normalMapUnit = 0;
+    // if keepSoA, Read (or ReadAsync) also copies points to separate x, y, z arrays for SIMD kernels
+    bool keepSoA = false;
+    PointsSoA pointsSoA;
+    // OBJ materials, in draw order (sorted by texture, then diffuse color); if empty, the mesh
+    // is drawn in one call with textureName, as are materials without a texture map
+    vector<MeshMaterial> materials;
     // object to world space
     mat4 transform;
     // GPU vertex buffer and texture
     GLuint vBufferId = 0;
+    // GPU index buffer: triangles, then lodTriangles
+    GLuint iBufferId = 0;
+    // GPU vertex layout, set before Read or Buffer: if interleaved, each vertex's point, normal, and uv
+    // are adjacent (interleavedFloats per vertex); else the buffer holds all points, then normals, then uvs
+    bool interleaved = true;
 	GLuint textureName = 0, textureUnit = 0;
+    // if true, Read reuses (or creates) a binary sidecar of the normalized mesh (see MeshCache.h); off by
+    // default, as it writes next to the source file
+    bool useCache = false;
+    // if true, Read (or ReadAsync) reorders triangles for the post-transform vertex cache and vertices for
+    // fetch locality (see MeshOptimize.h), and prints ACMR and ATVR before and after
+    bool optimizeVertexCache = false;
+    // if also true, clusters of each material's triangles are then sorted to draw likely occluders first,
+    // and overdraw measured by a software rasterizer is printed before and after
+    bool optimizeOverdraw = false;
+    // if true, Read (or ReadAsync) groups each material's triangles (or all), after any reordering above,
+    // into meshlets (which then set the order, reordered within each if optimizeVertexCache), and Display
+    // skips meshlets outside the view and, if cullBackMeshlets (closed meshes only), those facing away
+    bool buildMeshlets = false, cullBackMeshlets = false;
+    vector<Meshlet> meshlets;
+    // if true, Read (or ReadAsync) builds a chain of simplified levels, each about half the triangles of
+    // the one before, stored together in lodTriangles; lods[0] is the first simplified level (the full mesh
+    // is triangles); levels index points, normals, and uvs, so share the vertex buffer
+    bool buildLods = false;
+    vector<int3> lodTriangles;
+    vector<MeshLod> lods;
+    vec3 lodCenter;                         // bounding sphere of points, set with lods
+    float lodRadius = 0;
+    // Display draws the coarsest level whose error, projected to the viewport, is under lodPixelError pixels,
+    // but moves to a coarser level only once its error is under lodPixelError/(1+lodHysteresis), so a mesh
+    // near a threshold doesn't alternate between levels
+    float lodPixelError = 1, lodHysteresis = .5f;
+    int lod = 0;                            // level last drawn (0: full detail)
+    MeshDrawStats drawStats;
+    // asynchronous loading: vertex and index buffers complete, bytes uploaded so far, background read (if any)
+    bool resident = false;
+    size_t uploadedBytes = 0, uploadBytesPerFrame = 8 << 20;
+    std::shared_ptr<MeshLoad> pending;
     // operations
     void Buffer();
     void Display(CameraAB &camera);
+        // skip mesh if not resident; if a background read has finished, first upload up to uploadBytesPerFrame
+        // with materials, draw each material's range, changing texture and color only when they differ
+        // with lods, draw the level chosen by SelectLod; at full detail, draw only meshlets MeshletVisible
+        // (see MeshOptimize.h), as one glMultiDrawElements per material; set drawStats
+    void DisplayIds(CameraAB &camera, int id);
+        // for GPU picking (see MeshPick.h): draw id and triangle index (at full detail) to each covered pixel,
+        // skipping meshlets MeshletVisible rejects; skip mesh if not resident
+    int SelectLod(mat4 &modelview, mat4 &persp, int viewportHeight);
+        // set and return lod for an object to eye transform (camera modelview times transform) and projection
     bool Read(string filename, mat4 *m = NULL);
         // read in object file (with normals, uvs) and texture file, initialize matrix, build vertex buffer
+        // for OBJ files with usemtl, read material libraries, sort triangles by material, load textures
     bool Read(string objFilename, string texFilename, int textureUnit, mat4 *m = NULL);
         // read in object file (with normals, uvs) and texture file, initialize matrix, build vertex buffer
 		// textureUnit must be > 0
+    std::shared_future<bool> ReadAsync(string filename, mat4 *m = NULL);
+        // queue file to be read and normalized on a background thread (one file at a time, in request order);
+        // future becomes true when arrays are ready to upload, false if file can't be read
+        // arrays are moved into the mesh and uploaded on the calling (GL) thread, by Upload or Display
+    bool Upload(size_t maxBytes);
+        // if a background read has finished, continue the vertex buffer upload by up to maxBytes
+        // call from the GL thread; return true if mesh is resident
 };
 
 // Read STL Format
@@ -80,6 +176,7 @@ void Normalize(vector<VertexSTL> &vertices, float scale = 1);
 
 void SetVertexNormals(vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals);
     // compute/recompute vertex normals as the average of surrounding triangle normals
+    // (see ComputeVertexNormals in MeshProcess.h for area or angle weighting)
 
 // Intersection with a Line
 
@@ -92,10 +189,13 @@ struct TriInfo {
 };
 
 void BuildTriInfos(vector<vec3> &points, vector<int3> &triangles, vector<TriInfo> &triInfos);
-    // for interactive selection
+    // for interactive selection (for larger meshes, declare a TriInfos, MeshBvh.h, in place of the vector)
+
+bool IntersectTriInfo(vec3 p1, vec3 p2, TriInfo &t, float &alpha);
+    // true if the line p1p2 crosses t, at p1+alpha*(p2-p1)
 
 int IntersectWithLine(vec3 p1, vec3 p2, vector<TriInfo> &triInfos, float &alpha);
-    // return triangle index of nearest intersected triangle, or -1 if none
+    // return triangle index of nearest intersected triangle (least alpha, then least index), or -1 if none
     // intersection = p1+alpha*(p2-p1)
 
 #endif
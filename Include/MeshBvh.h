@@ -0,0 +1,111 @@
+// MeshBvh.h - bounding volume hierarchy for line queries against mesh triangles
+
+#ifndef MESH_BVH_HDR
+#define MESH_BVH_HDR
+
+#include <float.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+#include "Mesh.h"
+#include "VecMat.h"
+
+using std::vector;
+
+struct BvhNode {
+    vec3 min;
+    int first = 0;                          // leaf: first slot of its triangles; interior: index of first child
+    vec3 max;
+    int count = 0;                          // leaf: # triangles (> 0); interior: 0, second child at first+1
+};
+
+struct RayHit {
+    int triangle = -1;
+    float alpha = FLT_MAX;                  // hit at origin+alpha*direction
+    float u = 0, v = 0;                     // barycentrics of the triangle's second and third vertices
+};
+
+const int rayRun = 64;                      // consecutive rays IntersectRays gives one thread at a time
+const int cornerPad = 7;                    // corners arrays extend past the last slot by this much, for wide loads
+
+class MeshBvh {
+public:
+    vector<BvhNode> nodes;                  // siblings adjacent; nodes[0] is the root
+    vector<int> order;                      // triangle index of each leaf slot
+    vector<TriInfo> infos;                  // TriInfo of each leaf slot
+    vector<float> corners[9];               // of each leaf slot: first vertex x, y, z, then second, then third
+    vector<int> parents;                    // parent of each node (-1: root); children follow their parent
+    vector<int> slots;                      // leaf slot of each triangle
+    vector<int> leaves;                     // leaf node of each slot
+    float pad = 0;                          // node bounds grow triangle bounds by this
+    float builtCost = 0;                    // Cost when built
+    void Build(vector<vec3> &points, vector<int3> &triangles, int nThreads = 0);
+        // build over triangles by binned surface area heuristic (subtrees built in parallel on nThreads,
+        // 0: all); the tree doesn't depend on nThreads
+    void Refit(vector<vec3> &points, vector<int3> &triangles, const vector<int> &changed);
+        // after points of the changed triangles (indices) move, triangles themselves unchanged: update their
+        // slots, their leaves' bounds and ancestors' bounds up to where bounds don't change; the tree's
+        // shape is kept, so Cost rises as triangles move far (a point beyond pad's reach refits all)
+    void Refit(vector<vec3> &points, vector<int3> &triangles, int nThreads = 0);
+        // after any points move (triangles unchanged): update all slots and bounds, slots and leaves in parallel
+    int Intersect(vec3 p1, vec3 p2, float &alpha, bool anyHit = false,
+                  float minAlpha = -HUGE_VALF, float maxAlpha = FLT_MAX);
+        // as IntersectWithLine (Mesh.h) for triangles hit at minAlpha <= alpha < maxAlpha: the nearest (least
+        // alpha, then least triangle index), or if anyHit any one; return triangle index, or -1 (alpha maxAlpha)
+    int IntersectRay(vec3 origin, vec3 direction, RayHit &hit, bool anyHit = false,
+                     float minAlpha = -HUGE_VALF, float maxAlpha = FLT_MAX);
+        // watertight test (no line slips between triangles sharing an edge), 4 or 8 triangles at a time
+        // with SSE2 or AVX; hit and tie rules as Intersect; return hit.triangle
+    void IntersectPacket(const vec3 *origins, const vec3 *directions, int nRays, RayHit *hits, bool anyHit = false,
+                         float minAlpha = -HUGE_VALF, float maxAlpha = FLT_MAX);
+        // as IntersectRay for each ray; groups of 4 or 8 rays whose major axes agree (such as coherent
+        // camera rays) traverse together, each triangle tested against the group at once
+    void IntersectRays(const vec3 *origins, const vec3 *directions, int nRays, RayHit *hits, bool anyHit = false,
+                       float minAlpha = -HUGE_VALF, float maxAlpha = FLT_MAX, int nThreads = 0);
+        // as IntersectPacket, in runs of rayRun rays spread over threads: SharedPool (Parallel.h) if
+        // nThreads is 0, else nThreads new threads; hits don't depend on nThreads
+    float Cost();
+        // surface area heuristic cost of the tree, relative to its root's area (kept by Build and Refit)
+private:
+    double weightedArea = 0;                // sum of node areas, leaves' times their counts
+    void SetSlot(int slot, vector<vec3> &points, vector<int3> &triangles);
+    void SetBounds(int node, const vec3 &min, const vec3 &max);
+};
+
+// Picking
+
+struct BvhRebuild;                          // a hierarchy built on a detached thread (MeshBvh.cpp)
+
+struct TriInfos {
+    // triangles for interactive selection, owning a hierarchy over them: declared in place of
+    // vector<TriInfo>, BuildTriInfos and IntersectWithLine calls pick in logarithmic time; the hierarchy
+    // keeps its own copy of each triangle, so after points move, update it with UpdateTriInfos
+    std::shared_ptr<MeshBvh> bvh;
+    vector<int> pointStarts, pointTriangles;    // triangles of each point, set by the first UpdateTriInfos
+    std::shared_ptr<BvhRebuild> rebuild;        // started once refits degrade bvh; shared with its thread,
+                                                // so dropping a TriInfos never waits for a rebuild
+    vector<int> moved;                          // triangles moved since the rebuild started
+    bool allMoved = false;
+};
+
+void BuildTriInfos(vector<vec3> &points, vector<int3> &triangles, TriInfos &triInfos);
+    // build the hierarchy over triangles (in parallel), replacing any earlier one
+
+void UpdateTriInfos(vector<vec3> &points, vector<int3> &triangles, TriInfos &triInfos, const vector<int> &movedPoints);
+    // after movedPoints (indices, such as a point dragged by Mover) move, refit the hierarchy along their
+    // triangles' paths, in microseconds; once refits degrade the hierarchy, a rebuild starts in the background,
+    // and a later update swaps it in (triangles must be unchanged; don't intersect during an update)
+
+void UpdateTriInfos(vector<vec3> &points, vector<int3> &triangles, TriInfos &triInfos);
+    // as above, after any points move (deforming the whole mesh); the hierarchy is refit in parallel
+    // a rigid motion (a mesh transform, as set by Framer) needs no update: intersect with the line in object space
+
+int IntersectWithLine(vec3 p1, vec3 p2, TriInfos &triInfos, float &alpha);
+    // as IntersectWithLine (Mesh.h), same triangle and alpha
+
+void IntersectWithRays(TriInfos &triInfos, const vec3 *origins, const vec3 *directions, int nRays,
+                       RayHit *hits, int nThreads = 0);
+    // for each ray, the nearest intersected triangle (as IntersectWithLine, with p1 origin and p2 origin+direction),
+    // its alpha and barycentrics; spread over threads as MeshBvh::IntersectRays
+
+#endif
@@ -0,0 +1,42 @@
+// MeshCache.h - binary mesh sidecar files for fast reload
+
+#ifndef MESH_CACHE_HDR
+#define MESH_CACHE_HDR
+
+#include <string>
+#include <vector>
+#include "VecMat.h"
+
+using std::string;
+using std::vector;
+
+struct ObjMaterials;
+
+// a cache file holds a header (version, source file time and size, normalization scale,
+// object transform and bounds) followed by 16-byte aligned arrays of points, normals, uvs,
+// and triangles, stored exactly as they are kept in memory, then any OBJ material names
+// and per-triangle material ids
+
+struct MeshCacheInfo {
+    float normalizeScale = 1;   // scale given to Normalize (0 if not normalized)
+    mat4 transform;             // original to normalized coordinates
+    vec3 min, max;              // bounds of original (unnormalized) points
+};
+
+string MeshCacheName(const char *sourceName);
+    // sidecar name for given source file
+
+bool WriteMeshCache(const char *cacheName, const char *sourceName, MeshCacheInfo &info,
+                    vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                    ObjMaterials *materials = NULL);
+    // save arrays and info (and materials, if non-null); sourceName's modification time and size are
+    // recorded for validation
+
+bool ReadMeshCache(const char *cacheName, const char *sourceName, float normalizeScale,
+                   vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                   MeshCacheInfo *info = NULL, ObjMaterials *materials = NULL);
+    // map cache file and copy its arrays; return false if cache is missing, corrupt, of another version,
+    // normalized with a different scale, or older than (or of a different size than) sourceName
+    // if materials non-null, replace its contents with those saved (empty if none were)
+
+#endif
@@ -0,0 +1,162 @@
+// MeshIO.h - fast mesh file input and output
+
+#ifndef MESH_IO_HDR
+#define MESH_IO_HDR
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "VecMat.h"
+
+using std::string;
+using std::vector;
+
+// Memory-Mapped File (read-only)
+
+class MappedFile {
+public:
+    const char *data = NULL;
+    size_t size = 0;
+    bool Open(const char *filename);
+        // map entire file into memory; return false if file can't be opened or mapped
+    void Close();
+    MappedFile() { }
+    MappedFile(const char *filename) { Open(filename); }
+    ~MappedFile() { Close(); }
+private:
+    void *file = NULL, *mapping = NULL;
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+// Number Parsing
+
+bool ParseFloat(const char *&ptr, const char *end, float &f);
+    // skip blanks, parse float at ptr (not beyond end), advance ptr; return false if no number
+
+bool ParseInt(const char *&ptr, const char *end, int &i);
+    // as above, for (optionally signed) decimal integer
+
+// Number Formatting
+
+int FormatFloat(char *out, float f);
+    // write shortest decimal that parses back to f (at most 16 chars, not null-terminated); return # chars
+    // magnitudes beyond about 1e-13..1e30 get 9 significant digits, which also round-trip
+
+int FormatInt(char *out, int i);
+    // write decimal i (at most 11 chars, not null-terminated); return # chars
+
+// Read OBJ Format via Memory Map
+
+struct ObjMaterials {
+    vector<string> libraries;               // mtllib file names, as given
+    vector<string> names;                   // usemtl names, in order of first use
+    vector<int>    triangleMaterials;       // index into names of each triangle read, -1 if none
+};
+
+bool ReadObjMapped(const char   *filename,
+                   vector<vec3> &points,
+                   vector<int3> &triangles,
+                   vector<vec3> *normals = NULL,
+                   vector<vec2> *textures = NULL,
+                   vector<int>  *triangleGroups = NULL,
+                   vector<int4> *quads = NULL,
+                   ObjMaterials *materials = NULL);
+    // same arguments and output as ReadAsciiObj, but parse in place from a mapped file
+    // and dedupe vertex/uv/normal triplets with a hash table rather than a map
+    // if materials non-null, also record mtllib and usemtl (materials of quads are not recorded)
+
+bool ReadObjParallel(const char   *filename,
+                     vector<vec3> &points,
+                     vector<int3> &triangles,
+                     vector<vec3> *normals = NULL,
+                     vector<vec2> *textures = NULL,
+                     vector<int>  *triangleGroups = NULL,
+                     vector<int4> *quads = NULL,
+                     ObjMaterials *materials = NULL,
+                     int          nThreads = 0);
+    // as ReadObjMapped, but parse newline-aligned chunks of the file on nThreads workers
+    // (0: all hardware threads) and merge them by prefix sums over the per-chunk counts;
+    // vertex numbering and triangle order are identical to the serial readers
+
+// OBJ Material Library
+
+struct ObjMaterial {
+    string name;
+    vec3 ambient, diffuse = vec3(1, 1, 1), specular;        // Ka, Kd, Ks
+    float shininess = 0, opacity = 1;                       // Ns, d (or 1-Tr)
+    string diffuseMap;                                      // map_Kd, as given (relative to the MTL file)
+};
+
+bool ReadMtl(const char *filename, vector<ObjMaterial> &materials);
+    // append materials defined by newmtl; other statements ignored; return false if file unreadable
+
+// Streaming OBJ Input (bounded memory)
+
+struct ObjBatch {
+    int firstVertex = 0, firstNormal = 0, firstUv = 0;     // file-wide index of batch's first v, vn, vt
+    vector<vec3> vertices, normals;                         // v and vn records, in file order
+    vector<vec2> uvs;                                       // vt records
+    vector<int3> corners;                                   // file-wide (vid, tid, nid) of each face corner, from 0
+    vector<int>  faceSizes;                                 // # corners of each face
+    vector<int>  faceGroups;                                // integer group of each face
+    size_t Bytes();
+    void Clear();                                           // empty arrays, advance first indices
+};
+
+typedef std::function<bool(ObjBatch &batch)> ObjBatchFn;
+    // called for each batch; return false to stop reading
+
+bool StreamObj(const char *filename, ObjBatchFn visit, size_t batchBytes = 16 << 20);
+    // read file a buffer at a time, passing records to visit in batches of about batchBytes;
+    // faces refer to v, vn, vt in the same or preceding batches; corners are as given (not validated)
+    // materials (usemtl, mtllib) are ignored
+    // memory use is about batchBytes plus a 1 MB read buffer; return false if unreadable or malformed
+
+bool SplitObj(const char *filename, const char *outputPrefix, size_t memoryBudget = 256 << 20,
+              vector<string> *outputNames = NULL);
+    // partition faces among a grid of spatially coherent cells (placed at per-axis point quantiles) so
+    // each cell's working set fits about memoryBudget; write each non-empty cell, re-indexed with its own
+    // copy of the vertices it uses, as <outputPrefix>_<n>.obj; temporary files are written alongside
+    // source points are paged in from a spooled binary copy rather than held in memory; grids of more than
+    // 256 cells re-read the source once per 256 cells
+
+// Read STL Format as Indexed Mesh
+
+bool IsAsciiSTL(const char *filename);
+    // true if file begins with "solid" and its size doesn't fit the binary format's triangle count
+
+int ReadAsciiSTL(const char *filename, vector<vec3> &facets);
+    // append four vec3s per facet (normal, then vertices, as given in file); return # facets
+
+int ReadSTL(const char *filename, vector<vec3> &points, vector<int3> &triangles, vector<vec3> *normals = NULL);
+    // read binary or ASCII STL, orient each facet to agree with its normal, weld coincident vertices;
+    // append to points and triangles (and, if non-null, vertex normals averaged from facet normals)
+    // return # triangles read
+
+// Read PLY Format
+
+bool ReadPly(const char *filename, vector<vec3> &points, vector<int3> &triangles,
+             vector<vec3> *normals = NULL, vector<vec2> *uvs = NULL, vector<vec3> *colors = NULL, int nThreads = 0);
+    // read ASCII or binary (either byte order) PLY; append vertex and face elements to points and triangles,
+    // fanning polygons; append normals (nx ny nz), uvs (u v or s t), and colors (red green blue, scaled 0-1)
+    // only if non-null and present in the file; fixed-size binary vertex records are decoded in parallel
+    // return false if unreadable or malformed
+
+// Write OBJ, PLY, STL
+// output is formatted into large memory buffers, chunks in parallel on nThreads (0: all hardware threads),
+// and written with one fwrite per buffer
+
+bool WriteObjBuffered(const char *filename, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
+                      vector<int3> *triangles = NULL, vector<int4> *quads = NULL, int nThreads = 0);
+    // same layout as WriteAsciiObj (which calls this), with shortest round-trip floats rather than %f
+
+bool WritePly(const char *filename, vector<vec3> &points, vector<vec3> *normals, vector<vec2> *uvs,
+              vector<int3> &triangles, vector<vec3> *colors = NULL, int nThreads = 0);
+    // write binary little-endian PLY; normals, uvs, colors (as uchar) written if non-null and sized as points
+
+bool WriteSTL(const char *filename, vector<vec3> &points, vector<int3> &triangles, int nThreads = 0);
+    // write binary STL with facet normals from the triangles' right-hand rule
+
+#endif
@@ -0,0 +1,84 @@
+// MeshOptimize.h - reorder mesh triangles and vertices for the GPU
+
+#ifndef MESH_OPTIMIZE_HDR
+#define MESH_OPTIMIZE_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Post-Transform Vertex Cache
+
+struct VertexCacheStats {
+    float acmr = 0;                         // average cache miss ratio: vertex shader runs per triangle (0.5 to 3)
+    float atvr = 0;                         // average transformed vertex ratio: shader runs per vertex used (1 best)
+};
+
+VertexCacheStats MeasureVertexCache(vector<int3> &triangles, int nVertices, int cacheSize = 16,
+                                    int firstTriangle = 0, int nTriangles = -1);
+    // simulate a FIFO cache of cacheSize vertices drawing triangles (all, if nTriangles < 0)
+
+void OptimizeVertexCache(vector<int3> &triangles, int nVertices, int cacheSize = 16,
+                         int firstTriangle = 0, int nTriangles = -1);
+    // reorder the triangles of the range (all, if nTriangles < 0) for reuse of recently transformed
+    // vertices (Tipsify: Sander, Nehab, Barczak 2007); runs in time linear in the range
+    // each triangle keeps its winding; triangles outside the range are unchanged
+
+// Overdraw
+
+void OptimizeOverdraw(vector<int3> &triangles, vector<vec3> &points, float threshold = 1.05f, int cacheSize = 16,
+                      int firstTriangle = 0, int nTriangles = -1);
+    // reorder the range (all, if nTriangles < 0), which should already be vertex cache optimized, so that
+    // triangles likely to occlude others are drawn first (Sander, Nehab, Barczak 2007): split the range into
+    // clusters at cache restarts and wherever the cluster's ACMR falls within threshold of its enclosing run,
+    // then sort clusters by how far they face out from the range's centroid; ACMR grows by at most about threshold
+
+struct OverdrawStats {
+    long long covered = 0;                  // pixels covered, summed over views
+    long long shaded = 0;                   // fragments passing the depth test (and so shaded), summed over views
+    float overdraw = 0;                     // shaded/covered (1 best)
+};
+
+OverdrawStats MeasureOverdraw(vector<vec3> &points, vector<int3> &triangles, int resolution = 256, int nThreads = 0);
+    // rasterize the triangles, in order, with a depth buffer from 14 orthographic views (along the axes and the
+    // cube diagonals, both ways) at resolution^2 pixels, without face culling (as Mesh::Display draws)
+
+// Vertex Fetch
+
+int OptimizeVertexFetch(vector<int3> &triangles, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs);
+    // renumber vertices in order of first use by triangles, so vertex reads move forward through memory;
+    // permute points (and normals, uvs if sized as points) to match; unused vertices move to the end
+    // return # vertices used
+
+// Meshlets
+
+struct Meshlet {
+    int firstTriangle = 0, nTriangles = 0;  // range of triangles
+    int nVertices = 0;                      // distinct vertices
+    vec3 center;                            // bounding sphere
+    float radius = 0;
+    vec3 coneAxis;                          // average outward normal
+    float coneCutoff = 1;                   // sine of the cone's half angle, 1 if no eye sees only back faces
+};
+
+int BuildMeshlets(vector<int3> &triangles, vector<vec3> &points, vector<Meshlet> &meshlets,
+                  int maxVertices = 64, int maxTriangles = 124, int firstTriangle = 0, int nTriangles = -1);
+    // reorder the range (all, if nTriangles < 0) into meshlets of at most maxVertices and maxTriangles,
+    // each grown over shared vertices from the first unused triangle, taking the triangle that adds
+    // fewest vertices, then the one facing most nearly as the meshlet; append their bounds and cones
+    // to meshlets, return # appended; normals are outward (reversed if the range encloses negative volume)
+
+void OptimizeVertexCache(vector<int3> &triangles, int nVertices, vector<Meshlet> &meshlets, int cacheSize = 16);
+    // reorder each meshlet's triangles for the vertex cache, as above; a meshlet keeps its
+    // triangles, so its bounds and cone stay valid
+
+void FrustumPlanes(mat4 &m, vec4 planes[6]);
+    // set view frustum planes (inside positive) in the space m (e.g., persp*modelview) transforms to clip space
+
+bool MeshletVisible(Meshlet &m, vec4 planes[6], vec3 eye, bool cullBackFacing);
+    // false if m's bounding sphere is outside a plane or, if cullBackFacing, all its triangles face away
+    // from eye (in the planes' space); back-facing culling suits closed meshes only, as Display draws
+    // both sides of triangles
+
+#endif
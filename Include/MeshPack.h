@@ -0,0 +1,26 @@
+// MeshPack.h - quantized, entropy-coded mesh files
+
+#ifndef MESH_PACK_HDR
+#define MESH_PACK_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// a packed mesh stores points quantized to 16 bits within their bounding box, normals
+// octahedrally encoded in two 16-bit values, uvs as half floats, and triangle indices as
+// variable-length deltas; each 16-bit channel is delta coded and split into byte planes,
+// and every byte stream is compressed with an order-0 range coder (rANS)
+// vertices and triangles are coded in independent blocks, so both encode and decode run in parallel
+
+bool WritePackedMesh(const char *filename, vector<vec3> &points, vector<vec3> &normals,
+                     vector<vec2> &uvs, vector<int3> &triangles, int nThreads = 0);
+    // normals and uvs are stored only if sized as points; nThreads 0: all hardware threads
+
+bool ReadPackedMesh(const char *filename, vector<vec3> &points, vector<vec3> &normals,
+                    vector<vec2> &uvs, vector<int3> &triangles, int nThreads = 0);
+    // replace arrays with decoded mesh (normals, uvs empty if not stored);
+    // return false if file is missing, of another version, or corrupt
+
+#endif
@@ -0,0 +1,59 @@
+// MeshPick.h - GPU picking: mesh and triangle ids rendered offscreen, read back without stalling
+
+#ifndef MESH_PICK_HDR
+#define MESH_PICK_HDR
+
+#include "glad.h"
+
+// a pick pass draws each mesh with Mesh::DisplayIds into an integer framebuffer (mesh id+1 and triangle
+// index per pixel, 0 where empty) with drawing limited to a small region around the cursor; End queues
+// a copy of the region into a pixel buffer, and Poll reads it once the GPU has finished, frames later
+// if need be, so neither call waits on the GPU:
+//
+//     if (picker.Begin(x, y, width, height)) {
+//         for (int i = 0; i < nMeshes; i++)
+//             meshes[i].DisplayIds(camera, i);
+//         picker.End();
+//     }
+//     PickHit hit;
+//     if (picker.Poll(hit) && hit.mesh >= 0)
+//         ...                                  // meshes[hit.mesh].triangles[hit.triangle]
+
+struct PickHit {
+    int mesh = -1, triangle = -1;           // -1 if no mesh covers the region
+    int x = 0, y = 0;                       // pixel of the hit, or the region's center if none
+};
+
+const int pickBuffers = 3;                  // readbacks in flight
+
+class MeshPicker {
+public:
+    int radius = 3;                         // region read: pixels within radius of the cursor on each axis
+    int width = 0, height = 0;              // of the framebuffer
+    GLuint framebuffer = 0, idBuffer = 0, depthBuffer = 0;  // renderbuffers: RG32UI ids, 24-bit depth
+    ~MeshPicker();
+    bool Begin(int x, int y, int width, int height);
+        // start a pick pass at pixel x, y (OpenGL window coordinates: origin lower left) of a width by height
+        // viewport: bind (creating or resizing) the framebuffer, clear the region around x, y and limit drawing
+        // to it, with depth test on; return false (nothing bound) if x, y is outside the viewport or the
+        // framebuffer can't be made
+    void End();
+        // restore the framebuffer, viewport, scissor, and depth test in use before Begin, and queue the readback
+    bool Poll(PickHit &hit);
+        // if a queued readback has finished, set hit from the latest such (the covered pixel nearest the cursor;
+        // ties to the lowest, then leftmost), drop any older ones, and return true; else return false at once
+    void Release();
+        // delete GPU resources (as does the destructor; call with the context current)
+private:
+    struct Readback {
+        GLuint buffer = 0;
+        GLsync fence = 0;
+        int x = 0, y = 0, w = 0, h = 0, cx = 0, cy = 0, serial = 0;
+    };
+    Readback readbacks[pickBuffers], region;   // region: of the pass begun
+    int serial = 0;
+    GLint previousDraw = 0, previousRead = 0, previousViewport[4], previousScissor[4];
+    GLboolean previousScissorTest = GL_FALSE, previousDepthTest = GL_FALSE;
+};
+
+#endif
@@ -0,0 +1,89 @@
+// MeshProcess.h - parallel operations over mesh arrays
+
+#ifndef MESH_PROCESS_HDR
+#define MESH_PROCESS_HDR
+
+#include <stddef.h>
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Bounds and Normalization
+// points are three floats, stride bytes apart (12 for packed vec3, sizeof(VertexSTL) for STL vertices);
+// packed points are processed four (SSE2) or, in /arch:AVX builds, eight at a time on nThreads (0: all)
+
+void ComputeBounds(const float *xyz, int count, size_t stride, vec3 &min, vec3 &max, int nThreads = 0);
+    // per-axis min and max of points (NaN coordinates ignored); if count is 0, min is FLT_MAX, max -FLT_MAX
+
+void ComputeBounds(vector<vec3> &points, vec3 &min, vec3 &max, int nThreads = 0);
+
+struct UnitFit {
+    vec3 min, max;                          // bounds of the points before the fit
+    vec3 center;                            // middle of the bounds
+    float scale = 1;                        // fitted point = scale*(point-center)
+};
+
+UnitFit FitToUnit(float *xyz, int count, size_t stride, float fitScale = 1,
+                  unsigned short *quantized = NULL, int nThreads = 0);
+    // translate and uniformly scale points in place so their largest extent spans -fitScale,+fitScale;
+    // if quantized non-null, also write three values per point mapping -fitScale,+fitScale to 0,65535
+    // (points that are all coincident are only centered)
+
+UnitFit FitToUnit(vector<vec3> &points, float fitScale = 1, unsigned short *quantized = NULL, int nThreads = 0);
+
+// Structure-of-Arrays Points
+// coordinates in separate arrays, so SIMD kernels load four (or eight) x, y, or z values per instruction
+// with no shuffles; the AoS vector<vec3> versions below are the scalar equivalents
+
+struct PointsSoA {
+    vector<float> x, y, z;
+    int Size() { return (int) x.size(); }
+};
+
+void ToSoA(vector<vec3> &points, PointsSoA &soa, int nThreads = 0);
+    // resize soa to points and copy coordinates
+
+void FromSoA(PointsSoA &soa, vector<vec3> &points, int nThreads = 0);
+    // resize points to soa and copy coordinates
+
+void ComputeBounds(PointsSoA &soa, vec3 &min, vec3 &max, int nThreads = 0);
+
+void TransformPoints(mat4 &m, vector<vec3> &points, int nThreads = 0);
+    // replace each point p with the affine transform m*(p, 1) (the bottom row of m is ignored)
+
+void TransformPoints(mat4 &m, PointsSoA &soa, int nThreads = 0);
+
+// Interleaved Vertices
+
+const int interleavedFloats = 8;            // point, normal, uv: 32 bytes per vertex
+
+void InterleaveVertices(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
+                        int first, int count, float *out, int nThreads = 0);
+    // write count vertices, from vertex first, as interleavedFloats each (normals and uvs sized as points)
+
+// Vertex Normals
+
+enum NormalWeight { WeightUniform, WeightArea, WeightAngle };
+    // contribution of a triangle to each of its vertices' normals: equal, in proportion
+    // to triangle area, or in proportion to the triangle's angle at the vertex
+
+void ComputeVertexNormals(vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals,
+                          NormalWeight weight = WeightAngle, int nThreads = 0);
+    // set normals (sized as points) to the unit weighted sum of adjacent triangle normals;
+    // vertices with no (non-degenerate) triangles get (0, 0, 1)
+    // corners are bucketed by vertex range, so each thread sums its own vertices without atomics;
+    // face normals and corner angles are computed 8 (AVX) or 4 (SSE2) triangles at a time
+
+// Tangents
+
+int ComputeTangents(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                    vector<vec4> &tangents, int nThreads = 0);
+    // set tangents (sized as points) to unit directions of increasing u, orthogonal to the normals, with w the
+    // handedness: the direction of increasing v is w*cross(normal, tangent); tangents of adjacent triangles
+    // are area weighted, and triangles with degenerate uvs don't contribute
+    // a vertex whose triangles map uvs with both handednesses (a mirrored uv seam) is split: a copy of its
+    // point, normal, and uv is appended for the triangles of negative handedness; return # vertices added
+    // (tangents empty, return -1, if normals or uvs aren't sized as points)
+
+#endif
@@ -0,0 +1,40 @@
+// MeshSimplify.h - quadric error mesh simplification and detail levels
+
+#ifndef MESH_SIMPLIFY_HDR
+#define MESH_SIMPLIFY_HDR
+
+#include <float.h>
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// edges are collapsed cheapest first (Garland and Heckbert 1997), each moving one vertex onto the
+// other, so simplified triangles index the original vertices and keep their normals and uvs;
+// vertices sharing a position (wedges on normal or uv seams) move together, and only along the seam,
+// each wedge to the wedge on its own side; borders collapse only along themselves; collapses that
+// would flip a triangle or pinch the surface are skipped
+// error is the area-weighted RMS distance (in point units) from the moved vertices to the planes
+// of the triangles merged into them, the largest over all collapses made so far
+
+struct LodLevel {
+    vector<int3> triangles;                 // indices into the original points, in original triangle order
+    vector<int>  sources;                   // original index of each triangle
+    float error = 0;
+};
+
+float Simplify(vector<vec3> &points, vector<int3> &triangles, LodLevel &level, int targetTriangles,
+               float maxError = FLT_MAX, int nCells = 0, int nThreads = 0);
+    // collapse until at most targetTriangles remain, or no collapse costs less than maxError; return error
+    // nCells > 1: partitioned mode, in which nCells spatially coherent groups of triangles are first
+    // simplified concurrently on nThreads (0: all), each with its shared vertices fixed, and the joined
+    // mesh is then finished serially; nCells 0: one cell per 64K triangles; nCells 1: serial
+    // results depend on nCells but not nThreads
+
+int SimplifyLods(vector<vec3> &points, vector<int3> &triangles, vector<LodLevel> &levels,
+                 float ratio = .5f, int minTriangles = 256, int nCells = 0, int nThreads = 0);
+    // set levels to successive simplifications, each about ratio times the triangles of the one before,
+    // stopping at minTriangles or when a level can't shrink its predecessor by a tenth; each level
+    // continues from the last, so errors don't decrease; return # levels (the original is not included)
+
+#endif
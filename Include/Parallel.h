@@ -0,0 +1,144 @@
+// Parallel.h - simple fork-join loops over worker threads
+
+#ifndef PARALLEL_HDR
+#define PARALLEL_HDR
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline int NumThreads() {
+    // hardware threads available (at least 1)
+    int n = (int) std::thread::hardware_concurrency();
+    return n > 0? n : 1;
+}
+
+template<class Task>
+void ParallelFor(int nTasks, Task task, int nThreads = 0) {
+    // call task(i) for 0 <= i < nTasks, distributing tasks dynamically over threads;
+    // the calling thread participates; returns when all tasks have finished
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    if (nThreads > nTasks)
+        nThreads = nTasks;
+    if (nThreads <= 1) {
+        for (int i = 0; i < nTasks; i++)
+            task(i);
+        return;
+    }
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i; (i = next++) < nTasks;)
+            task(i);
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; t++)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+template<class Task>
+void ParallelRange(int n, Task task, int grain = 4096, int nThreads = 0) {
+    // call task(begin, end) over consecutive subranges of [0, n), each at least grain long
+    // (except possibly the last)
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    int nRanges = (n+grain-1)/grain;
+    if (nRanges > 4*nThreads)
+        nRanges = 4*nThreads;
+    if (nRanges < 1)
+        nRanges = 1;
+    ParallelFor(nRanges, [&](int r) {
+        int begin = (int) ((long long) n*r/nRanges), end = (int) ((long long) n*(r+1)/nRanges);
+        if (begin < end)
+            task(begin, end);
+    }, nThreads);
+}
+
+class ThreadPool {
+    // persistent workers for loops run often (per frame, say), where starting threads would cost
+    // more than the work; one loop at a time: a loop started while another runs (from another
+    // thread, or from within a task) runs serially on its caller
+public:
+    ThreadPool(int nThreads = 0) {
+        // nThreads counts the calling thread (0: all hardware threads)
+        if (nThreads <= 0)
+            nThreads = NumThreads();
+        for (int t = 1; t < nThreads; t++)
+            threads.push_back(std::thread(&ThreadPool::Work, this));
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+    }
+    int Size() { return (int) threads.size()+1; }
+    template<class Task>
+    void For(int nTasks, Task task) {
+        // as ParallelFor, on the pool's threads
+        if (threads.empty() || nTasks <= 1 || running.exchange(true)) {
+            for (int i = 0; i < nTasks; i++)
+                task(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = task;
+            count = nTasks;
+            next = 0;
+            busy = (int) threads.size();
+            generation++;
+        }
+        wake.notify_all();
+        Loop();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return busy == 0; });
+        job = nullptr;
+        running = false;
+    }
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::function<void(int)> job;
+    std::atomic<bool> running{false};
+    std::atomic<int> next{0};
+    int count = 0, busy = 0, generation = 0;
+    bool quit = false;
+    void Loop() {
+        for (int i; (i = next++) < count;)
+            job(i);
+    }
+    void Work() {
+        for (int seen = 0;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return quit || generation != seen; });
+                if (quit)
+                    return;
+                seen = generation;
+            }
+            Loop();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+};
+
+inline ThreadPool &SharedPool() {
+    // pool of all hardware threads, started on first use and never destroyed (its threads may outlive main)
+    static ThreadPool *pool = new ThreadPool;
+    return *pool;
+}
+
+#endif
@@ -3,7 +3,14 @@
 #include "CameraArcball.h"
 #include "GLXtras.h"
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshIO.h"
+#include "MeshOptimize.h"
+#include "MeshPack.h"
+#include "MeshProcess.h"
+#include "MeshSimplify.h"
 #include "Misc.h"
+#include "Parallel.h"
 #include <assert.h>
 #include <iostream>
 #include <fstream>
@@ -11,6 +18,12 @@
 #include <float.h>
 #include <string.h>
 #include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 using std::string;
 using std::vector;
@@ -28,14 +41,17 @@ const char *meshVertexShader = R"(
     in vec3 point;
     in vec3 normal;
     in vec2 uv;
+    in vec4 tangent;
     out vec3 vPoint;
     out vec3 vNormal;
     out vec2 vUv;
+    out vec4 vTangent;
     uniform mat4 modelview;
     uniform mat4 persp;
     void main() {
         vPoint = (modelview*vec4(point, 1)).xyz;
         vNormal = (modelview*vec4(normal, 0)).xyz;
+        vTangent = vec4((modelview*vec4(tangent.xyz, 0)).xyz, tangent.w);
         gl_Position = persp*vec4(vPoint, 1);
         vUv = uv;
     }
@@ -46,23 +62,58 @@ const char *meshPixelShader = R"(
     in vec3 vPoint;
     in vec3 vNormal;
     in vec2 vUv;
+    in vec4 vTangent;
     out vec4 pColor;
     uniform vec3 light;
     uniform sampler2D textureName;
 	uniform int useTexture = 0;
+    uniform sampler2D normalMap;
+    uniform int useNormalMap = 0;
+    uniform vec3 diffuse = vec3(1);
     void main() {
         vec3 N = normalize(vNormal);       // surface normal
+        if (useNormalMap == 1) {
+            // tangent space normal, encoded as by GetNormals: x, y in [-1,1], z in [0,1]
+            vec3 c = texture(normalMap, vUv).rgb;
+            vec3 T = normalize(vTangent.xyz-dot(vTangent.xyz, N)*N);
+            vec3 B = vTangent.w*cross(N, T);
+            N = normalize(mat3(T, B, N)*vec3(2*c.r-1, 2*c.g-1, c.b));
+        }
         vec3 L = normalize(light-vPoint);  // light vector
         vec3 E = normalize(vPoint);        // eye vector
         vec3 R = reflect(L, N);            // highlight vector
         float d = abs(dot(N, L));          // two-sided diffuse
         float s = abs(dot(R, E));          // two-sided specular
         float intensity = clamp(d+pow(s, 50), 0, 1);
-        vec3 color = useTexture == 1? texture(textureName, vUv).rgb : vec3(1);
+        vec3 color = diffuse*(useTexture == 1? texture(textureName, vUv).rgb : vec3(1));
         pColor = vec4(intensity*color, 1);
     }
 )";
 
+// ID Shaders (for picking): mesh id+1 (0: none) and triangle index of each pixel
+
+const char *idVertexShader = R"(
+    #version 150
+    in vec3 point;
+    uniform mat4 modelview;
+    uniform mat4 persp;
+    void main() {
+        gl_Position = persp*modelview*vec4(point, 1);
+    }
+)";
+
+const char *idPixelShader = R"(
+    #version 150
+    out uvec2 pId;
+    uniform int meshId;
+    uniform int firstTriangle;             // of the draw; gl_PrimitiveID counts from 0 in each
+    void main() {
+        pId = uvec2(meshId+1, firstTriangle+gl_PrimitiveID);
+    }
+)";
+
+GLuint idShader = 0;
+
 } // end namespace
 
 GLuint GetMeshShader() {
@@ -77,8 +128,71 @@ GLuint UseMeshShader() {
 	return s;
 }
 
+static GLuint UseIdShader() {
+    if (!idShader)
+        idShader = LinkProgramViaCode(&idVertexShader, &idPixelShader);
+    glUseProgram(idShader);
+    return idShader;
+}
+
 // Mesh Class
 
+static size_t LayoutBytes(Mesh &m) {
+    // points, normals, and uvs, in either layout
+    return m.points.size()*(2*sizeof(vec3)+sizeof(vec2));
+}
+
+static size_t TangentBytes(Mesh &m) {
+    return m.tangents.size() == m.points.size()? m.tangents.size()*sizeof(vec4) : 0;
+}
+
+static void BufferVertices(Mesh &m, size_t from, size_t to) {
+    // copy bytes from to to of the mesh's GPU layout, then any tangents, into the bound vertex buffer
+    // (for the interleaved layout, from and to, if within it, are multiples of the vertex size)
+    size_t layoutBytes = LayoutBytes(m);
+    if (to > layoutBytes) {
+        size_t b = from > layoutBytes? from : layoutBytes;
+        glBufferSubData(GL_ARRAY_BUFFER, b, to-b, (const char *) m.tangents.data()+(b-layoutBytes));
+        if (from >= layoutBytes)
+            return;
+        to = layoutBytes;
+    }
+    if (m.interleaved) {
+        // pack a staging block of vertices at a time
+        const int vertexBytes = interleavedFloats*sizeof(float), blockVertices = 1 << 16;
+        int first = from/vertexBytes, end = to/vertexBytes;
+        vector<float> block((size_t) interleavedFloats*(end-first < blockVertices? end-first : blockVertices));
+        for (int v = first; v < end; v += blockVertices) {
+            int n = end-v < blockVertices? end-v : blockVertices;
+            InterleaveVertices(m.points, m.normals, m.uvs, v, n, block.data());
+            glBufferSubData(GL_ARRAY_BUFFER, (size_t) v*vertexBytes, (size_t) n*vertexBytes, block.data());
+        }
+        return;
+    }
+    const char *arrays[] = {(const char *) &m.points[0], (const char *) &m.normals[0], (const char *) &m.uvs[0]};
+    size_t sizes[] = {m.points.size()*sizeof(vec3), m.normals.size()*sizeof(vec3), m.uvs.size()*sizeof(vec2)};
+    for (size_t a = 0, start = 0; a < 3; start += sizes[a++]) {
+        size_t b = from > start? from : start, e = to < start+sizes[a]? to : start+sizes[a];
+        if (b < e)
+            glBufferSubData(GL_ARRAY_BUFFER, b, e-b, arrays[a]+(b-start));
+    }
+}
+
+static void BufferIndices(Mesh &m, size_t from, size_t to) {
+    // copy bytes from to to of triangles then lodTriangles into the bound index buffer
+    const char *arrays[] = {(const char *) m.triangles.data(), (const char *) m.lodTriangles.data()};
+    size_t sizes[] = {m.triangles.size()*sizeof(int3), m.lodTriangles.size()*sizeof(int3)};
+    for (size_t a = 0, start = 0; a < 2; start += sizes[a++]) {
+        size_t b = from > start? from : start, e = to < start+sizes[a]? to : start+sizes[a];
+        if (b < e)
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, b, e-b, arrays[a]+(b-start));
+    }
+}
+
+static size_t IndexBytes(Mesh &m) {
+    return (m.triangles.size()+m.lodTriangles.size())*sizeof(int3);
+}
+
 void Mesh::Buffer() {
 	int nPts = points.size(), nNrms = normals.size(), nUvs = uvs.size();
 	if (!nPts || nPts != nNrms || nPts != nUvs) {
@@ -88,56 +202,683 @@ void Mesh::Buffer() {
     // create a vertex buffer for the mesh
     glGenBuffers(1, &vBufferId);
     glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
-    // allocate GPU memory for vertex locations and colors
-    int sizePoints = points.size()*sizeof(vec3);
-    int sizeNormals = normals.size()*sizeof(vec3);
-    int sizeUvs = uvs.size()*sizeof(vec2);
-    int bufferSize = sizePoints+sizeUvs+sizeNormals;
+    // allocate GPU memory for vertex locations, normals, and uvs (same total for either layout), and tangents
+    size_t bufferSize = LayoutBytes(*this)+TangentBytes(*this);
     glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
     // load data to buffer
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizePoints, &points[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, sizePoints, sizeNormals, &normals[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, sizePoints+sizeNormals, sizeUvs, &uvs[0]);
+    BufferVertices(*this, 0, bufferSize);
+    // and triangles, with any detail levels, to an index buffer
+    size_t indexSize = IndexBytes(*this);
+    glGenBuffers(1, &iBufferId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize, NULL, GL_STATIC_DRAW);
+    BufferIndices(*this, 0, indexSize);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    uploadedBytes = bufferSize+indexSize;
+    resident = true;
+}
+
+int Mesh::SelectLod(mat4 &modelview, mat4 &persp, int viewportHeight) {
+    if (lods.empty())
+        return lod = 0;
+    // pixels per unit of object space at the nearest point of the bounding sphere
+    float scale = 0;
+    for (int k = 0; k < 3; k++) {
+        float s = length(vec3(modelview[0][k], modelview[1][k], modelview[2][k]));
+        scale = s > scale? s : scale;
+    }
+    vec4 center = modelview*vec4(lodCenter, 1);
+    float w = persp[3][2]*(center.z+scale*lodRadius)+persp[3][3];
+    if (w <= 0) {
+        // camera within the sphere
+        drawStats.pixelError = 0;
+        return lod = 0;
+    }
+    float pixelsPerUnit = scale*persp[1][1]*viewportHeight/(2*w);
+    int nLevels = lods.size()+1, level = lod < nLevels? lod : nLevels-1;
+    auto Error = [&](int i) { return i? lods[i-1].error*pixelsPerUnit : 0; };
+    auto Coarsest = [&](float limit) {
+        int i = 0;
+        while (i+1 < nLevels && Error(i+1) <= limit)
+            i++;
+        return i;
+    };
+    if (Error(level) > lodPixelError)
+        level = Coarsest(lodPixelError);
+    else {
+        int coarser = Coarsest(lodPixelError/(1+lodHysteresis));
+        level = coarser > level? coarser : level;
+    }
+    drawStats.pixelError = Error(level);
+    return lod = level;
+}
+
+static void CullSpace(mat4 modelview, mat4 &persp, vec4 planes[6], vec3 &eye) {
+    // view frustum and eye in object space, for MeshletVisible
+    mat4 clip = persp*modelview;
+    vec4 e = Invert(modelview)*vec4(0, 0, 0, 1);
+    FrustumPlanes(clip, planes);
+    eye = vec3(e.x, e.y, e.z)/e.w;
+}
+
+static int VisibleRanges(Mesh &m, int firstMeshlet, int nMeshlets, vec4 planes[6], vec3 eye, vector<int2> &ranges) {
+    // set triangle ranges (first, count) of the visible meshlets, adjacent ones merged; return # visible
+    int nVisible = 0;
+    ranges.clear();
+    for (int i = firstMeshlet; i < firstMeshlet+nMeshlets; i++) {
+        Meshlet &ml = m.meshlets[i];
+        if (!MeshletVisible(ml, planes, eye, m.cullBackMeshlets))
+            continue;
+        if (!ranges.empty() && ranges.back().i1+ranges.back().i2 == ml.firstTriangle)
+            ranges.back().i2 += ml.nTriangles;
+        else
+            ranges.push_back(int2(ml.firstTriangle, ml.nTriangles));
+        nVisible++;
+    }
+    return nVisible;
 }
 
 void Mesh::Display(CameraAB &camera) {
+	if (!resident && !Upload(uploadBytesPerFrame))
+		return;
 	int nPts = points.size(), nNrms = normals.size(), nUvs = uvs.size(), nTris = triangles.size();
 	if (!nPts || !nNrms || !nUvs || !nTris)
 		return;
-    // use vertex buffer for this mesh
+    // use vertex and index buffers for this mesh
     glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
     // connect shader inputs to GPU buffer
-    int sizePoints = nPts*sizeof(vec3);
-    int sizeNormals = nNrms*sizeof(vec3);
+    int stride = interleaved? interleavedFloats*sizeof(float) : 0;
+    size_t normalsOffset = interleaved? sizeof(vec3) : nPts*sizeof(vec3);
+    size_t uvsOffset = interleaved? 2*sizeof(vec3) : normalsOffset+nNrms*sizeof(vec3);
 	int shader = UseMeshShader();
-	SetUniform(shader, "useTexture", textureUnit? 1 : 0);
     // vertex feeder
-    VertexAttribPointer(shader, "point", 3, 0, (void *) 0);
-    VertexAttribPointer(shader, "normal", 3, 0, (void *) sizePoints);
-    VertexAttribPointer(shader, "uv", 2, 0, (void *) (sizePoints+sizeNormals));
+    VertexAttribPointer(shader, "point", 3, stride, (void *) 0);
+    VertexAttribPointer(shader, "normal", 3, stride, (void *) normalsOffset);
+    VertexAttribPointer(shader, "uv", 2, stride, (void *) uvsOffset);
+    bool normalMapped = TangentBytes(*this) && normalMapName;
+    if (TangentBytes(*this))
+        VertexAttribPointer(shader, "tangent", 4, 0, (void *) LayoutBytes(*this));
+    else
+        DisableVertexAttribute(shader, "tangent");
     // set custom transform (xform = mesh transforms X view transform)
+    SetUniform(shader, "modelview", camera.modelview*transform);
+    SetUniform(shader, "persp", camera.persp);
+    SetUniform(shader, "diffuse", vec3(1, 1, 1));
+    SetUniform(shader, "useNormalMap", normalMapped? 1 : 0);
+    if (normalMapped) {
+        glActiveTexture(GL_TEXTURE0+normalMapUnit);
+        glBindTexture(GL_TEXTURE_2D, normalMapName);
+        SetUniform(shader, "normalMap", (int) normalMapUnit);
+    }
+    // detail level, and the range of the index buffer holding it
+    int level = 0;
+    if (!lods.empty()) {
+        int vp[4];
+        glGetIntegerv(GL_VIEWPORT, vp);
+        mat4 modelview = camera.modelview*transform;
+        level = SelectLod(modelview, camera.persp, vp[3]);
+    }
+    int first = level? nTris+lods[level-1].firstTriangle : 0, count = level? lods[level-1].nTriangles : nTris;
+    drawStats.level = level;
+    drawStats.fullTriangles = nTris;
+    drawStats.triangles = drawStats.meshlets = drawStats.meshletsDrawn = 0;
+    // at full detail, with meshlets, cull them in object space
+    bool cull = !level && !meshlets.empty();
+    vec4 planes[6];
+    vec3 eye;
+    if (cull)
+        CullSpace(camera.modelview*transform, camera.persp, planes, eye);
+    vector<int2> ranges;
+    vector<GLsizei> counts;
+    vector<const void *> offsets;
+    auto Draw = [&](int first, int count, int firstMeshlet, int nMeshlets) {
+        // draw triangles first to first+count of the index buffer or, if culling, its visible meshlets,
+        // with adjacent meshlets merged into one range
+        if (!cull) {
+            if (count)
+                glDrawElements(GL_TRIANGLES, 3*count, GL_UNSIGNED_INT, (void *) ((size_t) first*sizeof(int3)));
+            drawStats.triangles += count;
+            return;
+        }
+        drawStats.meshletsDrawn += VisibleRanges(*this, firstMeshlet, nMeshlets, planes, eye, ranges);
+        drawStats.meshlets += nMeshlets;
+        counts.clear();
+        offsets.clear();
+        for (size_t i = 0; i < ranges.size(); i++) {
+            counts.push_back(3*ranges[i].i2);
+            offsets.push_back((const void *) ((size_t) ranges[i].i1*sizeof(int3)));
+            drawStats.triangles += ranges[i].i2;
+        }
+        if (!counts.empty())
+            glMultiDrawElements(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(), counts.size());
+    };
+    if (!materials.empty()) {
+        // one draw per material range; materials are sorted so texture and color changes are few
+        // materials without a texture map use the mesh's texture, if any (as drawn without materials)
+        GLuint boundTexture = 0, meshTexture = textureUnit? textureName : 0;
+        vec3 color(1, 1, 1);
+        SetUniform(shader, "useTexture", 0);
+        SetUniform(shader, "textureName", (int) textureUnit);
+        glActiveTexture(GL_TEXTURE0+textureUnit);
+        for (size_t i = 0; i < materials.size(); i++) {
+            MeshMaterial &m = materials[i];
+            GLuint texture = m.textureName? m.textureName : meshTexture;
+            if (texture != boundTexture) {
+                if (!boundTexture || !texture)
+                    SetUniform(shader, "useTexture", texture? 1 : 0);
+                if (texture)
+                    glBindTexture(GL_TEXTURE_2D, texture);
+                boundTexture = texture;
+            }
+            if (m.diffuse.x != color.x || m.diffuse.y != color.y || m.diffuse.z != color.z)
+                SetUniform(shader, "diffuse", color = m.diffuse);
+            int2 range = level? lods[level-1].materialRanges[i] : int2(m.firstTriangle, m.nTriangles);
+            Draw((level? nTris : 0)+range.i1, range.i2, m.firstMeshlet, m.nMeshlets);
+        }
+        SetUniform(shader, "diffuse", vec3(1, 1, 1));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        return;
+    }
+	SetUniform(shader, "useTexture", textureUnit? 1 : 0);
 	if (textureUnit) {
 	    glActiveTexture(GL_TEXTURE0+textureUnit);  // active texture corresponds with textureUnit or textureName????
 		glBindTexture(GL_TEXTURE_2D, textureName); // bound texture and shader id correspond with textureName
 	    SetUniform(shader, "textureName", (int) textureName);
 	}
-    SetUniform(shader, "modelview", camera.modelview*transform);
+    Draw(first, count, 0, meshlets.size());
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Mesh::DisplayIds(CameraAB &camera, int id) {
+    if (!resident || triangles.empty())
+        return;
+    glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+    int stride = interleaved? interleavedFloats*sizeof(float) : 0;
+    int shader = UseIdShader();
+    VertexAttribPointer(shader, "point", 3, stride, (void *) 0);
+    mat4 modelview = camera.modelview*transform;
+    SetUniform(shader, "modelview", modelview);
     SetUniform(shader, "persp", camera.persp);
-	glDrawElements(GL_TRIANGLES, 3*nTris, GL_UNSIGNED_INT, &triangles[0]);
+    SetUniform(shader, "meshId", id);
+    // full detail, so ids index triangles; a draw per range, as gl_PrimitiveID restarts with each
+    vector<int2> ranges;
+    if (meshlets.empty())
+        ranges.push_back(int2(0, triangles.size()));
+    else {
+        vec4 planes[6];
+        vec3 eye;
+        CullSpace(modelview, camera.persp, planes, eye);
+        VisibleRanges(*this, 0, meshlets.size(), planes, eye, ranges);
+    }
+    for (size_t i = 0; i < ranges.size(); i++) {
+        SetUniform(shader, "firstTriangle", ranges[i].i1);
+        glDrawElements(GL_TRIANGLES, 3*ranges[i].i2, GL_UNSIGNED_INT, (void *) ((size_t) ranges[i].i1*sizeof(int3)));
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-bool Mesh::Read(string name, mat4 *m) {
-    if (!ReadAsciiObj((char *) name.c_str(), points, triangles, &normals, &uvs)) {
+static bool HasExtension(string &name, const char *ext) {
+    size_t n = strlen(ext);
+    if (name.size() < n)
+        return false;
+    for (size_t i = 0; i < n; i++)
+        if (tolower(name[name.size()-n+i]) != ext[i])
+            return false;
+    return true;
+}
+
+static bool ReadMeshFile(string &name, vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals, vector<vec2> &uvs,
+                         ObjMaterials &materials) {
+    // choose reader by file extension (default OBJ)
+    if (HasExtension(name, ".stl")) {
+        if (!ReadSTL(name.c_str(), points, triangles, &normals))
+            return false;
+        uvs.resize(points.size());                  // STL has no uvs
+        return true;
+    }
+    if (HasExtension(name, ".mpk")) {
+        if (!ReadPackedMesh(name.c_str(), points, normals, uvs, triangles))
+            return false;
+        if (normals.size() != points.size())
+            ComputeVertexNormals(points, triangles, normals, WeightAngle);
+        uvs.resize(points.size());
+        return true;
+    }
+    if (HasExtension(name, ".ply")) {
+        if (!ReadPly(name.c_str(), points, triangles, &normals, &uvs))
+            return false;
+        if (normals.size() != points.size())
+            ComputeVertexNormals(points, triangles, normals, WeightAngle);
+        uvs.resize(points.size());
+        return true;
+    }
+    return ReadObjParallel(name.c_str(), points, triangles, &normals, &uvs, NULL, NULL, &materials);
+}
+
+static bool ReadNormalized(string &name, bool useCache, vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals, vector<vec2> &uvs,
+                           ObjMaterials &materials) {
+    // reuse binary sidecar if source unchanged, else read source and write sidecar
+    static const float scale = .8f;
+    string cacheName = MeshCacheName(name.c_str());
+    if (useCache && ReadMeshCache(cacheName.c_str(), name.c_str(), scale, points, normals, uvs, triangles, NULL, &materials))
+        return true;
+    if (!ReadMeshFile(name, points, triangles, normals, uvs, materials)) {
         printf("Mesh.Read: can't read %s\n", name.c_str());
         return false;
     }
-    Normalize(points, .8f);
+    MeshCacheInfo info;
+    UnitFit fit = FitToUnit(points, scale);
+    info.min = fit.min;
+    info.max = fit.max;
+    info.normalizeScale = scale;
+    info.transform = Scale(fit.scale, fit.scale, fit.scale)*Translate(-fit.center);
+    if (useCache && !WriteMeshCache(cacheName.c_str(), name.c_str(), info, points, normals, uvs, triangles, &materials))
+        printf("Mesh.Read: can't write %s\n", cacheName.c_str());
+    return true;
+}
+
+static string Directory(string &name) {
+    size_t slash = name.find_last_of("/\\");
+    return slash == string::npos? string() : name.substr(0, slash+1);
+}
+
+static void SortByMaterial(string &name, ObjMaterials &objMaterials, vector<int3> &triangles, vector<MeshMaterial> &materials) {
+    // read material libraries; reorder triangles into one contiguous range per material, with
+    // materials sorted by texture file then diffuse color so that Display changes state least
+    materials.clear();
+    int nNames = objMaterials.names.size(), nTriangles = triangles.size();
+    if (!nNames)
+        return;
+    if ((int) objMaterials.triangleMaterials.size() != nTriangles) {
+        printf("Mesh.Read: %s: materials don't match triangles\n", name.c_str());
+        return;
+    }
+    string dir = Directory(name);
+    vector<ObjMaterial> library;
+    for (size_t i = 0; i < objMaterials.libraries.size(); i++)
+        ReadMtl((dir+objMaterials.libraries[i]).c_str(), library);
+    // material nNames holds triangles preceding any usemtl
+    vector<MeshMaterial> all(nNames+1);
+    for (int i = 0; i < nNames; i++) {
+        MeshMaterial &m = all[i];
+        m.name = objMaterials.names[i];
+        size_t k = 0;
+        while (k < library.size() && library[k].name != m.name)
+            k++;
+        if (k == library.size()) {
+            printf("Mesh.Read: material %s undefined\n", m.name.c_str());
+            continue;
+        }
+        ObjMaterial &o = library[k];
+        m.ambient = o.ambient;
+        m.diffuse = o.diffuse;
+        m.specular = o.specular;
+        m.shininess = o.shininess;
+        m.opacity = o.opacity;
+        if (!o.diffuseMap.empty())
+            m.textureFile = dir+o.diffuseMap;
+    }
+    for (int t = 0; t < nTriangles; t++) {
+        int id = objMaterials.triangleMaterials[t];
+        all[id >= 0 && id < nNames? id : nNames].nTriangles++;
+    }
+    vector<int> order;
+    for (int i = 0; i <= nNames; i++)
+        if (all[i].nTriangles)
+            order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        MeshMaterial &ma = all[a], &mb = all[b];
+        if (ma.textureFile != mb.textureFile)
+            return ma.textureFile < mb.textureFile;
+        for (int k = 0; k < 3; k++)
+            if (ma.diffuse[k] != mb.diffuse[k])
+                return ma.diffuse[k] < mb.diffuse[k];
+        return false;
+    });
+    // counting sort of triangles, stable within each material
+    for (size_t i = 0, first = 0; i < order.size(); first += all[order[i++]].nTriangles)
+        all[order[i]].firstTriangle = first;
+    vector<int> next(nNames+1);
+    for (int i = 0; i <= nNames; i++)
+        next[i] = all[i].firstTriangle;
+    vector<int3> sorted(nTriangles);
+    for (int t = 0; t < nTriangles; t++) {
+        int id = objMaterials.triangleMaterials[t];
+        sorted[next[id >= 0 && id < nNames? id : nNames]++] = triangles[t];
+    }
+    triangles.swap(sorted);
+    for (size_t i = 0; i < order.size(); i++)
+        materials.push_back(all[order[i]]);
+}
+
+static void OptimizeForGpu(string &name, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
+                           vector<int3> &triangles, vector<MeshMaterial> &materials, bool overdraw) {
+    // reorder each material's range (or all triangles) for the vertex cache (and, optionally, overdraw),
+    // then renumber vertices
+    const int cacheSize = 16;
+    int nPoints = points.size();
+    VertexCacheStats before = MeasureVertexCache(triangles, nPoints, cacheSize);
+    OverdrawStats overdrawBefore;
+    if (overdraw)
+        overdrawBefore = MeasureOverdraw(points, triangles);
+    vector<int2> ranges(1, int2(0, triangles.size()));
+    if (!materials.empty())
+        ranges.clear();
+    for (size_t i = 0; i < materials.size(); i++)
+        ranges.push_back(int2(materials[i].firstTriangle, materials[i].nTriangles));
+    for (size_t r = 0; r < ranges.size(); r++) {
+        OptimizeVertexCache(triangles, nPoints, cacheSize, ranges[r].i1, ranges[r].i2);
+        if (overdraw)
+            OptimizeOverdraw(triangles, points, 1.05f, cacheSize, ranges[r].i1, ranges[r].i2);
+    }
+    OptimizeVertexFetch(triangles, points, normals, uvs);
+    VertexCacheStats after = MeasureVertexCache(triangles, nPoints, cacheSize);
+    printf("Mesh.Read: %s ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name.c_str(), before.acmr, after.acmr, before.atvr, after.atvr);
+    if (overdraw)
+        printf("Mesh.Read: %s overdraw %.3f -> %.3f\n", name.c_str(), overdrawBefore.overdraw, MeasureOverdraw(points, triangles).overdraw);
+}
+
+static void BuildTangents(string &name, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
+                          vector<int3> &triangles, vector<vec4> &tangents) {
+    // after any vertex reordering, as split vertices are appended
+    int nSplit = ComputeTangents(points, normals, uvs, triangles, tangents);
+    if (nSplit < 0)
+        printf("Mesh.Read: %s: no tangents without normals and uvs\n", name.c_str());
+    else if (nSplit)
+        printf("Mesh.Read: %s: %i vertices split at mirrored uv seams\n", name.c_str(), nSplit);
+}
+
+static void BuildMeshletRanges(string &name, vector<vec3> &points, vector<int3> &triangles, vector<MeshMaterial> &materials,
+                               vector<Meshlet> &meshlets, bool optimize) {
+    // meshlets for each material's range (or all triangles); meshlets set the order, so if optimize
+    // reorder within each for the vertex cache, and print ACMR for the final order
+    meshlets.clear();
+    if (materials.empty())
+        BuildMeshlets(triangles, points, meshlets);
+    for (size_t i = 0; i < materials.size(); i++) {
+        MeshMaterial &m = materials[i];
+        m.firstMeshlet = meshlets.size();
+        m.nMeshlets = BuildMeshlets(triangles, points, meshlets, 64, 124, m.firstTriangle, m.nTriangles);
+    }
+    int nVertices = 0;
+    if (meshlets.empty())
+        return;
+    if (optimize)
+        OptimizeVertexCache(triangles, points.size(), meshlets);
+    for (size_t i = 0; i < meshlets.size(); i++)
+        nVertices += meshlets[i].nVertices;
+    printf("Mesh.Read: %s %i meshlets, %.1f triangles and %.1f vertices each, ACMR %.3f\n", name.c_str(),
+           (int) meshlets.size(), (float) triangles.size()/meshlets.size(), (float) nVertices/meshlets.size(),
+           MeasureVertexCache(triangles, points.size()).acmr);
+}
+
+static void BuildLods(string &name, vector<vec3> &points, vector<int3> &triangles, vector<MeshMaterial> &materials,
+                      vector<int3> &lodTriangles, vector<MeshLod> &lods, bool optimize) {
+    // simplify the whole mesh (so material boundaries move with it); levels keep the original triangle
+    // order, hence material grouping, so each level's material ranges follow from triangle sources
+    lodTriangles.clear();
+    lods.clear();
+    vector<LodLevel> levels;
+    SimplifyLods(points, triangles, levels);
+    for (size_t i = 0; i < levels.size(); i++) {
+        LodLevel &level = levels[i];
+        MeshLod lod;
+        lod.firstTriangle = lodTriangles.size();
+        lod.nTriangles = level.triangles.size();
+        lod.error = level.error;
+        for (size_t k = 0, t = 0; k < materials.size(); k++) {
+            int end = materials[k].firstTriangle+materials[k].nTriangles;
+            size_t first = t;
+            while (t < level.sources.size() && level.sources[t] < end)
+                t++;
+            lod.materialRanges.push_back(int2(lod.firstTriangle+first, t-first));
+        }
+        lodTriangles.insert(lodTriangles.end(), level.triangles.begin(), level.triangles.end());
+        if (optimize) {
+            if (materials.empty())
+                OptimizeVertexCache(lodTriangles, points.size(), 16, lod.firstTriangle, lod.nTriangles);
+            for (size_t k = 0; k < lod.materialRanges.size(); k++)
+                OptimizeVertexCache(lodTriangles, points.size(), 16, lod.materialRanges[k].i1, lod.materialRanges[k].i2);
+        }
+        lods.push_back(lod);
+    }
+    printf("Mesh.Read: %s %i detail levels", name.c_str(), (int) lods.size());
+    for (size_t i = 0; i < lods.size(); i++)
+        printf("%s %i (%.5f)", i? "," : ":", lods[i].nTriangles, lods[i].error);
+    printf("\n");
+}
+
+static void LodSphere(Mesh &m) {
+    // sphere about the bounds of the points, for projecting level errors
+    vec3 min, max;
+    m.lodRadius = 0;
+    if (m.lods.empty() || m.points.empty())
+        return;
+    ComputeBounds(m.points, min, max);
+    m.lodCenter = .5f*(min+max);
+    m.lodRadius = .5f*length(max-min);
+}
+
+static void LoadMaterialTextures(vector<MeshMaterial> &materials, GLuint textureUnit) {
+    // materials sharing a texture file share a texture (sorting has made them adjacent)
+    for (size_t i = 0; i < materials.size(); i++) {
+        MeshMaterial &m = materials[i];
+        if (m.textureFile.empty())
+            continue;
+        if (i > 0 && materials[i-1].textureFile == m.textureFile)
+            m.textureName = materials[i-1].textureName;
+        else
+            m.textureName = LoadTexture(m.textureFile.c_str(), textureUnit);
+    }
+}
+
+bool Mesh::Read(string name, mat4 *m) {
+    pending.reset();
+    ObjMaterials objMaterials;
+    if (!ReadNormalized(name, useCache, points, triangles, normals, uvs, objMaterials))
+        return false;
+    SortByMaterial(name, objMaterials, triangles, materials);
+    if (optimizeVertexCache)
+        OptimizeForGpu(name, points, normals, uvs, triangles, materials, optimizeOverdraw);
+    if (buildTangents)
+        BuildTangents(name, points, normals, uvs, triangles, tangents);
+    else
+        tangents.clear();
+    if (buildMeshlets)
+        BuildMeshletRanges(name, points, triangles, materials, meshlets, optimizeVertexCache);
+    else
+        meshlets.clear();
+    if (buildLods)
+        BuildLods(name, points, triangles, materials, lodTriangles, lods, optimizeVertexCache);
+    else {
+        lodTriangles.clear();
+        lods.clear();
+    }
+    LodSphere(*this);
+    lod = 0;
+    if (keepSoA)
+        ToSoA(points, pointsSoA);
+    else
+        pointsSoA = PointsSoA();
     Buffer();
+    LoadMaterialTextures(materials, textureUnit);
     if (m)
         transform = *m;
     return true;
 }
 
+// Asynchronous Loading
+
+struct MeshLoad {
+    // arrays filled by the loader thread, moved into the mesh once future is ready
+    string name;
+    bool useCache = false, optimize = false, overdraw = false, tangents = false, meshlets = false, lods = false;
+    bool keepSoA = false, hasTransform = false;
+    mat4 transform;
+    vector<vec3> points, normals;
+    vector<vec2> uvs;
+    vector<vec4> tangentArray;
+    vector<int3> triangles;
+    PointsSoA pointsSoA;
+    vector<MeshMaterial> materials;
+    vector<Meshlet> clusters;
+    vector<int3> lodTriangles;
+    vector<MeshLod> lodLevels;
+    std::promise<bool> promise;
+    std::shared_future<bool> done;
+    bool moved = false;
+};
+
+namespace {
+
+class MeshLoader {
+    // single background thread reading queued files in order; it uses the parallel readers
+    // for each file, so dozens of requests don't oversubscribe the cores
+public:
+    void Add(std::shared_ptr<MeshLoad> load) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(load);
+        if (!started) {
+            std::thread(&MeshLoader::Run, this).detach();
+            started = true;
+        }
+        ready.notify_one();
+    }
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::shared_ptr<MeshLoad>> queue;
+    bool started = false;
+    void Run() {
+        for (;;) {
+            std::shared_ptr<MeshLoad> load;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]() { return !queue.empty(); });
+                load = queue.front();
+                queue.pop_front();
+            }
+            ObjMaterials objMaterials;
+            bool ok = ReadNormalized(load->name, load->useCache, load->points, load->triangles, load->normals, load->uvs, objMaterials);
+            if (ok)
+                SortByMaterial(load->name, objMaterials, load->triangles, load->materials);
+            if (ok && load->optimize)
+                OptimizeForGpu(load->name, load->points, load->normals, load->uvs, load->triangles, load->materials, load->overdraw);
+            if (ok && load->tangents)
+                BuildTangents(load->name, load->points, load->normals, load->uvs, load->triangles, load->tangentArray);
+            if (ok && load->meshlets)
+                BuildMeshletRanges(load->name, load->points, load->triangles, load->materials, load->clusters, load->optimize);
+            if (ok && load->lods)
+                BuildLods(load->name, load->points, load->triangles, load->materials, load->lodTriangles, load->lodLevels, load->optimize);
+            if (ok && load->keepSoA)
+                ToSoA(load->points, load->pointsSoA);
+            load->promise.set_value(ok);
+        }
+    }
+};
+
+MeshLoader &Loader() {
+    static MeshLoader *loader = new MeshLoader;     // never destroyed: its thread may outlive main
+    return *loader;
+}
+
+} // end namespace
+
+std::shared_future<bool> Mesh::ReadAsync(string name, mat4 *m) {
+    std::shared_ptr<MeshLoad> load = std::make_shared<MeshLoad>();
+    load->name = name;
+    load->useCache = useCache;
+    load->optimize = optimizeVertexCache;
+    load->overdraw = optimizeOverdraw;
+    load->tangents = buildTangents;
+    load->meshlets = buildMeshlets;
+    load->lods = buildLods;
+    load->keepSoA = keepSoA;
+    load->hasTransform = m != NULL;
+    if (m)
+        load->transform = *m;
+    load->done = load->promise.get_future().share();
+    pending = load;
+    resident = false;
+    Loader().Add(load);
+    return load->done;
+}
+
+bool Mesh::Upload(size_t maxBytes) {
+    if (resident)
+        return true;
+    if (!pending || pending->done.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+    if (!pending->moved) {
+        // first slice: take arrays and allocate GPU buffer
+        pending->moved = true;
+        if (!pending->done.get()) {
+            pending.reset();
+            return false;
+        }
+        points.swap(pending->points);
+        normals.swap(pending->normals);
+        uvs.swap(pending->uvs);
+        tangents.swap(pending->tangentArray);
+        triangles.swap(pending->triangles);
+        pointsSoA.x.swap(pending->pointsSoA.x);
+        pointsSoA.y.swap(pending->pointsSoA.y);
+        pointsSoA.z.swap(pending->pointsSoA.z);
+        materials.swap(pending->materials);
+        meshlets.swap(pending->clusters);
+        lodTriangles.swap(pending->lodTriangles);
+        lods.swap(pending->lodLevels);
+        LodSphere(*this);
+        lod = 0;
+        LoadMaterialTextures(materials, textureUnit);
+        if (pending->hasTransform)
+            transform = pending->transform;
+        int nPts = points.size();
+        if (!nPts || nPts != (int) normals.size() || nPts != (int) uvs.size()) {
+            printf("mesh missing points, normals, or uvs\n");
+            pending.reset();
+            return false;
+        }
+        glGenBuffers(1, &vBufferId);
+        glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+        glBufferData(GL_ARRAY_BUFFER, LayoutBytes(*this)+TangentBytes(*this), NULL, GL_STATIC_DRAW);
+        glGenBuffers(1, &iBufferId);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, IndexBytes(*this), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        uploadedBytes = 0;
+    }
+    // copy next slice of the layout used by Buffer (whole vertices, if interleaved), then of any tangents,
+    // then of the indices
+    size_t layoutTotal = LayoutBytes(*this), vertexTotal = layoutTotal+TangentBytes(*this);
+    size_t total = vertexTotal+IndexBytes(*this);
+    if (uploadedBytes < vertexTotal) {
+        size_t limit = uploadedBytes < layoutTotal? layoutTotal : vertexTotal;
+        size_t end = uploadedBytes+maxBytes < limit? uploadedBytes+maxBytes : limit;
+        if (interleaved && limit == layoutTotal) {
+            size_t vertexBytes = interleavedFloats*sizeof(float);
+            end = end/vertexBytes > uploadedBytes/vertexBytes? end/vertexBytes*vertexBytes : uploadedBytes+vertexBytes;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+        BufferVertices(*this, uploadedBytes, end);
+        uploadedBytes = end;
+    }
+    else {
+        size_t end = uploadedBytes+maxBytes < total? uploadedBytes+maxBytes : total;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+        BufferIndices(*this, uploadedBytes-vertexTotal, end-vertexTotal);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        uploadedBytes = end;
+    }
+    if (uploadedBytes == total) {
+        resident = true;
+        pending.reset();
+    }
+    return resident;
+}
+
 bool Mesh::Read(string objName, string texName, int texUnit, mat4 *m) {
 	if (!Read(objName, m))
 		return false;
@@ -209,116 +950,45 @@ bool IsInside(const vec2 &p, const vec2 &a, const vec2 &b, const vec2 &c) {
     return odd;
 }
 
+bool IntersectTriInfo(vec3 p1, vec3 p2, TriInfo &t, float &alpha) {
+    vec3 inter;
+    return LineIntersectPlane(p1, p2, t.plane, &inter, &alpha) && IsInside(MajPln(inter, t.majorPlane), t.p1, t.p2, t.p3);
+}
+
 void BuildTriInfos(vector<vec3> &points, vector<int3> &triangles, vector<TriInfo> &triInfos) {
     triInfos.resize(triangles.size());
-    for (size_t i = 0; i < triangles.size(); i++) {
-        int3 &t = triangles[i];
-        triInfos[i] = TriInfo(points[t.i1], points[t.i2], points[t.i3]);
-    }
+    ParallelRange(triangles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            int3 &t = triangles[i];
+            triInfos[i] = TriInfo(points[t.i1], points[t.i2], points[t.i3]);
+        }
+    }, 1 << 16);
 }
 
 int IntersectWithLine(vec3 p1, vec3 p2, vector<TriInfo> &triInfos, float &retAlpha) {
     int picked = -1;
     float alpha, minAlpha = FLT_MAX;
-    for (size_t i = 0; i < triInfos.size(); i++) {
-        TriInfo &t = triInfos[i];
-        vec3 inter;
-        if (LineIntersectPlane(p1, p2, t.plane, &inter, &alpha)) {
-            if (alpha < minAlpha) {
-                if (IsInside(MajPln(inter, t.majorPlane), t.p1, t.p2, t.p3)) {
-                    minAlpha = alpha;
-                    picked = i;
-                }
-            }
+    for (size_t i = 0; i < triInfos.size(); i++)
+        if (IntersectTriInfo(p1, p2, triInfos[i], alpha) && alpha < minAlpha) {
+            minAlpha = alpha;
+            picked = i;
         }
-    }
     retAlpha = minAlpha;
     return picked;
 }
 
-// center/scale for unit size models
-
-void UpdateMinMax(vec3 p, vec3 &min, vec3 &max) {
-    for (int k = 0; k < 3; k++) {
-        if (p[k] < min[k]) min[k] = p[k];
-        if (p[k] > max[k]) max[k] = p[k];
-    }
-}
-
-float GetScaleCenter(vec3 &min, vec3 &max, float scale, vec3 &center) {
-    center = .5f*(min+max);
-    float maxrange = 0;
-    for (int k = 0; k < 3; k++)
-        if ((max[k]-min[k]) > maxrange)
-            maxrange = max[k]-min[k];
-    return scale*2.f/maxrange;
-}
-
-// normalize STL models
-
-void MinMax(vector<VertexSTL> &points, vec3 &min, vec3 &max) {
-    min.x = min.y = min.z = FLT_MAX;
-    max.x = max.y = max.z = -FLT_MAX;
-    for (int i = 0; i < (int) points.size(); i++)
-        UpdateMinMax(points[i].point, min, max);
-}
+// normalize STL and vec3 models
 
 void Normalize(vector<VertexSTL> &vertices, float scale) {
-    vec3 min, max, center;
-    MinMax(vertices, min, max);
-    float s = GetScaleCenter(min, max, scale, center);
-    for (int i = 0; i < (int) vertices.size(); i++) {
-        vec3 &v = vertices[i].point;
-        v = s*(v-center);
-    }
-}
-
-// normalize vec3 models
-
-void MinMax(vector<vec3> &points, vec3 &min, vec3 &max) {
-    min[0] = min[1] = min[2] = FLT_MAX;
-    max[0] = max[1] = max[2] = -FLT_MAX;
-    for (int i = 0; i < (int) points.size(); i++) {
-        vec3 &v = points[i];
-        for (int k = 0; k < 3; k++) {
-            if (v[k] < min[k]) min[k] = v[k];
-            if (v[k] > max[k]) max[k] = v[k];
-        }
-    }
+    FitToUnit(vertices.size()? &vertices[0].point.x : NULL, vertices.size(), sizeof(VertexSTL), scale);
 }
 
 void Normalize(vector<vec3> &points, float scale) {
-    vec3 min, max;
-    MinMax(points, min, max);
-    vec3 center(.5f*(min[0]+max[0]), .5f*(min[1]+max[1]), .5f*(min[2]+max[2]));
-    float maxrange = 0;
-    for (int k = 0; k < 3; k++)
-        if ((max[k]-min[k]) > maxrange)
-            maxrange = max[k]-min[k];
-    float s = scale*2.f/maxrange;
-    for (int i = 0; i < (int) points.size(); i++) {
-        vec3 &v = points[i];
-        for (int k = 0; k < 3; k++)
-            v[k] = s*(v[k]-center[k]);
-    }
+    FitToUnit(points, scale);
 }
 
 void SetVertexNormals(vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals) {
-    // size normals array and initialize to zero
-    int nverts = (int) points.size();
-    normals.resize(nverts, vec3(0,0,0));
-    // accumulate each triangle normal into its three vertex normals
-    for (int i = 0; i < (int) triangles.size(); i++) {
-        int3 &t = triangles[i];
-        vec3 &p1 = points[t.i1], &p2 = points[t.i2], &p3 = points[t.i3];
-        vec3 a(p2-p1), b(p3-p2), n(normalize(cross(a, b)));
-        normals[t.i1] += n;
-        normals[t.i2] += n;
-        normals[t.i3] += n;
-    }
-    // set to unit length
-    for (int i = 0; i < nverts; i++)
-        normals[i] = normalize(normals[i]);
+    ComputeVertexNormals(points, triangles, normals, WeightUniform);
 }
 
 // ASCII support
@@ -353,16 +1023,11 @@ int ReadSTL(const char *filename, vector<VertexSTL> &vertices) {
         vector<VertexSTL> *verts;
         vector<string> vSpecs;                              // ASCII only
         Helper(const char *filename, vector<VertexSTL> *verts) : verts(verts) {
-            char line[1000], word[1000], *ptr = line;
-            ifstream inText(filename, ios::in);             // text default mode
-            inText.getline(line, 10);
-            bool ascii = ReadWord(ptr, word, 10) && !strcmp(Lower(word), "solid");
-//          bool ascii = ReadWord(ptr, word, 10) && !_stricmp(word, "solid");
-            ascii = false; // hmm!
+            // a leading "solid" is not enough: many binary files begin so
+            bool ascii = IsAsciiSTL(filename);
             if (ascii)
-                status = ReadASCII(inText);
-            inText.close();
-            if (!ascii) {
+                status = ReadASCII(filename);
+            else {
                 FILE *inBinary = fopen(filename, "rb");     // inText.setmode(ios::binary) fails
                 if (inBinary) {
                     nTriangles = 0;
@@ -373,9 +1038,21 @@ int ReadSTL(const char *filename, vector<VertexSTL> &vertices) {
                     status = false;
             }
         }
-        bool ReadASCII(ifstream &in) {
-            printf("can't read ASCII STL\n");
-            return true;
+        bool ReadASCII(const char *filename) {
+            vector<vec3> facets;
+            nTriangles = ReadAsciiSTL(filename, facets);
+            for (int i = 0; i < nTriangles; i++) {
+                vec3 n = facets[4*i], v[] = {facets[4*i+1], facets[4*i+2], facets[4*i+3]};
+                vec3 a(v[1]-v[0]), b(v[2]-v[1]);
+                if (dot(cross(a, b), n) < 0) {
+                    vec3 vtmp = v[0];
+                    v[0] = v[2];
+                    v[2] = vtmp;
+                }
+                for (int k = 0; k < 3; k++)
+                    verts->push_back(VertexSTL((float *) &v[k].x, (float *) &n.x));
+            }
+            return nTriangles > 0;
         }
         bool ReadBinary(FILE *in) {
                   // # bytes      use                  significance
@@ -581,29 +1258,6 @@ bool ReadAsciiObj(const char    *filename,
 } // end ReadAsciiObj
 
 bool WriteAsciiObj(const char *filename, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> *triangles, vector<int4> *quads) {
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        printf("can't write %s\n", filename);
-        return false;
-    }
-    for (size_t i = 0; i < points.size(); i++)
-        fprintf(file, "v %f %f %f \n", points[i].x, points[i].y, points[i].z);
-    fprintf(file, "\n");
-    for (size_t i = 0; i < normals.size(); i++)
-        fprintf(file, "vn %f %f %f \n", normals[i].x, normals[i].y, normals[i].z);
-    fprintf(file, "\n");
-    for (size_t i = 0; i < uvs.size(); i++)
-        fprintf(file, "vt %f %f \n", uvs[i].x, uvs[i].y);
-    fprintf(file, "\n");
-    // write triangles, quads (adding 1 to all vertex indices per OBJ format)
-    if (triangles) {
-        for (size_t i = 0; i < triangles->size(); i++)
-            fprintf(file, "f %d %d %d \n", 1+(*triangles)[i].i1, 1+(*triangles)[i].i2, 1+(*triangles)[i].i3);
-        fprintf(file, "\n");
-    }
-    if (quads)
-        for (size_t i = 0; i < quads->size(); i++)
-            fprintf(file, "f %d %d %d %d \n", 1+(*quads)[i].i1, 1+(*quads)[i].i2, 1+(*quads)[i].i3, 1+(*quads)[i].i4);
-    fclose(file);
-    return true;
+    // formatted into large buffers (see MeshIO.h) rather than one fprintf per record
+    return WriteObjBuffered(filename, points, normals, uvs, triangles, quads);
 }
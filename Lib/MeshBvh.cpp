@@ -0,0 +1,954 @@
+// MeshBvh.cpp - bounding volume hierarchy for line queries against mesh triangles
+
+#include "MeshBvh.h"
+#include "MeshProcess.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(MESH_SSE2) && defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const int nBins = 12;                       // candidate splits per axis
+const int maxLeaf = 8;                      // triangles per leaf, unless splitting costs more
+const int leafGroup = 4;                    // triangles tested together (costed as one)
+const int maxDepth = 96;                    // below this, split in half (keeps traversal stacks bounded)
+const int jobSize = 1 << 14;                // subtrees of at most this many triangles are built in parallel
+const int binGrain = 1 << 16;               // bin larger nodes in parallel
+
+struct Box {
+    vec3 min = vec3(FLT_MAX, FLT_MAX, FLT_MAX), max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    void Grow(const vec3 &p) {
+        for (int k = 0; k < 3; k++) {
+            min[k] = p[k] < min[k]? p[k] : min[k];
+            max[k] = p[k] > max[k]? p[k] : max[k];
+        }
+    }
+    void Grow(const Box &b) {
+        for (int k = 0; k < 3; k++) {
+            min[k] = b.min[k] < min[k]? b.min[k] : min[k];
+            max[k] = b.max[k] > max[k]? b.max[k] : max[k];
+        }
+    }
+    float Area() const {
+        if (min.x > max.x)
+            return 0;
+        vec3 d = max-min;
+        return 2*(d.x*d.y+d.y*d.z+d.z*d.x);
+    }
+};
+
+bool Same(const vec3 &a, const vec3 &b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+
+double NodeArea(const BvhNode &n) {
+    // area weighted as in Cost
+    Box b;
+    b.Grow(n.min);
+    b.Grow(n.max);
+    return (double) b.Area()*(n.count? n.count : 1);
+}
+
+Box Bounds(MeshBvh &bvh, int n) {
+    // of a leaf's padded triangles, or an interior node's children
+    Box b;
+    BvhNode &node = bvh.nodes[n];
+    if (node.count) {
+        for (int i = node.first; i < node.first+node.count; i++)
+            for (int j = 0; j < 9; j += 3)
+                b.Grow(vec3(bvh.corners[j][i], bvh.corners[j+1][i], bvh.corners[j+2][i]));
+        b.min -= vec3(bvh.pad, bvh.pad, bvh.pad);
+        b.max += vec3(bvh.pad, bvh.pad, bvh.pad);
+    }
+    else
+        for (int c = node.first; c < node.first+2; c++) {
+            b.Grow(bvh.nodes[c].min);
+            b.Grow(bvh.nodes[c].max);
+        }
+    return b;
+}
+
+struct Prim {
+    Box bounds;                             // padded bounds of a triangle
+    vec3 center;
+    int triangle;
+};
+
+struct Bin {
+    Box bounds;
+    int count = 0;
+};
+
+class Builder {
+public:
+    Builder(vector<vec3> &points, vector<int3> &triangles, float pad, int nThreads);
+    void Top(vector<BvhNode> &nodes, vector<int> &order);
+private:
+    vector<Prim> prims;                     // partitioned in place as nodes split
+    int nThreads;
+    struct Job {
+        int node, begin, end, depth;
+        Box box, centers;
+    };
+    vector<Job> jobs;
+    void Node(vector<BvhNode> &nodes, int n, int begin, int end, const Box &box, const Box &centers, int depth, bool top);
+};
+
+float PadFor(vector<vec3> &points, int nThreads) {
+    // pad bounds so that points IntersectTriInfo finds on a triangle (computed on its plane, with
+    // rounding) never fall outside its box
+    vec3 min, max;
+    ComputeBounds(points, min, max, nThreads);
+    float size = 0;
+    for (int k = 0; k < 3; k++) {
+        size = max[k]-min[k] > size? max[k]-min[k] : size;
+        size = fabs(min[k]) > size? fabs(min[k]) : size;
+        size = fabs(max[k]) > size? fabs(max[k]) : size;
+    }
+    return 1e-5f*size;
+}
+
+Builder::Builder(vector<vec3> &points, vector<int3> &triangles, float padding, int nThreads) : nThreads(nThreads) {
+    int nTriangles = triangles.size();
+    vec3 pad(padding, padding, padding);
+    prims.resize(nTriangles);
+    ParallelRange(nTriangles, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            Prim &p = prims[t];
+            for (int k = 0; k < 3; k++)
+                p.bounds.Grow(points[triangles[t][k]]);
+            p.bounds.min -= pad;
+            p.bounds.max += pad;
+            p.center = .5f*(p.bounds.min+p.bounds.max);
+            p.triangle = t;
+        }
+    }, binGrain, nThreads);
+}
+
+void Builder::Top(vector<BvhNode> &nodes, vector<int> &order) {
+    // build the tree above jobSize serially (binning large nodes in parallel), then the subtrees
+    // in parallel, each into its own array, appended in job order
+    int nRanges = 4*(nThreads > 0? nThreads : NumThreads());
+    vector<Box> boxes(nRanges), centers(nRanges);
+    ParallelFor(nRanges, [&](int r) {
+        for (size_t i = prims.size()*r/nRanges; i < prims.size()*(r+1)/nRanges; i++) {
+            boxes[r].Grow(prims[i].bounds);
+            centers[r].Grow(prims[i].center);
+        }
+    }, nThreads);
+    for (int r = 1; r < nRanges; r++) {
+        boxes[0].Grow(boxes[r]);
+        centers[0].Grow(centers[r]);
+    }
+    nodes.resize(1);
+    Node(nodes, 0, 0, prims.size(), boxes[0], centers[0], 0, true);
+    vector<vector<BvhNode>> subtrees(jobs.size());
+    ParallelFor(jobs.size(), [&](int j) {
+        subtrees[j].resize(1);
+        Node(subtrees[j], 0, jobs[j].begin, jobs[j].end, jobs[j].box, jobs[j].centers, jobs[j].depth, false);
+    }, nThreads);
+    for (size_t j = 0; j < jobs.size(); j++) {
+        // local node i > 0 goes to base+i-1; the local root replaces the job's node
+        vector<BvhNode> &sub = subtrees[j];
+        int base = nodes.size();
+        for (size_t i = 0; i < sub.size(); i++)
+            if (!sub[i].count)
+                sub[i].first += base-1;
+        nodes[jobs[j].node] = sub[0];
+        nodes.insert(nodes.end(), sub.begin()+1, sub.end());
+    }
+    order.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        order[i] = prims[i].triangle;
+}
+
+void Builder::Node(vector<BvhNode> &nodes, int n, int begin, int end, const Box &box, const Box &centers, int depth, bool top) {
+    // box bounds the triangles in [begin, end), centers their centroids
+    int count = end-begin;
+    if (top && count <= jobSize) {
+        jobs.push_back({n, begin, end, depth, box, centers});
+        return;
+    }
+    BvhNode &node = nodes[n];
+    node.min = box.min;
+    node.max = box.max;
+    node.first = begin;
+    node.count = count;
+    vec3 extent = centers.max-centers.min, scale;
+    if (count <= 2 || (extent.x <= 0 && extent.y <= 0 && extent.z <= 0 && count <= maxLeaf))
+        return;
+    // bin centroids along each axis (an axis without extent puts all in bin 0, and isn't split)
+    for (int k = 0; k < 3; k++)
+        scale[k] = extent[k] > 0? nBins/extent[k] : 0;
+    auto BinOf = [&](int axis, const Prim &p) {
+        int k = (int) (scale[axis]*(p.center[axis]-centers.min[axis]));
+        return k < nBins-1? k : nBins-1;
+    };
+    auto Fill = [&](int b, int e, Bin (*into)[nBins]) {
+        for (int i = b; i < e; i++)
+            for (int axis = 0; axis < 3; axis++) {
+                Bin &bin = into[axis][BinOf(axis, prims[i])];
+                bin.bounds.Grow(prims[i].bounds);
+                bin.count++;
+            }
+    };
+    Bin bins[3][nBins];
+    if (count > binGrain) {
+        int nRanges = 4*(nThreads > 0? nThreads : NumThreads());
+        vector<Bin> rangeBins((size_t) nRanges*3*nBins);
+        ParallelFor(nRanges, [&](int r) {
+            Fill(begin+(int) ((long long) count*r/nRanges), begin+(int) ((long long) count*(r+1)/nRanges),
+                 (Bin (*)[nBins]) &rangeBins[(size_t) r*3*nBins]);
+        }, nThreads);
+        for (int r = 0; r < nRanges; r++)
+            for (int axis = 0; axis < 3; axis++)
+                for (int k = 0; k < nBins; k++) {
+                    Bin &from = rangeBins[((size_t) r*3+axis)*nBins+k];
+                    bins[axis][k].bounds.Grow(from.bounds);
+                    bins[axis][k].count += from.count;
+                }
+    }
+    else
+        Fill(begin, end, bins);
+    // least cost split: traversal 1, intersection 1 per leafGroup triangles, weighted by the chance of
+    // reaching each side
+    auto Groups = [](int n) { return (float) ((n+leafGroup-1)/leafGroup); };
+    float bestCost = FLT_MAX, area = box.Area();
+    int axis = -1, split = 0;
+    for (int a = 0; a < 3; a++) {
+        if (extent[a] <= 0)
+            continue;
+        float rightAreas[nBins];
+        int rightCounts[nBins];
+        Box right, left;
+        for (int k = nBins-1, nRight = 0; k > 0; k--) {
+            right.Grow(bins[a][k].bounds);
+            rightAreas[k] = right.Area();
+            rightCounts[k] = nRight += bins[a][k].count;
+        }
+        for (int k = 1, nLeft = 0; k < nBins; k++) {
+            left.Grow(bins[a][k-1].bounds);
+            nLeft += bins[a][k-1].count;
+            float cost = 1+(left.Area()*Groups(nLeft)+rightAreas[k]*Groups(rightCounts[k]))/area;
+            if (nLeft && rightCounts[k] && cost < bestCost) {
+                bestCost = cost;
+                axis = a;
+                split = k;
+            }
+        }
+    }
+    if (count <= maxLeaf && (axis < 0 || bestCost >= Groups(count)))
+        return;
+    if (depth >= maxDepth)
+        axis = -1;
+    // partition at the split (or, with coincident centroids, in half), bounding each side
+    int mid = begin+count/2;
+    Box boxes[2], centerBoxes[2];
+    if (axis >= 0) {
+        int i = begin, j = end-1;
+        while (true) {
+            while (i <= j && BinOf(axis, prims[i]) < split) {
+                boxes[0].Grow(prims[i].bounds);
+                centerBoxes[0].Grow(prims[i++].center);
+            }
+            while (i <= j && BinOf(axis, prims[j]) >= split) {
+                boxes[1].Grow(prims[j].bounds);
+                centerBoxes[1].Grow(prims[j--].center);
+            }
+            if (i >= j)
+                break;
+            std::swap(prims[i], prims[j]);
+        }
+        mid = i;
+    }
+    else
+        for (int i = begin; i < end; i++) {
+            boxes[i >= mid].Grow(prims[i].bounds);
+            centerBoxes[i >= mid].Grow(prims[i].center);
+        }
+    int first = nodes.size();
+    nodes[n].first = first;
+    nodes[n].count = 0;
+    nodes.resize(first+2);
+    Node(nodes, first, begin, mid, boxes[0], centerBoxes[0], depth+1, top);
+    Node(nodes, first+1, mid, end, boxes[1], centerBoxes[1], depth+1, top);
+}
+
+inline bool Slab(const BvhNode &n, const vec3 &p, const vec3 &inverse, float tol, float lo, float hi, float &near) {
+    // does the line p+alpha*d, lo <= alpha <= hi, cross the node's box (grown by tol)? set near to its entering alpha
+    for (int k = 0; k < 3; k++) {
+        float a1 = (n.min[k]-tol-p[k])*inverse[k], a2 = (n.max[k]+tol-p[k])*inverse[k];
+        lo = std::max(lo, std::min(a1, a2));
+        hi = std::min(hi, std::max(a1, a2));
+    }
+    near = lo;
+    return lo <= hi;
+}
+
+float Tolerance(const vec3 &p1, const vec3 &p2) {
+    // hits are found at p1+alpha*(p2-p1) with rounding relative to p1 and p2, which can be far larger
+    // than the mesh, so boxes are grown by that too
+    float tol = 0;
+    for (int k = 0; k < 3; k++) {
+        tol = fabs(p1[k]) > tol? fabs(p1[k]) : tol;
+        tol = fabs(p2[k]) > tol? fabs(p2[k]) : tol;
+    }
+    return 1e-5f*tol;
+}
+
+template<class Leaf>
+void Traverse(vector<BvhNode> &nodes, vec3 p, vec3 d, float minAlpha, float &alpha, Leaf leaf) {
+    // visit leaves crossed by p+a*d, minAlpha <= a <= alpha, nearer child first; leaf(node) may lower
+    // alpha, or return true to stop; ties at alpha may still hold a lesser index, so boxes at alpha are kept
+    if (nodes.empty())
+        return;
+    vec3 inverse;
+    for (int k = 0; k < 3; k++)
+        inverse[k] = 1/(d[k] != 0? d[k] : 1e-30f);
+    float tol = Tolerance(p, p+d), near;
+    int stack[128], nStack = 0;             // depth is at most maxDepth+31
+    if (!Slab(nodes[0], p, inverse, tol, minAlpha, alpha, near))
+        return;
+    stack[nStack++] = 0;
+    while (nStack) {
+        const BvhNode &n = nodes[stack[--nStack]];
+        if (n.count) {
+            if (leaf(n))
+                return;
+            continue;
+        }
+        float near1, near2;
+        bool hit1 = Slab(nodes[n.first], p, inverse, tol, minAlpha, alpha, near1);
+        bool hit2 = Slab(nodes[n.first+1], p, inverse, tol, minAlpha, alpha, near2);
+        if (hit1 && hit2) {
+            bool swap = near2 < near1;
+            stack[nStack++] = swap? n.first : n.first+1;
+            stack[nStack++] = swap? n.first+1 : n.first;
+        }
+        else if (hit1 || hit2)
+            stack[nStack++] = hit1? n.first : n.first+1;
+    }
+}
+
+// watertight ray-triangle test (Woop, Benthin and Wald 2013): vertices are translated to the ray origin
+// and sheared so the ray runs along +z; the 2D edge functions U, V, W then decide containment exactly
+// (redone in double when one rounds to zero), so no line slips between triangles sharing an edge
+
+struct Ray {
+    vec3 org, dir;
+    int kx = 0, ky = 1, kz = 2;             // axes after the shear; kz has the largest |dir|
+    float sx = 0, sy = 0, sz = 0;
+    bool valid = false;
+    Ray() { }
+    Ray(vec3 o, vec3 d) : org(o), dir(d) {
+        vec3 a(fabs(d.x), fabs(d.y), fabs(d.z));
+        kz = a.x > a.y? (a.x > a.z? 0 : 2) : (a.y > a.z? 1 : 2);
+        if (d[kz] == 0)
+            return;
+        kx = (kz+1)%3;
+        ky = (kx+1)%3;
+        if (d[kz] < 0)
+            std::swap(kx, ky);              // keep winding
+        sx = d[kx]/d[kz];
+        sy = d[ky]/d[kz];
+        sz = 1/d[kz];
+        valid = true;
+    }
+};
+
+bool Watertight(const Ray &r, const float a[3], const float b[3], const float c[3], float &t, float &u, float &v) {
+    // scalar test of one triangle; set alpha t and barycentrics u (of b) and v (of c)
+    float ax = a[r.kx]-r.org[r.kx], ay = a[r.ky]-r.org[r.ky], az = a[r.kz]-r.org[r.kz];
+    float bx = b[r.kx]-r.org[r.kx], by = b[r.ky]-r.org[r.ky], bz = b[r.kz]-r.org[r.kz];
+    float cx = c[r.kx]-r.org[r.kx], cy = c[r.ky]-r.org[r.ky], cz = c[r.kz]-r.org[r.kz];
+    ax -= r.sx*az; ay -= r.sy*az;
+    bx -= r.sx*bz; by -= r.sy*bz;
+    cx -= r.sx*cz; cy -= r.sy*cz;
+    float U = cx*by-cy*bx, V = ax*cy-ay*cx, W = bx*ay-by*ax;
+    if (U == 0 || V == 0 || W == 0) {
+        U = (float) ((double) cx*by-(double) cy*bx);
+        V = (float) ((double) ax*cy-(double) ay*cx);
+        W = (float) ((double) bx*ay-(double) by*ax);
+    }
+    if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0))
+        return false;
+    float det = U+V+W;
+    if (det == 0)
+        return false;
+    float T = U*(r.sz*az)+V*(r.sz*bz)+W*(r.sz*cz);
+    t = T/det;
+    u = V/det;
+    v = W/det;
+    return true;
+}
+
+inline bool Better(float a, int triangle, const RayHit &hit) {
+    // nearer, or as near with a lesser index
+    return a < hit.alpha || (a == hit.alpha && hit.triangle >= 0 && triangle < hit.triangle);
+}
+
+#ifdef MESH_SSE2
+
+// lanes of floats: 8 with AVX, else 4 with SSE2
+
+#ifdef __AVX__
+const int nLanes = 8;
+typedef __m256 Floats;
+inline Floats Set(float f) { return _mm256_set1_ps(f); }
+inline Floats Load(const float *p) { return _mm256_loadu_ps(p); }
+inline void Store(float *p, Floats a) { _mm256_storeu_ps(p, a); }
+inline Floats Add(Floats a, Floats b) { return _mm256_add_ps(a, b); }
+inline Floats Sub(Floats a, Floats b) { return _mm256_sub_ps(a, b); }
+inline Floats Mul(Floats a, Floats b) { return _mm256_mul_ps(a, b); }
+inline Floats Div(Floats a, Floats b) { return _mm256_div_ps(a, b); }
+inline Floats Min(Floats a, Floats b) { return _mm256_min_ps(a, b); }
+inline Floats Max(Floats a, Floats b) { return _mm256_max_ps(a, b); }
+inline Floats Lt(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Floats Le(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline Floats Eq(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+inline Floats Or(Floats a, Floats b) { return _mm256_or_ps(a, b); }
+inline Floats And(Floats a, Floats b) { return _mm256_and_ps(a, b); }
+inline int Bits(Floats a) { return _mm256_movemask_ps(a); }
+#else
+const int nLanes = 4;
+typedef __m128 Floats;
+inline Floats Set(float f) { return _mm_set1_ps(f); }
+inline Floats Load(const float *p) { return _mm_loadu_ps(p); }
+inline void Store(float *p, Floats a) { _mm_storeu_ps(p, a); }
+inline Floats Add(Floats a, Floats b) { return _mm_add_ps(a, b); }
+inline Floats Sub(Floats a, Floats b) { return _mm_sub_ps(a, b); }
+inline Floats Mul(Floats a, Floats b) { return _mm_mul_ps(a, b); }
+inline Floats Div(Floats a, Floats b) { return _mm_div_ps(a, b); }
+inline Floats Min(Floats a, Floats b) { return _mm_min_ps(a, b); }
+inline Floats Max(Floats a, Floats b) { return _mm_max_ps(a, b); }
+inline Floats Lt(Floats a, Floats b) { return _mm_cmplt_ps(a, b); }
+inline Floats Le(Floats a, Floats b) { return _mm_cmple_ps(a, b); }
+inline Floats Eq(Floats a, Floats b) { return _mm_cmpeq_ps(a, b); }
+inline Floats Or(Floats a, Floats b) { return _mm_or_ps(a, b); }
+inline Floats And(Floats a, Floats b) { return _mm_and_ps(a, b); }
+inline int Bits(Floats a) { return _mm_movemask_ps(a); }
+#endif
+
+struct Edges {
+    Floats U, V, W, T;                      // edge functions, and alpha times U+V+W
+};
+
+inline Edges Shear(Floats a[3], Floats b[3], Floats c[3], Floats sx, Floats sy, Floats sz) {
+    // corners already translated to the origin and permuted to kx, ky, kz
+    Floats ax = Sub(a[0], Mul(sx, a[2])), ay = Sub(a[1], Mul(sy, a[2]));
+    Floats bx = Sub(b[0], Mul(sx, b[2])), by = Sub(b[1], Mul(sy, b[2]));
+    Floats cx = Sub(c[0], Mul(sx, c[2])), cy = Sub(c[1], Mul(sy, c[2]));
+    Edges e;
+    e.U = Sub(Mul(cx, by), Mul(cy, bx));
+    e.V = Sub(Mul(ax, cy), Mul(ay, cx));
+    e.W = Sub(Mul(bx, ay), Mul(by, ax));
+    e.T = Add(Add(Mul(e.U, Mul(sz, a[2])), Mul(e.V, Mul(sz, b[2]))), Mul(e.W, Mul(sz, c[2])));
+    return e;
+}
+
+inline int Inside(const Edges &e, int &zero) {
+    // lanes with all edge functions of one sign and nonzero sum; zero gets lanes needing the scalar test
+    Floats z = Set(0);
+    zero = Bits(Or(Or(Eq(e.U, z), Eq(e.V, z)), Eq(e.W, z)));
+    Floats neg = Or(Or(Lt(e.U, z), Lt(e.V, z)), Lt(e.W, z));
+    Floats pos = Or(Or(Lt(z, e.U), Lt(z, e.V)), Lt(z, e.W));
+    return ~Bits(And(neg, pos)) & ~Bits(Eq(Add(Add(e.U, e.V), e.W), z)) & ((1 << nLanes)-1);
+}
+
+#endif
+
+} // end namespace
+
+void MeshBvh::Build(vector<vec3> &points, vector<int3> &triangles, int nThreads) {
+    nodes.clear();
+    order.clear();
+    infos.clear();
+    for (int k = 0; k < 9; k++)
+        corners[k].clear();
+    parents.clear();
+    slots.clear();
+    leaves.clear();
+    weightedArea = builtCost = 0;
+    if (triangles.empty())
+        return;
+    pad = PadFor(points, nThreads);
+    Builder builder(points, triangles, pad, nThreads);
+    builder.Top(nodes, order);
+    int nSlots = order.size();
+    infos.resize(nSlots);
+    for (int k = 0; k < 9; k++)
+        corners[k].assign(nSlots+cornerPad, 0);
+    slots.resize(nSlots);
+    leaves.resize(nSlots);
+    parents.assign(nodes.size(), -1);
+    ParallelRange(nSlots, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            SetSlot(i, points, triangles);
+            slots[order[i]] = i;
+        }
+    }, binGrain, nThreads);
+    ParallelRange(nodes.size(), [&](int begin, int end) {
+        for (int n = begin; n < end; n++) {
+            BvhNode &node = nodes[n];
+            if (node.count)
+                for (int i = node.first; i < node.first+node.count; i++)
+                    leaves[i] = n;
+            else
+                parents[node.first] = parents[node.first+1] = n;
+        }
+    }, binGrain, nThreads);
+    weightedArea = 0;
+    for (size_t n = 0; n < nodes.size(); n++)
+        weightedArea += NodeArea(nodes[n]);
+    builtCost = Cost();
+}
+
+void MeshBvh::SetSlot(int i, vector<vec3> &points, vector<int3> &triangles) {
+    int3 &t = triangles[order[i]];
+    infos[i] = TriInfo(points[t.i1], points[t.i2], points[t.i3]);
+    for (int j = 0; j < 3; j++)
+        for (int k = 0; k < 3; k++)
+            corners[3*j+k][i] = points[t[j]][k];
+}
+
+void MeshBvh::SetBounds(int n, const vec3 &min, const vec3 &max) {
+    BvhNode &node = nodes[n];
+    weightedArea -= NodeArea(node);
+    node.min = min;
+    node.max = max;
+    weightedArea += NodeArea(node);
+}
+
+void MeshBvh::Refit(vector<vec3> &points, vector<int3> &triangles, const vector<int> &changed) {
+    // update slots, then walk up from each leaf touched; each step leaves every node bounding its children,
+    // so a walk can stop at the first node whose bounds don't change
+    float reach = pad/1e-5f;
+    for (size_t c = 0; c < changed.size(); c++)
+        for (int j = 0; j < 3; j++) {
+            vec3 &p = points[triangles[changed[c]][j]];
+            if (fabs(p.x) > reach || fabs(p.y) > reach || fabs(p.z) > reach) {
+                Refit(points, triangles);
+                return;
+            }
+        }
+    vector<int> touched(changed.size());
+    for (size_t c = 0; c < changed.size(); c++) {
+        int slot = slots[changed[c]];
+        SetSlot(slot, points, triangles);
+        touched[c] = leaves[slot];
+    }
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (size_t c = 0; c < touched.size(); c++)
+        for (int n = touched[c]; n >= 0; n = parents[n]) {
+            Box b = Bounds(*this, n);
+            if (Same(b.min, nodes[n].min) && Same(b.max, nodes[n].max))
+                break;
+            SetBounds(n, b.min, b.max);
+        }
+}
+
+void MeshBvh::Refit(vector<vec3> &points, vector<int3> &triangles, int nThreads) {
+    if (nodes.empty())
+        return;
+    pad = PadFor(points, nThreads);
+    // leaves with their slots in parallel
+    ParallelRange(nodes.size(), [&](int begin, int end) {
+        for (int n = begin; n < end; n++)
+            if (nodes[n].count) {
+                for (int i = nodes[n].first; i < nodes[n].first+nodes[n].count; i++)
+                    SetSlot(i, points, triangles);
+                Box b = Bounds(*this, n);
+                nodes[n].min = b.min;
+                nodes[n].max = b.max;
+            }
+    }, binGrain, nThreads);
+    // children follow their parent, so a reverse pass sees children first
+    weightedArea = 0;
+    for (int n = (int) nodes.size()-1; n >= 0; n--) {
+        if (!nodes[n].count) {
+            Box b = Bounds(*this, n);
+            nodes[n].min = b.min;
+            nodes[n].max = b.max;
+        }
+        weightedArea += NodeArea(nodes[n]);
+    }
+}
+
+int MeshBvh::Intersect(vec3 p1, vec3 p2, float &alpha, bool anyHit, float minAlpha, float maxAlpha) {
+    int picked = -1;
+    alpha = maxAlpha;
+    Traverse(nodes, p1, p2-p1, minAlpha, alpha, [&](const BvhNode &n) {
+        for (int i = n.first; i < n.first+n.count; i++) {
+            float a;
+            if (IntersectTriInfo(p1, p2, infos[i], a) && a >= minAlpha &&
+                (a < alpha || (a == alpha && picked >= 0 && order[i] < picked))) {
+                alpha = a;
+                picked = order[i];
+                if (anyHit)
+                    return true;
+            }
+        }
+        return false;
+    });
+    return picked;
+}
+
+int MeshBvh::IntersectRay(vec3 origin, vec3 direction, RayHit &hit, bool anyHit, float minAlpha, float maxAlpha) {
+    hit = RayHit();
+    hit.alpha = maxAlpha;
+    Ray r(origin, direction);
+    if (!r.valid)
+        return -1;
+    auto Accept = [&](int i, float t, float u, float v) {
+        if (t >= minAlpha && Better(t, order[i], hit)) {
+            hit.triangle = order[i];
+            hit.alpha = t;
+            hit.u = u;
+            hit.v = v;
+            return true;
+        }
+        return false;
+    };
+    auto Scalar = [&](int i) {
+        float a[3], b[3], c[3], t, u, v;
+        for (int k = 0; k < 3; k++) {
+            a[k] = corners[k][i];
+            b[k] = corners[3+k][i];
+            c[k] = corners[6+k][i];
+        }
+        return Watertight(r, a, b, c, t, u, v) && Accept(i, t, u, v);
+    };
+    Traverse(nodes, origin, direction, minAlpha, hit.alpha, [&](const BvhNode &n) {
+#ifdef MESH_SSE2
+        // nLanes triangles at once (corners are padded so loads past the last triangle are safe)
+        int axes[3] = {r.kx, r.ky, r.kz};
+        Floats sx = Set(r.sx), sy = Set(r.sy), sz = Set(r.sz);
+        for (int first = n.first; first < n.first+n.count; first += nLanes) {
+            Floats a[3], b[3], c[3];
+            for (int k = 0; k < 3; k++) {
+                Floats o = Set(r.org[axes[k]]);
+                a[k] = Sub(Load(&corners[axes[k]][first]), o);
+                b[k] = Sub(Load(&corners[3+axes[k]][first]), o);
+                c[k] = Sub(Load(&corners[6+axes[k]][first]), o);
+            }
+            Edges e = Shear(a, b, c, sx, sy, sz);
+            int zero, live = n.first+n.count-first < nLanes? (1 << (n.first+n.count-first))-1 : (1 << nLanes)-1;
+            int inside = Inside(e, zero) & ~zero & live;
+            zero &= live;
+            if (!inside && !zero)
+                continue;
+            float U[nLanes], V[nLanes], W[nLanes], T[nLanes];
+            Store(U, e.U);
+            Store(V, e.V);
+            Store(W, e.W);
+            Store(T, e.T);
+            for (int lane = 0; lane < nLanes; lane++) {
+                int i = first+lane;
+                if (zero & (1 << lane)) {
+                    if (Scalar(i) && anyHit)
+                        return true;
+                }
+                else if (inside & (1 << lane)) {
+                    float det = U[lane]+V[lane]+W[lane];
+                    if (Accept(i, T[lane]/det, V[lane]/det, W[lane]/det) && anyHit)
+                        return true;
+                }
+            }
+        }
+#else
+        for (int i = n.first; i < n.first+n.count; i++)
+            if (Scalar(i) && anyHit)
+                return true;
+#endif
+        return false;
+    });
+    return hit.triangle;
+}
+
+void MeshBvh::IntersectPacket(const vec3 *origins, const vec3 *directions, int nRays, RayHit *hits,
+                              bool anyHit, float minAlpha, float maxAlpha) {
+#ifdef MESH_SSE2
+    for (int first = 0; first < nRays; first += nLanes) {
+        int n = nRays-first < nLanes? nRays-first : nLanes;
+        const vec3 *o = origins+first, *d = directions+first;
+        RayHit *h = hits+first;
+        // lanes share one traversal only if their rays shear alike; otherwise trace them singly
+        Ray r0(o[0], d[0]);
+        bool coherent = r0.valid;
+        Ray rays[nLanes];
+        for (int i = 0; i < n && coherent; i++) {
+            rays[i] = Ray(o[i], d[i]);
+            coherent = rays[i].valid && rays[i].kx == r0.kx && rays[i].ky == r0.ky && rays[i].kz == r0.kz;
+        }
+        if (!coherent || nodes.empty()) {
+            for (int i = 0; i < n; i++)
+                IntersectRay(o[i], d[i], h[i], anyHit, minAlpha, maxAlpha);
+            continue;
+        }
+        // per lane origin, inverse direction (zero components made tiny: a line in a face plane of a
+        // grown box can't meet a triangle), shear, and alpha limit; unused lanes repeat the first ray
+        float org[3][nLanes], inv[3][nLanes], shear[3][nLanes], limit[nLanes], tol = 0;
+        for (int lane = 0; lane < nLanes; lane++) {
+            Ray &r = rays[lane < n? lane : 0];
+            for (int k = 0; k < 3; k++) {
+                float dk = r.dir[k] != 0? r.dir[k] : (r.dir[k] < 0? -1e-30f : 1e-30f);
+                org[k][lane] = r.org[k];
+                inv[k][lane] = 1/dk;
+            }
+            shear[0][lane] = r.sx;
+            shear[1][lane] = r.sy;
+            shear[2][lane] = r.sz;
+            limit[lane] = lane < n? maxAlpha : -HUGE_VALF;
+            float t = Tolerance(r.org, r.org+r.dir);
+            tol = t > tol? t : tol;
+        }
+        for (int i = 0; i < n; i++) {
+            h[i] = RayHit();
+            h[i].alpha = maxAlpha;
+        }
+        Floats O[3], I[3], sx = Load(shear[0]), sy = Load(shear[1]), sz = Load(shear[2]);
+        Floats lo = Set(minAlpha), T = Set(tol);
+        for (int k = 0; k < 3; k++) {
+            O[k] = Load(org[k]);
+            I[k] = Load(inv[k]);
+        }
+        int axes[3] = {r0.kx, r0.ky, r0.kz}, done = 0;
+        auto Cross = [&](const BvhNode &node, float &near) {
+            // lanes whose rays cross the node's box (grown by tol) within their limits; near is the least entry
+            Floats enter = lo, exit = Load(limit);
+            for (int k = 0; k < 3; k++) {
+                Floats a1 = Mul(Sub(Sub(Set(node.min[k]), T), O[k]), I[k]);
+                Floats a2 = Mul(Sub(Add(Set(node.max[k]), T), O[k]), I[k]);
+                enter = Max(enter, Min(a1, a2));
+                exit = Min(exit, Max(a1, a2));
+            }
+            int mask = Bits(Le(enter, exit));
+            float e[nLanes];
+            Store(e, enter);
+            near = HUGE_VALF;
+            for (int lane = 0; lane < nLanes; lane++)
+                if (mask & (1 << lane))
+                    near = e[lane] < near? e[lane] : near;
+            return mask;
+        };
+        float near;
+        int stack[128], nStack = 0;
+        if (Cross(nodes[0], near))
+            stack[nStack++] = 0;
+        while (nStack) {
+            const BvhNode &node = nodes[stack[--nStack]];
+            if (!node.count) {
+                float near1, near2;
+                bool hit1 = Cross(nodes[node.first], near1) != 0, hit2 = Cross(nodes[node.first+1], near2) != 0;
+                if (hit1 && hit2) {
+                    bool swap = near2 < near1;
+                    stack[nStack++] = swap? node.first : node.first+1;
+                    stack[nStack++] = swap? node.first+1 : node.first;
+                }
+                else if (hit1 || hit2)
+                    stack[nStack++] = hit1? node.first : node.first+1;
+                continue;
+            }
+            // each triangle against all lanes
+            for (int i = node.first; i < node.first+node.count; i++) {
+                Floats a[3], b[3], c[3];
+                for (int k = 0; k < 3; k++) {
+                    a[k] = Sub(Set(corners[axes[k]][i]), O[axes[k]]);
+                    b[k] = Sub(Set(corners[3+axes[k]][i]), O[axes[k]]);
+                    c[k] = Sub(Set(corners[6+axes[k]][i]), O[axes[k]]);
+                }
+                Edges e = Shear(a, b, c, sx, sy, sz);
+                int zero, live = ((1 << n)-1) & ~done;
+                int inside = Inside(e, zero) & ~zero & live;
+                zero &= live;
+                if (!inside && !zero)
+                    continue;
+                float U[nLanes], V[nLanes], W[nLanes], Ts[nLanes];
+                Store(U, e.U);
+                Store(V, e.V);
+                Store(W, e.W);
+                Store(Ts, e.T);
+                for (int lane = 0; lane < n; lane++) {
+                    float t, u, v;
+                    if (zero & (1 << lane)) {
+                        float ca[3], cb[3], cc[3];
+                        for (int k = 0; k < 3; k++) {
+                            ca[k] = corners[k][i];
+                            cb[k] = corners[3+k][i];
+                            cc[k] = corners[6+k][i];
+                        }
+                        if (!Watertight(rays[lane], ca, cb, cc, t, u, v))
+                            continue;
+                    }
+                    else if (inside & (1 << lane)) {
+                        float det = U[lane]+V[lane]+W[lane];
+                        t = Ts[lane]/det;
+                        u = V[lane]/det;
+                        v = W[lane]/det;
+                    }
+                    else
+                        continue;
+                    if (t >= minAlpha && Better(t, order[i], h[lane])) {
+                        h[lane].triangle = order[i];
+                        h[lane].alpha = t;
+                        h[lane].u = u;
+                        h[lane].v = v;
+                        limit[lane] = t;
+                        if (anyHit) {
+                            // a finished lane fails every box test
+                            done |= 1 << lane;
+                            limit[lane] = -HUGE_VALF;
+                        }
+                    }
+                }
+            }
+        }
+    }
+#else
+    for (int i = 0; i < nRays; i++)
+        IntersectRay(origins[i], directions[i], hits[i], anyHit, minAlpha, maxAlpha);
+#endif
+}
+
+void MeshBvh::IntersectRays(const vec3 *origins, const vec3 *directions, int nRays, RayHit *hits,
+                            bool anyHit, float minAlpha, float maxAlpha, int nThreads) {
+    // each call traverses with its own stack, so threads share only the tree
+    auto Run = [&](int r) {
+        int first = r*rayRun, n = nRays-first < rayRun? nRays-first : rayRun;
+        IntersectPacket(origins+first, directions+first, n, hits+first, anyHit, minAlpha, maxAlpha);
+    };
+    int nRuns = (nRays+rayRun-1)/rayRun;
+    if (nThreads == 0)
+        SharedPool().For(nRuns, Run);
+    else
+        ParallelFor(nRuns, Run, nThreads);
+}
+
+float MeshBvh::Cost() {
+    if (nodes.empty())
+        return 0;
+    float rootArea = NodeArea(nodes[0]);
+    return rootArea > 0? (float) (weightedArea/rootArea) : 0;
+}
+
+// Picking
+
+struct BvhRebuild {
+    std::atomic<bool> done{false};          // set once bvh is built
+    std::shared_ptr<MeshBvh> bvh;
+};
+
+namespace {
+
+const float rebuildCost = 1.5f;             // rebuild once refits raise Cost this far over its built value
+
+void Refit(TriInfos &e, vector<vec3> &points, vector<int3> &triangles, const vector<int> *moved) {
+    // refit along the moved triangles (or all, if moved is null); a finished rebuild first replaces the
+    // tree, caught up on triangles moved since it started; a tree degraded by refits starts a rebuild on a
+    // copy of the mesh, on a detached thread leaving a core for the caller; the thread and e share the
+    // rebuild, so neither waits on the other
+    if (e.rebuild && e.rebuild->done.load(std::memory_order_acquire)) {
+        std::shared_ptr<MeshBvh> bvh = e.rebuild->bvh;
+        if (e.allMoved)
+            bvh->Refit(points, triangles);
+        else if (!e.moved.empty())
+            bvh->Refit(points, triangles, e.moved);
+        e.bvh = bvh;
+        e.rebuild.reset();
+        e.moved.clear();
+        e.allMoved = false;
+    }
+    if (moved)
+        e.bvh->Refit(points, triangles, *moved);
+    else
+        e.bvh->Refit(points, triangles);
+    if (e.rebuild) {
+        if (moved && !e.allMoved) {
+            e.moved.insert(e.moved.end(), moved->begin(), moved->end());
+            if (e.moved.size() > triangles.size()/8) {
+                std::sort(e.moved.begin(), e.moved.end());
+                e.moved.erase(std::unique(e.moved.begin(), e.moved.end()), e.moved.end());
+            }
+        }
+        if (!moved || e.moved.size() > triangles.size()/8) {
+            e.allMoved = true;
+            e.moved.clear();
+        }
+    }
+    else if (e.bvh->Cost() > rebuildCost*e.bvh->builtCost) {
+        int nThreads = NumThreads() > 1? NumThreads()-1 : 1;
+        std::shared_ptr<BvhRebuild> rebuild = std::make_shared<BvhRebuild>();
+        e.rebuild = rebuild;
+        std::thread([rebuild, p = points, t = triangles, nThreads]() mutable {
+            std::shared_ptr<MeshBvh> bvh = std::make_shared<MeshBvh>();
+            bvh->Build(p, t, nThreads);
+            rebuild->bvh = bvh;
+            rebuild->done.store(true, std::memory_order_release);
+        }).detach();
+    }
+}
+
+} // end namespace
+
+void BuildTriInfos(vector<vec3> &points, vector<int3> &triangles, TriInfos &triInfos) {
+    triInfos = TriInfos();
+    triInfos.bvh = std::make_shared<MeshBvh>();
+    triInfos.bvh->Build(points, triangles);
+}
+
+void UpdateTriInfos(vector<vec3> &points, vector<int3> &triangles, TriInfos &triInfos, const vector<int> &movedPoints) {
+    if (!triInfos.bvh)
+        return;
+    if (triInfos.pointStarts.empty()) {
+        // counting sort of triangles by point
+        vector<int> &starts = triInfos.pointStarts, &tris = triInfos.pointTriangles;
+        starts.assign(points.size()+1, 0);
+        for (size_t i = 0; i < triangles.size(); i++)
+            for (int k = 0; k < 3; k++)
+                starts[triangles[i][k]+1]++;
+        for (size_t i = 0; i < points.size(); i++)
+            starts[i+1] += starts[i];
+        tris.resize(3*triangles.size());
+        vector<int> next(starts.begin(), starts.end()-1);
+        for (size_t i = 0; i < triangles.size(); i++)
+            for (int k = 0; k < 3; k++)
+                tris[next[triangles[i][k]]++] = i;
+    }
+    vector<int> moved;
+    for (size_t i = 0; i < movedPoints.size(); i++) {
+        int p = movedPoints[i];
+        moved.insert(moved.end(), triInfos.pointTriangles.begin()+triInfos.pointStarts[p],
+                     triInfos.pointTriangles.begin()+triInfos.pointStarts[p+1]);
+    }
+    std::sort(moved.begin(), moved.end());
+    moved.erase(std::unique(moved.begin(), moved.end()), moved.end());
+    Refit(triInfos, points, triangles, &moved);
+}
+
+void UpdateTriInfos(vector<vec3> &points, vector<int3> &triangles, TriInfos &triInfos) {
+    if (triInfos.bvh)
+        Refit(triInfos, points, triangles, NULL);
+}
+
+int IntersectWithLine(vec3 p1, vec3 p2, TriInfos &triInfos, float &alpha) {
+    if (triInfos.bvh)
+        return triInfos.bvh->Intersect(p1, p2, alpha);
+    alpha = FLT_MAX;
+    return -1;
+}
+
+void IntersectWithRays(TriInfos &triInfos, const vec3 *origins, const vec3 *directions, int nRays,
+                       RayHit *hits, int nThreads) {
+    if (triInfos.bvh)
+        triInfos.bvh->IntersectRays(origins, directions, nRays, hits, false, -HUGE_VALF, FLT_MAX, nThreads);
+    else
+        std::fill(hits, hits+nRays, RayHit());
+}
@@ -0,0 +1,170 @@
+// MeshCache.cpp - binary mesh sidecar files for fast reload
+
+#include "MeshCache.h"
+#include "MeshIO.h"
+#include "Misc.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char cacheMagic[8] = {'M', 'E', 'S', 'H', 'C', 'C', 'H', 0};
+const unsigned int cacheVersion = 2;
+
+struct CacheHeader {
+    char magic[8];
+    unsigned int version, headerSize;
+    long long sourceModified, sourceSize;
+    float normalizeScale;
+    int nPoints, nNormals, nUvs, nTriangles;
+    float transform[16];
+    float min[3], max[3];
+    long long pointsOffset, normalsOffset, uvsOffset, trianglesOffset;
+    int nLibraries, nMaterialNames, nTriangleMaterials;
+    long long namesOffset, namesSize, triangleMaterialsOffset;
+};
+
+long long FileSize(const char *name) {
+    struct stat info;
+    return stat(name, &info) == 0? (long long) info.st_size : -1;
+}
+
+long long Align(long long offset) { return (offset+15) & ~15LL; }
+
+bool WriteArray(FILE *out, const void *data, long long nBytes, long long &offset) {
+    // pad to alignment, write array, return its offset
+    static const char zeros[16] = {0};
+    long long start = Align(offset);
+    if (start > offset && fwrite(zeros, 1, (size_t) (start-offset), out) != (size_t) (start-offset))
+        return false;
+    if (nBytes && fwrite(data, 1, (size_t) nBytes, out) != (size_t) nBytes)
+        return false;
+    offset = start+nBytes;
+    return true;
+}
+
+bool ArrayFits(MappedFile &file, long long offset, int count, size_t elementSize) {
+    return count >= 0 && offset >= (long long) sizeof(CacheHeader) && offset+count*(long long) elementSize <= (long long) file.size;
+}
+
+template<class T>
+void CopyArray(MappedFile &file, long long offset, int count, vector<T> &v) {
+    // arrays are stored as kept in memory, so copy bytes into the (not trivially copyable) elements
+    v.resize(count);
+    if (count)
+        memcpy((void *) &v[0], file.data+offset, count*sizeof(T));
+}
+
+} // end namespace
+
+string MeshCacheName(const char *sourceName) {
+    return string(sourceName)+".mcache";
+}
+
+bool WriteMeshCache(const char *cacheName, const char *sourceName, MeshCacheInfo &info,
+                    vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                    ObjMaterials *materials) {
+    FILE *out = fopen(cacheName, "wb");
+    if (!out)
+        return false;
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));                       // magic left zero until arrays are written
+    h.version = cacheVersion;
+    h.headerSize = sizeof(CacheHeader);
+    h.sourceModified = (long long) FileModified(sourceName);
+    h.sourceSize = FileSize(sourceName);
+    h.normalizeScale = info.normalizeScale;
+    h.nPoints = points.size();
+    h.nNormals = normals.size();
+    h.nUvs = uvs.size();
+    h.nTriangles = triangles.size();
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            h.transform[4*i+j] = info.transform[i][j];
+    for (int k = 0; k < 3; k++) {
+        h.min[k] = info.min[k];
+        h.max[k] = info.max[k];
+    }
+    long long offset = sizeof(h);
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1;
+    ok = ok && WriteArray(out, points.data(), (long long) h.nPoints*sizeof(vec3), offset);
+    h.pointsOffset = offset-(long long) h.nPoints*sizeof(vec3);
+    ok = ok && WriteArray(out, normals.data(), (long long) h.nNormals*sizeof(vec3), offset);
+    h.normalsOffset = offset-(long long) h.nNormals*sizeof(vec3);
+    ok = ok && WriteArray(out, uvs.data(), (long long) h.nUvs*sizeof(vec2), offset);
+    h.uvsOffset = offset-(long long) h.nUvs*sizeof(vec2);
+    ok = ok && WriteArray(out, triangles.data(), (long long) h.nTriangles*sizeof(int3), offset);
+    h.trianglesOffset = offset-(long long) h.nTriangles*sizeof(int3);
+    if (materials) {
+        // library and material names as consecutive null-terminated strings
+        string names;
+        for (size_t i = 0; i < materials->libraries.size(); i++)
+            names.append(materials->libraries[i].c_str(), materials->libraries[i].size()+1);
+        for (size_t i = 0; i < materials->names.size(); i++)
+            names.append(materials->names[i].c_str(), materials->names[i].size()+1);
+        h.nLibraries = materials->libraries.size();
+        h.nMaterialNames = materials->names.size();
+        h.nTriangleMaterials = materials->triangleMaterials.size();
+        h.namesSize = names.size();
+        ok = ok && WriteArray(out, names.data(), h.namesSize, offset);
+        h.namesOffset = offset-h.namesSize;
+        ok = ok && WriteArray(out, materials->triangleMaterials.data(), (long long) h.nTriangleMaterials*sizeof(int), offset);
+        h.triangleMaterialsOffset = offset-(long long) h.nTriangleMaterials*sizeof(int);
+    }
+    // header rewritten last, so a partial file is never mistaken for a valid cache
+    memcpy(h.magic, cacheMagic, sizeof(cacheMagic));
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        remove(cacheName);
+    return ok;
+}
+
+bool ReadMeshCache(const char *cacheName, const char *sourceName, float normalizeScale,
+                   vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                   MeshCacheInfo *info, ObjMaterials *materials) {
+    MappedFile file(cacheName);
+    if (!file.data || file.size < sizeof(CacheHeader))
+        return false;
+    CacheHeader h;
+    memcpy(&h, file.data, sizeof(h));
+    if (memcmp(h.magic, cacheMagic, sizeof(cacheMagic)) || h.version != cacheVersion || h.headerSize != sizeof(CacheHeader))
+        return false;
+    if (h.normalizeScale != normalizeScale)
+        return false;
+    if (sourceName && (h.sourceModified != (long long) FileModified(sourceName) || h.sourceSize != FileSize(sourceName)))
+        return false;
+    if (!ArrayFits(file, h.pointsOffset, h.nPoints, sizeof(vec3)) ||
+        !ArrayFits(file, h.normalsOffset, h.nNormals, sizeof(vec3)) ||
+        !ArrayFits(file, h.uvsOffset, h.nUvs, sizeof(vec2)) ||
+        !ArrayFits(file, h.trianglesOffset, h.nTriangles, sizeof(int3)) ||
+        (h.namesSize && !ArrayFits(file, h.namesOffset, (int) h.namesSize, 1)) ||
+        (h.nTriangleMaterials && !ArrayFits(file, h.triangleMaterialsOffset, h.nTriangleMaterials, sizeof(int))))
+        return false;
+    // arrays are stored in memory layout: one block copy each
+    CopyArray(file, h.pointsOffset, h.nPoints, points);
+    CopyArray(file, h.normalsOffset, h.nNormals, normals);
+    CopyArray(file, h.uvsOffset, h.nUvs, uvs);
+    CopyArray(file, h.trianglesOffset, h.nTriangles, triangles);
+    if (materials) {
+        materials->libraries.clear();
+        materials->names.clear();
+        const char *name = file.data+h.namesOffset, *namesEnd = name+h.namesSize;
+        for (int i = 0; i < h.nLibraries+h.nMaterialNames && name < namesEnd; i++) {
+            size_t n = strnlen(name, namesEnd-name);
+            (i < h.nLibraries? materials->libraries : materials->names).push_back(string(name, n));
+            name += n+1;
+        }
+        CopyArray(file, h.triangleMaterialsOffset, h.nTriangleMaterials, materials->triangleMaterials);
+    }
+    if (info) {
+        info->normalizeScale = h.normalizeScale;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                info->transform[i][j] = h.transform[4*i+j];
+        info->min = vec3(h.min);
+        info->max = vec3(h.max);
+    }
+    return true;
+}
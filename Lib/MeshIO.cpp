@@ -0,0 +1,1992 @@
+// MeshIO.cpp - fast mesh file input and output
+
+#include "MeshIO.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::vector;
+
+// Memory-Mapped File
+
+bool MappedFile::Open(const char *filename) {
+    Close();
+#ifdef _WIN32
+    HANDLE f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+        return false;
+    file = f;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(f, &fileSize)) {
+        Close();
+        return false;
+    }
+    size = (size_t) fileSize.QuadPart;
+    if (!size)                                          // can't map an empty file
+        return true;
+    mapping = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    data = mapping? (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        return false;
+    }
+    size = (size_t) info.st_size;
+    if (size) {
+        void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = m == MAP_FAILED? NULL : (const char *) m;
+        if (data)
+            madvise((void *) data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);                                          // mapping persists after close
+    if (!size)
+        return true;
+#endif
+    if (!data) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping)
+        CloseHandle((HANDLE) mapping);
+    if (file)
+        CloseHandle((HANDLE) file);
+#else
+    if (data)
+        munmap((void *) data, size);
+#endif
+    data = NULL;
+    file = mapping = NULL;
+    size = 0;
+}
+
+// Number Parsing
+
+namespace {
+
+inline bool IsBlank(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+inline const char *SkipBlanks(const char *ptr, const char *end) {
+    while (ptr < end && IsBlank(*ptr))
+        ptr++;
+    return ptr;
+}
+
+inline const char *SkipWord(const char *ptr, const char *end) {
+    while (ptr < end && !IsBlank(*ptr))
+        ptr++;
+    return ptr;
+}
+
+const double powersOf10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                             1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+float SlowParseFloat(const char *start, const char *&ptr, const char *end) {
+    // uncommon input (long mantissa, large exponent, inf/nan): copy and let strtof decide
+    char buf[128];
+    size_t n = end-start < (int) sizeof(buf)-1? end-start : sizeof(buf)-1;
+    memcpy(buf, start, n);
+    buf[n] = 0;
+    char *stop = buf;
+    float f = strtof(buf, &stop);
+    ptr = start+(stop-buf);
+    return f;
+}
+
+} // end namespace
+
+bool ParseFloat(const char *&ptr, const char *end, float &f) {
+    // mantissa accumulated as a 64-bit integer; when it and the power of ten are exactly
+    // representable as doubles, a single multiply or divide rounds correctly to double
+    const char *p = SkipBlanks(ptr, end), *start = p;
+    bool negative = false, anyDigits = false, exact = true;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    unsigned long long mantissa = 0;
+    int nDigits = 0, exponent = 0;
+    for (; p < end && IsDigit(*p); p++, anyDigits = true)
+        if (nDigits < 19) {
+            mantissa = 10*mantissa+(*p-'0');
+            nDigits += mantissa > 0;
+        }
+        else {
+            exponent++;
+            exact = exact && *p == '0';
+        }
+    if (p < end && *p == '.') {
+        for (p++; p < end && IsDigit(*p); p++, anyDigits = true)
+            if (nDigits < 19) {
+                mantissa = 10*mantissa+(*p-'0');
+                nDigits += mantissa > 0;
+                exponent--;
+            }
+            else
+                exact = exact && *p == '0';
+    }
+    if (!anyDigits) {
+        if (p < end && (*p == 'i' || *p == 'I' || *p == 'n' || *p == 'N')) {
+            const char *q = p;
+            f = SlowParseFloat(start, q, end);
+            if (q == start)
+                return false;
+            ptr = q;
+            return true;
+        }
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p+1;
+        bool negExp = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negExp = *q++ == '-';
+        if (q < end && IsDigit(*q)) {
+            int e = 0;
+            for (; q < end && IsDigit(*q); q++)
+                if (e < 100000)
+                    e = 10*e+(*q-'0');
+            exponent += negExp? -e : e;
+            p = q;
+        }
+    }
+    if (exact && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        // d is within half a double ulp of the decimal value, so rounding d to float matches
+        // strtof unless d fell exactly halfway between two floats (low 29 bits 1000...0)
+        double d = (double) mantissa;
+        d = exponent < 0? d/powersOf10[-exponent] : d*powersOf10[exponent];
+        unsigned long long bits;
+        memcpy(&bits, &d, sizeof(bits));
+        if ((bits & 0x1fffffffull) != 0x10000000ull) {
+            f = (float) (negative? -d : d);
+            ptr = p;
+            return true;
+        }
+    }
+    f = SlowParseFloat(start, ptr, p);
+    return true;
+}
+
+bool ParseInt(const char *&ptr, const char *end, int &i) {
+    const char *p = SkipBlanks(ptr, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p >= end || !IsDigit(*p))
+        return false;
+    int n = 0;
+    for (; p < end && IsDigit(*p); p++)
+        n = 10*n+(*p-'0');
+    i = negative? -n : n;
+    ptr = p;
+    return true;
+}
+
+// ASCII OBJ via Memory Map
+
+namespace {
+
+int AtoI(const char *ptr, const char *end) {
+    // as atoi: 0 if no conversion
+    int i = 0;
+    return ParseInt(ptr, end, i)? i : 0;
+}
+
+bool IsKeyword(const char *word, const char *wordEnd, const char *keyword) {
+    // case-insensitive comparison of [word, wordEnd) with null-terminated keyword
+    for (; word < wordEnd; word++, keyword++)
+        if (!*keyword || (*word >= 'A' && *word <= 'Z'? *word|0x20 : *word) != *keyword)
+            return false;
+    return *keyword == 0;
+}
+
+class VidHash {
+    // open-addressing (linear probe) table from (vid, tid, nid) to mesh vertex id
+    struct Slot { int vid, tid, nid, id; };
+    vector<Slot> slots;
+    size_t mask = 0, count = 0;
+    static size_t Hash(int vid, int tid, int nid) {
+        unsigned long long h = ((unsigned long long) (unsigned) vid << 32 | (unsigned) tid)^
+                               ((unsigned long long) (unsigned) nid*0x9e3779b97f4a7c15ull);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return (size_t) h;
+    }
+    void Grow() {
+        vector<Slot> old;
+        old.swap(slots);
+        size_t capacity = old.empty()? 1024 : 2*old.size();
+        Slot empty = {0, 0, 0, -1};
+        slots.assign(capacity, empty);
+        mask = capacity-1;
+        for (size_t i = 0; i < old.size(); i++)
+            if (old[i].id >= 0) {
+                size_t h = Hash(old[i].vid, old[i].tid, old[i].nid)&mask;
+                while (slots[h].id >= 0)
+                    h = (h+1)&mask;
+                slots[h] = old[i];
+            }
+    }
+public:
+    VidHash(size_t expected = 0) {
+        while (slots.size() < 2*expected)
+            Grow();
+    }
+    int Insert(int vid, int tid, int nid, int id) {
+        // return id previously stored for (vid, tid, nid), else store and return given id
+        if (2*(count+1) > slots.size())
+            Grow();
+        for (size_t h = Hash(vid, tid, nid)&mask;; h = (h+1)&mask) {
+            Slot &s = slots[h];
+            if (s.id < 0) {
+                Slot n = {vid, tid, nid, id};
+                s = n;
+                count++;
+                return id;
+            }
+            if (s.vid == vid && s.tid == tid && s.nid == nid)
+                return s.id;
+        }
+    }
+    int Find(int vid, int tid, int nid) {
+        // return id stored for (vid, tid, nid), else -1
+        for (size_t h = mask? Hash(vid, tid, nid)&mask : 0; !slots.empty(); h = (h+1)&mask) {
+            Slot &s = slots[h];
+            if (s.id < 0 || (s.vid == vid && s.tid == tid && s.nid == nid))
+                return s.id;
+        }
+        return -1;
+    }
+};
+
+template<class Sink>
+bool ParseObjLine(const char *ptr, const char *eol, Sink &sink) {
+    // parse one line of an OBJ file, passing its record to sink; return false if a v, vn, or vt is malformed
+    // use of / is optional (ie, '3' is same as '3/3/3'); obj indexes from 1, sink receives indices from 0
+    ptr = SkipBlanks(ptr, eol);
+    if (ptr == eol || *ptr == '#')
+        return true;
+    const char *word = ptr, *wordEnd = ptr = SkipWord(ptr, eol);
+    if (IsKeyword(word, wordEnd, "g")) {
+        int group;
+        if (ParseInt(ptr, eol, group))                  // group field significant only if integer
+            sink.Group(group);
+    }
+    else if (IsKeyword(word, wordEnd, "v") || IsKeyword(word, wordEnd, "vn")) {
+        vec3 v;
+        if (!ParseFloat(ptr, eol, v.x) || !ParseFloat(ptr, eol, v.y) || !ParseFloat(ptr, eol, v.z))
+            return false;
+        if (wordEnd-word == 1)
+            sink.Vertex(v);
+        else
+            sink.Normal(v);
+    }
+    else if (IsKeyword(word, wordEnd, "vt")) {
+        vec2 t;
+        if (!ParseFloat(ptr, eol, t.x) || !ParseFloat(ptr, eol, t.y))
+            return false;
+        sink.Uv(t);
+    }
+    else if (IsKeyword(word, wordEnd, "f")) {
+        sink.BeginFace();
+        for (;;) {                                      // read arbitrary # face vid/tid/nid
+            const char *tok = SkipBlanks(ptr, eol), *tokEnd = ptr = SkipWord(tok, eol);
+            if (tok == tokEnd)
+                break;
+            const char *tPtr = tokEnd-tok > 1? (const char *) memchr(tok+1, '/', tokEnd-tok-1) : NULL;
+            const char *nPtr = tPtr? (const char *) memchr(tPtr+1, '/', tokEnd-tPtr-1) : NULL;
+            int vid = AtoI(tok, tokEnd);
+            if (!vid)
+                break;
+            int tid = tPtr && tPtr+1 < tokEnd && tPtr[1] != '/'? AtoI(tPtr+1, tokEnd) : vid;
+            int nid = nPtr && nPtr+1 < tokEnd? AtoI(nPtr+1, tokEnd) : vid;
+            if (!sink.Corner(int3(vid-1, tid-1, nid-1)))
+                break;
+        }
+        sink.EndFace();
+    }
+    else if (IsKeyword(word, wordEnd, "usemtl")) {
+        const char *name = SkipBlanks(ptr, eol), *nameEnd = eol;
+        while (nameEnd > name && IsBlank(nameEnd[-1]))
+            nameEnd--;
+        if (name < nameEnd)
+            sink.Material(name, nameEnd);
+    }
+    else if (IsKeyword(word, wordEnd, "mtllib"))
+        for (;;) {                                      // one or more library file names
+            const char *name = SkipBlanks(ptr, eol), *nameEnd = ptr = SkipWord(name, eol);
+            if (name == nameEnd)
+                break;
+            sink.Library(name, nameEnd);
+        }
+    // other attributes unsupported
+    return true;
+}
+
+int MaterialId(vector<string> &names, const char *name, const char *nameEnd) {
+    // index of name in names, appended if new; files use few materials, so search linearly
+    size_t n = nameEnd-name;
+    for (size_t i = 0; i < names.size(); i++)
+        if (names[i].size() == n && !memcmp(names[i].data(), name, n))
+            return i;
+    names.push_back(string(name, n));
+    return names.size()-1;
+}
+
+} // end namespace
+
+bool ReadObjMapped(const char   *filename,
+                   vector<vec3> &points,
+                   vector<int3> &triangles,
+                   vector<vec3> *normals,
+                   vector<vec2> *textures,
+                   vector<int>  *triangleGroups,
+                   vector<int4> *quads,
+                   ObjMaterials *materials) {
+    // parse semantics follow ReadAsciiObj: integer groups only, '/' fields optional,
+    // polygons fanned into triangles (or kept as quads if requested)
+    struct Sink {
+        vector<vec3> &points, *normals, tmpVertices, tmpNormals;
+        vector<vec2> *textures, tmpTextures;
+        vector<int3> &triangles;
+        vector<int> *triangleGroups, vids;
+        vector<int4> *quads;
+        ObjMaterials *materials;
+        VidHash vidHash;
+        int group = 0, material = -1, lineNum = 0;
+        const char *line = NULL, *eol = NULL;
+        void Group(int g) { group = g; }
+        void Material(const char *name, const char *end) {
+            if (materials)
+                material = MaterialId(materials->names, name, end);
+        }
+        void Library(const char *name, const char *end) {
+            if (materials)
+                MaterialId(materials->libraries, name, end);
+        }
+        void AddTriangle(int id1, int id2, int id3) {
+            triangles.push_back(int3(id1, id2, id3));
+            if (triangleGroups)
+                triangleGroups->push_back(group);
+            if (materials)
+                materials->triangleMaterials.push_back(material);
+        }
+        void Vertex(vec3 &v) { tmpVertices.push_back(v); }
+        void Normal(vec3 &n) { tmpNormals.push_back(n); }
+        void Uv(vec2 &t) { tmpTextures.push_back(t); }
+        void BeginFace() { vids.resize(0); }
+        bool Corner(int3 c) {
+            int vid = c.i1, tid = c.i2, nid = c.i3;
+            if (vid < 0 || tid < 0 || nid < 0 || vid >= (int) tmpVertices.size()) {
+                printf("bad format on line %d\n", lineNum);
+                return false;
+            }
+            int nvrts = points.size(), id = vidHash.Insert(vid, tid, nid, nvrts);
+            if (id == nvrts) {
+                points.push_back(tmpVertices[vid]);
+                if (normals && (int) tmpNormals.size() > nid)
+                    normals->push_back(tmpNormals[nid]);
+                if (textures && (int) tmpTextures.size() > tid)
+                    textures->push_back(tmpTextures[tid]);
+            }
+            vids.push_back(id);
+            return true;
+        }
+        void EndFace() {
+            int nids = vids.size();
+            if (nids < 3)
+                printf("nids = %i!, line %i = %.*s\n", nids, lineNum, (int) (eol-line), line);
+            if (nids == 3) {
+                int id1 = vids[0], id2 = vids[1], id3 = vids[2];
+                if (normals && (int) normals->size() > id1) {
+                    vec3 &p1 = points[id1], &p2 = points[id2], &p3 = points[id3];
+                    vec3 a(p2-p1), b(p3-p2), n(cross(a, b));
+                    if (dot(n, (*normals)[id1]) < 0) {
+                        int tmp = id1;
+                        id1 = id3;
+                        id3 = tmp;
+                    }
+                }
+                AddTriangle(id1, id2, id3);
+            }
+            else if (nids == 4 && quads)
+                quads->push_back(int4(vids[0], vids[1], vids[2], vids[3]));
+            else
+                for (int i = 1; i < nids-1; i++)
+                    AddTriangle(vids[0], vids[i], vids[(i+1)%nids]);
+        }
+        Sink(vector<vec3> &p, vector<vec3> *n, vector<vec2> *t, vector<int3> &tris, vector<int> *g, vector<int4> *q, ObjMaterials *m) :
+            points(p), normals(n), textures(t), triangles(tris), triangleGroups(g), quads(q), materials(m) { }
+    } sink(points, normals, textures, triangles, triangleGroups, quads, materials);
+    MappedFile file;
+    if (!file.Open(filename))
+        return false;
+    const char *p = file.data, *end = p+file.size;
+    for (; p < end; sink.lineNum++) {
+        const char *eol = (const char *) memchr(p, '\n', end-p);
+        sink.line = p;
+        sink.eol = eol = eol? eol : end;
+        if (!ParseObjLine(p, eol, sink)) {
+            printf("bad line %d in object file", sink.lineNum);
+            return false;
+        }
+        p = eol < end? eol+1 : end;
+    }
+    return true;
+} // end ReadObjMapped
+
+// Parallel ASCII OBJ
+
+namespace {
+
+struct ObjFace {
+    int corner, nCorners;       // range in ObjChunk::corners
+    int nV, nVt, nVn;           // chunk-local counts of v, vt, vn preceding the face
+    int line;                   // chunk-local line number
+    int group;                  // valid if groupSet, else inherited from preceding chunk
+    bool groupSet;
+    int material;               // chunk-local material id, or -1 if inherited from preceding chunk
+};
+
+struct ObjChunk {
+    const char *begin = NULL, *end = NULL;
+    // pass 1: parse
+    vector<vec3> vertices, normals;
+    vector<vec2> textures;
+    vector<int3> corners;       // zero-based vid, tid, nid
+    vector<ObjFace> faces;
+    int nLines = 0, badLine = -1, lastGroup = 0, lastMaterial = -1;
+    bool groupSet = false;
+    vector<string> materialNames, libraries;
+    // prefix sums over preceding chunks
+    int firstV = 0, firstVt = 0, firstVn = 0, firstLine = 0, startGroup = 0, startMaterial = -1;
+    vector<int> materialToGlobal;
+    // pass 2: local dedupe and triangulation
+    vector<int3> keys;          // unique corners, in order of first appearance
+    vector<char> keyFlags;      // 1: normal available, 2: uv available
+    vector<int3> triangles;     // local key ids
+    vector<int> triangleGroups, triangleMaterials;
+    vector<int4> quads;
+    vector<int2> messages;      // (local line, nids) for faces with < 3 vertices, or (local line, -1) for bad format
+    // pass 3: merge
+    vector<int> toGlobal;       // local key id to mesh vertex id
+    vector<int> newKeys;        // local key ids first seen (globally) in this chunk
+    int firstNewId = 0, firstTriangle = 0, firstQuad = 0;
+};
+
+void ParseObjChunk(ObjChunk &c) {
+    // parse v, vt, vn, g, f records; defer all cross-chunk decisions to later passes
+    struct Sink {
+        ObjChunk &c;
+        ObjFace f;
+        void Group(int g) { c.lastGroup = g; c.groupSet = true; }
+        void Material(const char *name, const char *end) { c.lastMaterial = MaterialId(c.materialNames, name, end); }
+        void Library(const char *name, const char *end) { MaterialId(c.libraries, name, end); }
+        void Vertex(vec3 &v) { c.vertices.push_back(v); }
+        void Normal(vec3 &n) { c.normals.push_back(n); }
+        void Uv(vec2 &t) { c.textures.push_back(t); }
+        void BeginFace() {
+            f.corner = c.corners.size();
+            f.nV = c.vertices.size();
+            f.nVt = c.textures.size();
+            f.nVn = c.normals.size();
+            f.line = c.nLines;
+            f.group = c.lastGroup;
+            f.groupSet = c.groupSet;
+            f.material = c.lastMaterial;
+        }
+        bool Corner(int3 k) { c.corners.push_back(k); return true; }
+        void EndFace() {
+            f.nCorners = c.corners.size()-f.corner;
+            c.faces.push_back(f);
+        }
+        Sink(ObjChunk &c) : c(c) { }
+    } sink(c);
+    for (const char *p = c.begin; p < c.end; c.nLines++) {
+        const char *eol = (const char *) memchr(p, '\n', c.end-p);
+        eol = eol? eol : c.end;
+        if (!ParseObjLine(p, eol, sink)) {
+            c.badLine = c.nLines++;
+            return;
+        }
+        p = eol < c.end? eol+1 : c.end;
+    }
+}
+
+void DedupeObjChunk(ObjChunk &c, vector<vec3> &allVertices, vector<vec3> &allNormals, bool wantNormals, bool wantQuads,
+                    bool wantMaterials) {
+    // assign chunk-local ids to unique corners and triangulate faces as does ReadObjMapped;
+    // the winding test presumes every vertex has a normal (ReadObjParallel verifies this)
+    VidHash vidHash(c.corners.size()/2);
+    vector<int> vids;
+    for (size_t i = 0; i < c.faces.size(); i++) {
+        ObjFace &f = c.faces[i];
+        int group = f.groupSet? f.group : c.startGroup;
+        vids.resize(0);
+        for (int k = 0; k < f.nCorners; k++) {
+            int3 &k3 = c.corners[f.corner+k];
+            if (k3.i1 < 0 || k3.i2 < 0 || k3.i3 < 0 || k3.i1 >= c.firstV+f.nV) {
+                c.messages.push_back(int2(f.line, -1));
+                break;
+            }
+            int nKeys = c.keys.size(), id = vidHash.Insert(k3.i1, k3.i2, k3.i3, nKeys);
+            if (id == nKeys) {
+                c.keys.push_back(k3);
+                c.keyFlags.push_back((k3.i3 < c.firstVn+f.nVn? 1 : 0) | (k3.i2 < c.firstVt+f.nVt? 2 : 0));
+            }
+            vids.push_back(id);
+        }
+        int nids = vids.size();
+        if (nids < 3)
+            c.messages.push_back(int2(f.line, nids));
+        if (nids == 3) {
+            int id1 = vids[0], id2 = vids[1], id3 = vids[2];
+            if (wantNormals && c.keyFlags[id1]&1) {
+                vec3 &p1 = allVertices[c.keys[id1].i1], &p2 = allVertices[c.keys[id2].i1], &p3 = allVertices[c.keys[id3].i1];
+                vec3 a(p2-p1), b(p3-p2), n(cross(a, b));
+                if (dot(n, allNormals[c.keys[id1].i3]) < 0) {
+                    int tmp = id1;
+                    id1 = id3;
+                    id3 = tmp;
+                }
+            }
+            c.triangles.push_back(int3(id1, id2, id3));
+            c.triangleGroups.push_back(group);
+            if (wantMaterials)
+                c.triangleMaterials.push_back(f.material);
+        }
+        else if (nids == 4 && wantQuads)
+            c.quads.push_back(int4(vids[0], vids[1], vids[2], vids[3]));
+        else
+            for (int k = 1; k < nids-1; k++) {
+                c.triangles.push_back(int3(vids[0], vids[k], vids[(k+1)%nids]));
+                c.triangleGroups.push_back(group);
+                if (wantMaterials)
+                    c.triangleMaterials.push_back(f.material);
+            }
+    }
+    // release pass 1 storage no longer needed
+    vector<int3>().swap(c.corners);
+    vector<ObjFace>().swap(c.faces);
+}
+
+template<class T>
+void Concatenate(vector<ObjChunk> &chunks, vector<T> ObjChunk::*member, vector<int> &offsets, vector<T> &result, int nThreads) {
+    // copy chunks[i].*member to result at offsets[i], in parallel
+    ParallelFor((int) chunks.size(), [&](int i) {
+        vector<T> &v = chunks[i].*member;
+        std::copy(v.begin(), v.end(), result.begin()+offsets[i]);
+        vector<T>().swap(v);
+    }, nThreads);
+}
+
+} // end namespace
+
+bool ReadObjParallel(const char   *filename,
+                     vector<vec3> &points,
+                     vector<int3> &triangles,
+                     vector<vec3> *normals,
+                     vector<vec2> *textures,
+                     vector<int>  *triangleGroups,
+                     vector<int4> *quads,
+                     ObjMaterials *materials,
+                     int          nThreads) {
+    // pass 1 (parallel): parse newline-aligned chunks
+    // pass 2 (parallel): given prefix sums, dedupe and triangulate each chunk with local ids
+    // pass 3 (parallel): merge unique corners by vid range, numbering vertices as would a serial read
+    // pass 4 (parallel): remap triangles, gather points, normals, uvs into place
+    static const size_t minChunk = 1 << 20;
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    MappedFile file;
+    if (!file.Open(filename))
+        return false;
+    size_t nChunks = file.size/minChunk < (size_t) 8*nThreads? file.size/minChunk : 8*nThreads;
+    if (nThreads == 1 || nChunks < 2) {
+        file.Close();
+        return ReadObjMapped(filename, points, triangles, normals, textures, triangleGroups, quads, materials);
+    }
+    vector<ObjChunk> chunks(nChunks);
+    const char *start = file.data, *end = file.data+file.size;
+    for (size_t i = 0; i < nChunks; i++) {
+        const char *e = i == nChunks-1? end : file.data+(i+1)*(file.size/nChunks);
+        const char *nl = e < end? (const char *) memchr(e, '\n', end-e) : NULL;
+        e = nl? nl+1 : end;
+        chunks[i].begin = start;
+        chunks[i].end = start = e > start? e : start;
+    }
+    ParallelFor(nChunks, [&](int i) { ParseObjChunk(chunks[i]); }, nThreads);
+    // prefix sums; vertex counts known, so concatenate vertices and normals
+    vector<int> vOffsets(nChunks), vtOffsets(nChunks), vnOffsets(nChunks);
+    int nV = 0, nVt = 0, nVn = 0, nLines = 0, group = 0, material = -1;
+    for (size_t i = 0; i < nChunks; i++) {
+        ObjChunk &c = chunks[i];
+        if (c.badLine >= 0) {
+            printf("bad line %d in object file", nLines+c.badLine);
+            return false;
+        }
+        vOffsets[i] = c.firstV = nV;
+        vtOffsets[i] = c.firstVt = nVt;
+        vnOffsets[i] = c.firstVn = nVn;
+        c.firstLine = nLines;
+        c.startGroup = group;
+        nV += c.vertices.size();
+        nVt += c.textures.size();
+        nVn += c.normals.size();
+        nLines += c.nLines;
+        if (c.groupSet)
+            group = c.lastGroup;
+        if (materials) {
+            // number materials in order of first use, as would a serial read
+            c.startMaterial = material;
+            for (size_t k = 0; k < c.libraries.size(); k++)
+                MaterialId(materials->libraries, c.libraries[k].data(), c.libraries[k].data()+c.libraries[k].size());
+            for (size_t k = 0; k < c.materialNames.size(); k++) {
+                string &name = c.materialNames[k];
+                c.materialToGlobal.push_back(MaterialId(materials->names, name.data(), name.data()+name.size()));
+            }
+            if (c.lastMaterial >= 0)
+                material = c.materialToGlobal[c.lastMaterial];
+        }
+    }
+    vector<vec3> allVertices(nV), allNormals(nVn);
+    vector<vec2> allTextures(nVt);
+    Concatenate(chunks, &ObjChunk::vertices, vOffsets, allVertices, nThreads);
+    Concatenate(chunks, &ObjChunk::normals, vnOffsets, allNormals, nThreads);
+    Concatenate(chunks, &ObjChunk::textures, vtOffsets, allTextures, nThreads);
+    ParallelFor(nChunks, [&](int i) { DedupeObjChunk(chunks[i], allVertices, allNormals, normals != NULL, quads != NULL, materials != NULL); }, nThreads);
+    // merge unique corners: each vid range (part) inserts its corners in file order into its own table,
+    // marking each corner with its first occurrence (keys numbered across chunks); first occurrences are
+    // then numbered by chunk, so vertex ids are as a serial read's
+    int nParts = nChunks, partSize = (nV+nParts-1)/nParts > 0? (nV+nParts-1)/nParts : 1;
+    vector<int> keyOffsets(nChunks+1, 0);
+    for (size_t i = 0; i < nChunks; i++)
+        keyOffsets[i+1] = keyOffsets[i]+chunks[i].keys.size();
+    vector<vector<int>> partStarts(nChunks), partKeys(nChunks);
+    ParallelFor(nChunks, [&](int i) {
+        // counting sort of the chunk's keys by part
+        ObjChunk &c = chunks[i];
+        vector<int> &starts = partStarts[i], &order = partKeys[i];
+        starts.assign(nParts+1, 0);
+        for (size_t k = 0; k < c.keys.size(); k++)
+            starts[c.keys[k].i1/partSize+1]++;
+        for (int p = 0; p < nParts; p++)
+            starts[p+1] += starts[p];
+        vector<int> next(starts.begin(), starts.end()-1);
+        order.resize(c.keys.size());
+        for (size_t k = 0; k < c.keys.size(); k++)
+            order[next[c.keys[k].i1/partSize]++] = k;
+    }, nThreads);
+    vector<int> firstOf(keyOffsets[nChunks]), ids(keyOffsets[nChunks]);
+    ParallelFor(nParts, [&](int p) {
+        size_t expected = 0;
+        for (size_t i = 0; i < nChunks; i++)
+            expected += partStarts[i][p+1]-partStarts[i][p];
+        VidHash vidHash(expected);
+        for (size_t i = 0; i < nChunks; i++)
+            for (int j = partStarts[i][p]; j < partStarts[i][p+1]; j++) {
+                int k = partKeys[i][j], g = keyOffsets[i]+k;
+                int3 &key = chunks[i].keys[k];
+                firstOf[g] = vidHash.Insert(key.i1, key.i2, key.i3, g);
+            }
+    }, nThreads);
+    vector<vector<int>>().swap(partStarts);
+    vector<vector<int>>().swap(partKeys);
+    vector<int> chunkNew(nChunks, 0), chunkNormals(nChunks, 0), chunkUvs(nChunks, 0);
+    ParallelFor(nChunks, [&](int i) {
+        ObjChunk &c = chunks[i];
+        for (size_t k = 0; k < c.keys.size(); k++)
+            if (firstOf[keyOffsets[i]+k] == keyOffsets[i]+(int) k) {
+                chunkNew[i]++;
+                chunkNormals[i] += c.keyFlags[k]&1;
+                chunkUvs[i] += (c.keyFlags[k]&2) >> 1;
+            }
+    }, nThreads);
+    int nPoints = points.size(), nOldTriangles = triangles.size(), nTriangles = nOldTriangles;
+    int nQuads = quads? quads->size() : 0;
+    int nWithNormal = 0, nWithUv = 0, nNew = 0;
+    for (size_t i = 0; i < nChunks; i++) {
+        ObjChunk &c = chunks[i];
+        for (size_t m = 0; m < c.messages.size(); m++) {
+            int2 &msg = c.messages[m];
+            if (msg.i2 < 0)
+                printf("bad format on line %d\n", c.firstLine+msg.i1);
+            else
+                printf("nids = %i!, line %i\n", msg.i2, c.firstLine+msg.i1);
+        }
+        c.firstNewId = nPoints+nNew;
+        nNew += chunkNew[i];
+        nWithNormal += chunkNormals[i];
+        nWithUv += chunkUvs[i];
+        c.firstTriangle = nTriangles;
+        c.firstQuad = nQuads;
+        nTriangles += c.triangles.size();
+        nQuads += c.quads.size();
+    }
+    ParallelFor(nChunks, [&](int i) {
+        ObjChunk &c = chunks[i];
+        for (size_t k = 0; k < c.keys.size(); k++) {
+            int g = keyOffsets[i]+k;
+            if (firstOf[g] == g) {
+                ids[g] = c.firstNewId+c.newKeys.size();
+                c.newKeys.push_back(k);
+            }
+        }
+    }, nThreads);
+    ParallelFor(nChunks, [&](int i) {
+        ObjChunk &c = chunks[i];
+        c.toGlobal.resize(c.keys.size());
+        for (size_t k = 0; k < c.keys.size(); k++)
+            c.toGlobal[k] = ids[firstOf[keyOffsets[i]+k]];
+    }, nThreads);
+    if ((normals && nWithNormal && nWithNormal != nNew) || (textures && nWithUv && nWithUv != nNew)) {
+        // normals or uvs cover only some vertices: arrays are misaligned with points, and winding
+        // depends on read order; rare enough to defer to the serial reader
+        chunks.clear();
+        file.Close();
+        return ReadObjMapped(filename, points, triangles, normals, textures, triangleGroups, quads, materials);
+    }
+    bool gatherNormals = normals && nWithNormal, gatherUvs = textures && nWithUv;
+    points.resize(nPoints+nNew);
+    triangles.resize(nTriangles);
+    if (gatherNormals)
+        normals->resize(normals->size()+nNew);
+    if (gatherUvs)
+        textures->resize(textures->size()+nNew);
+    if (triangleGroups)
+        triangleGroups->resize(triangleGroups->size()+nTriangles-nOldTriangles);
+    if (materials)
+        materials->triangleMaterials.resize(materials->triangleMaterials.size()+nTriangles-nOldTriangles);
+    if (quads)
+        quads->resize(nQuads);
+    int normalBase = gatherNormals? (int) normals->size()-nNew-nPoints : 0;
+    int uvBase = gatherUvs? (int) textures->size()-nNew-nPoints : 0;
+    int groupBase = triangleGroups? (int) triangleGroups->size()-nTriangles : 0;
+    int materialBase = materials? (int) materials->triangleMaterials.size()-nTriangles : 0;
+    ParallelFor(nChunks, [&](int i) {
+        ObjChunk &c = chunks[i];
+        for (size_t k = 0; k < c.newKeys.size(); k++) {
+            int3 &key = c.keys[c.newKeys[k]];
+            int id = c.firstNewId+k;
+            points[id] = allVertices[key.i1];
+            if (gatherNormals)
+                (*normals)[normalBase+id] = allNormals[key.i3];
+            if (gatherUvs)
+                (*textures)[uvBase+id] = allTextures[key.i2];
+        }
+        for (size_t t = 0; t < c.triangles.size(); t++) {
+            int3 &tri = c.triangles[t];
+            triangles[c.firstTriangle+t] = int3(c.toGlobal[tri.i1], c.toGlobal[tri.i2], c.toGlobal[tri.i3]);
+            if (triangleGroups)
+                (*triangleGroups)[groupBase+c.firstTriangle+t] = c.triangleGroups[t];
+            if (materials) {
+                int m = c.triangleMaterials[t];
+                materials->triangleMaterials[materialBase+c.firstTriangle+t] = m < 0? c.startMaterial : c.materialToGlobal[m];
+            }
+        }
+        for (size_t q = 0; q < c.quads.size(); q++) {
+            int4 &quad = c.quads[q];
+            (*quads)[c.firstQuad+q] = int4(c.toGlobal[quad.i1], c.toGlobal[quad.i2], c.toGlobal[quad.i3], c.toGlobal[quad.i4]);
+        }
+    }, nThreads);
+    return true;
+} // end ReadObjParallel
+
+// OBJ Material Library
+
+bool ReadMtl(const char *filename, vector<ObjMaterial> &materials) {
+    MappedFile file;
+    if (!file.Open(filename)) {
+        printf("can't open %s\n", filename);
+        return false;
+    }
+    const char *p = file.data, *end = p+file.size;
+    ObjMaterial *m = NULL;
+    for (int lineNum = 0; p < end; lineNum++) {
+        const char *eol = (const char *) memchr(p, '\n', end-p);
+        eol = eol? eol : end;
+        const char *word = SkipBlanks(p, eol), *wordEnd = SkipWord(word, eol), *ptr = wordEnd;
+        const char *rest = SkipBlanks(ptr, eol), *restEnd = eol;
+        while (restEnd > rest && IsBlank(restEnd[-1]))
+            restEnd--;
+        p = eol < end? eol+1 : end;
+        if (IsKeyword(word, wordEnd, "newmtl")) {
+            materials.resize(materials.size()+1);
+            m = &materials.back();
+            m->name = string(rest, restEnd);
+            continue;
+        }
+        if (!m)
+            continue;
+        vec3 *color = IsKeyword(word, wordEnd, "ka")? &m->ambient :
+                      IsKeyword(word, wordEnd, "kd")? &m->diffuse :
+                      IsKeyword(word, wordEnd, "ks")? &m->specular : NULL;
+        float f;
+        if (color) {
+            vec3 c;
+            if (!ParseFloat(ptr, eol, c.x))
+                continue;                               // eg, "Kd spectral file.rfl"
+            if (!ParseFloat(ptr, eol, c.y) || !ParseFloat(ptr, eol, c.z))
+                c.y = c.z = c.x;                        // single value is gray
+            *color = c;
+        }
+        else if (IsKeyword(word, wordEnd, "ns") && ParseFloat(ptr, eol, f))
+            m->shininess = f;
+        else if (IsKeyword(word, wordEnd, "d") && ParseFloat(ptr, eol, f))
+            m->opacity = f;
+        else if (IsKeyword(word, wordEnd, "tr") && ParseFloat(ptr, eol, f))
+            m->opacity = 1-f;
+        else if (IsKeyword(word, wordEnd, "map_kd") && rest < restEnd) {
+            // options (-s, -o, -bm, ...) precede the file name, which is taken as the last word
+            const char *name = restEnd;
+            while (name > rest && !IsBlank(name[-1]))
+                name--;
+            m->diffuseMap = string(name, restEnd);
+        }
+    }
+    return true;
+}
+
+// Streaming ASCII OBJ
+
+size_t ObjBatch::Bytes() {
+    return vertices.size()*sizeof(vec3)+normals.size()*sizeof(vec3)+uvs.size()*sizeof(vec2)+
+           corners.size()*sizeof(int3)+faceSizes.size()*sizeof(int)+faceGroups.size()*sizeof(int);
+}
+
+void ObjBatch::Clear() {
+    firstVertex += vertices.size();
+    firstNormal += normals.size();
+    firstUv += uvs.size();
+    vertices.resize(0);
+    normals.resize(0);
+    uvs.resize(0);
+    corners.resize(0);
+    faceSizes.resize(0);
+    faceGroups.resize(0);
+}
+
+namespace {
+
+class LineReader {
+    // lines from a file read a buffer at a time; the buffer grows only for a line longer than itself
+    FILE *in;
+    vector<char> buf;
+    size_t pos = 0, len = 0;
+    bool eof = false;
+public:
+    LineReader(FILE *in, size_t bufSize = 1 << 20) : in(in), buf(bufSize) { }
+    bool Next(const char *&line, const char *&eol) {
+        for (;;) {
+            const char *nl = len > pos? (const char *) memchr(&buf[pos], '\n', len-pos) : NULL;
+            if (nl || (eof && pos < len)) {
+                line = &buf[pos];
+                eol = nl? nl : &buf[0]+len;
+                pos = eol-&buf[0]+(nl? 1 : 0);
+                return true;
+            }
+            if (eof)
+                return false;
+            // keep partial line, refill
+            memmove(&buf[0], &buf[pos], len-pos);
+            len -= pos;
+            pos = 0;
+            if (len == buf.size())
+                buf.resize(2*buf.size());
+            size_t n = fread(&buf[len], 1, buf.size()-len, in);
+            eof = n == 0;
+            len += n;
+        }
+    }
+};
+
+} // end namespace
+
+bool StreamObj(const char *filename, ObjBatchFn visit, size_t batchBytes) {
+    struct Sink {
+        ObjBatch batch;
+        int group = 0;
+        size_t corner = 0;
+        void Group(int g) { group = g; }
+        void Material(const char *, const char *) { }
+        void Library(const char *, const char *) { }
+        void Vertex(vec3 &v) { batch.vertices.push_back(v); }
+        void Normal(vec3 &n) { batch.normals.push_back(n); }
+        void Uv(vec2 &t) { batch.uvs.push_back(t); }
+        void BeginFace() { corner = batch.corners.size(); }
+        bool Corner(int3 c) { batch.corners.push_back(c); return true; }
+        void EndFace() {
+            batch.faceSizes.push_back(batch.corners.size()-corner);
+            batch.faceGroups.push_back(group);
+        }
+    } sink;
+    FILE *in = fopen(filename, "rb");
+    if (!in)
+        return false;
+    LineReader reader(in);
+    const char *line, *eol;
+    bool ok = true, stopped = false;
+    for (int lineNum = 0; !stopped && reader.Next(line, eol); lineNum++) {
+        if (!ParseObjLine(line, eol, sink)) {
+            printf("bad line %d in object file", lineNum);
+            ok = false;
+            break;
+        }
+        if (sink.batch.Bytes() >= batchBytes) {
+            stopped = !visit(sink.batch);
+            sink.batch.Clear();
+        }
+    }
+    fclose(in);
+    if (ok && !stopped && (sink.batch.vertices.size() || sink.batch.normals.size() || sink.batch.uvs.size() || sink.batch.faceSizes.size()))
+        visit(sink.batch);
+    return ok;
+}
+
+// Split OBJ into Spatial Chunks
+
+namespace {
+
+int Cell(float v, vector<float> &splits) {
+    // index of slab containing v given ascending interior split values
+    return (int) (std::upper_bound(splits.begin(), splits.end(), v)-splits.begin());
+}
+
+void QuantileSplits(vector<int> &histogram, float min, float max, int nSlabs, vector<float> &splits) {
+    // choose nSlabs-1 split values so slabs hold about equal counts
+    long long total = 0, sum = 0;
+    for (size_t i = 0; i < histogram.size(); i++)
+        total += histogram[i];
+    splits.resize(0);
+    int nBins = histogram.size();
+    for (int b = 0, s = 1; b < nBins && s < nSlabs; b++) {
+        sum += histogram[b];
+        while (s < nSlabs && sum >= total*s/nSlabs) {
+            splits.push_back(min+(max-min)*(b+1)/nBins);
+            s++;
+        }
+    }
+    while ((int) splits.size() < nSlabs-1)
+        splits.push_back(max);
+}
+
+bool WriteTemp(FILE *out, const void *data, size_t nBytes) {
+    return !nBytes || fwrite(data, 1, nBytes, out) == nBytes;
+}
+
+void WriteFloats(FILE *out, const char *key, const float *f, int n) {
+    // OBJ record: key followed by n shortest round-trip floats
+    char line[16+3*17];
+    int len = sprintf(line, "%s", key);
+    for (int i = 0; i < n; i++) {
+        line[len++] = ' ';
+        len += FormatFloat(line+len, f[i]);
+    }
+    line[len++] = '\n';
+    fwrite(line, 1, len, out);
+}
+
+} // end namespace
+
+bool SplitObj(const char *filename, const char *outputPrefix, size_t memoryBudget, vector<string> *outputNames) {
+    // pass 1 streams the file, spooling v, vn, vt to flat binary files (mapped later) and histogramming points;
+    // pass 2 streams faces, spooling each to the file of the grid cell containing its centroid (once per
+    // maxCells cells, to bound open files);
+    // pass 3 loads one cell at a time, re-indexes its corners, and writes it as OBJ
+    // grid slabs are placed at per-axis quantiles so cells hold similar numbers of faces
+    static const int nBins = 1024, maxCells = 256;
+    string tmpV = string(outputPrefix)+".v.tmp", tmpN = string(outputPrefix)+".vn.tmp", tmpT = string(outputPrefix)+".vt.tmp";
+    FILE *outV = fopen(tmpV.c_str(), "wb"), *outN = fopen(tmpN.c_str(), "wb"), *outT = fopen(tmpT.c_str(), "wb");
+    vec3 min(FLT_MAX), max(-FLT_MAX);
+    long long nV = 0, nCorners = 0;
+    bool ok = outV && outN && outT;
+    size_t batchBytes = memoryBudget/8;
+    ok = ok && StreamObj(filename, [&](ObjBatch &b) {
+        for (size_t i = 0; i < b.vertices.size(); i++)
+            for (int k = 0; k < 3; k++) {
+                if (b.vertices[i][k] < min[k]) min[k] = b.vertices[i][k];
+                if (b.vertices[i][k] > max[k]) max[k] = b.vertices[i][k];
+            }
+        nV += b.vertices.size();
+        nCorners += b.corners.size();
+        return WriteTemp(outV, b.vertices.data(), b.vertices.size()*sizeof(vec3)) &&
+               WriteTemp(outN, b.normals.data(), b.normals.size()*sizeof(vec3)) &&
+               WriteTemp(outT, b.uvs.data(), b.uvs.size()*sizeof(vec2));
+    }, batchBytes);
+    if (outV) fclose(outV);
+    if (outN) fclose(outN);
+    if (outT) fclose(outT);
+    MappedFile points(tmpV.c_str()), normals(tmpN.c_str()), uvs(tmpT.c_str());
+    const vec3 *pts = (const vec3 *) points.data, *nrms = (const vec3 *) normals.data;
+    const vec2 *tex = (const vec2 *) uvs.data;
+    int nN = normals.size/sizeof(vec3), nT = uvs.size/sizeof(vec2);
+    ok = ok && nV > 0 && pts;
+    // size grid so a cell's corners, hash, and re-indexed vertices fit in budget
+    long long bytesPerCorner = sizeof(int3)+2*16+sizeof(int), bytesPerVertex = 2*sizeof(vec3)+sizeof(vec2);
+    long long working = nCorners*bytesPerCorner+nV*bytesPerVertex;
+    int nCells = (int) (working/(long long) (memoryBudget/2)+1), dims[] = {1, 1, 1};
+    while (dims[0]*dims[1]*dims[2] < nCells) {
+        int k = 0;                                      // split axis with largest extent per slab
+        for (int a = 1; a < 3; a++)
+            if ((max[a]-min[a])/dims[a] > (max[k]-min[k])/dims[k])
+                k = a;
+        dims[k] *= 2;
+    }
+    nCells = dims[0]*dims[1]*dims[2];
+    vector<float> splits[3];
+    if (ok) {
+        vector<int> histogram[3];
+        for (int k = 0; k < 3; k++)
+            histogram[k].assign(nBins, 0);
+        for (long long i = 0; i < nV; i++)
+            for (int k = 0; k < 3; k++) {
+                float range = max[k]-min[k];
+                int b = range > 0? (int) ((pts[i][k]-min[k])/range*nBins) : 0;
+                histogram[k][b < 0? 0 : b >= nBins? nBins-1 : b]++;
+            }
+        for (int k = 0; k < 3; k++)
+            QuantileSplits(histogram[k], min[k], max[k], dims[k], splits[k]);
+    }
+    // pass 2: spool faces to cell files as (# corners, group, corners)
+    vector<string> cellNames(nCells);
+    vector<long long> cellFaces(nCells, 0);
+    for (int first = 0; ok && first < nCells; first += maxCells) {
+        int nOpen = std::min(maxCells, nCells-first);
+        vector<FILE *> cellFiles(nOpen, (FILE *) NULL);
+        for (int c = 0; ok && c < nOpen; c++) {
+            char suffix[32];
+            sprintf(suffix, ".cell%d.tmp", first+c);
+            cellNames[first+c] = string(outputPrefix)+suffix;
+            ok = (cellFiles[c] = fopen(cellNames[first+c].c_str(), "wb")) != NULL;
+            if (ok)
+                setvbuf(cellFiles[c], NULL, _IOFBF, 1 << 16);
+        }
+        ok = ok && StreamObj(filename, [&](ObjBatch &b) {
+            for (size_t f = 0, corner = 0; f < b.faceSizes.size(); corner += b.faceSizes[f++]) {
+                int n = b.faceSizes[f], header[] = {n, b.faceGroups[f]};
+                vec3 centroid;
+                int nValid = 0;
+                for (int k = 0; k < n; k++) {
+                    int3 &k3 = b.corners[corner+k];
+                    if (k3.i1 >= 0 && k3.i1 < nV && (!nT || (k3.i2 >= 0 && k3.i2 < nT)) && (!nN || (k3.i3 >= 0 && k3.i3 < nN))) {
+                        centroid += pts[k3.i1];
+                        nValid++;
+                    }
+                }
+                if (nValid != n || n < 3)
+                    continue;                           // skip faces with bad vid, tid, or nid, as ReadAsciiObj would
+                centroid /= (float) n;
+                int c = Cell(centroid.x, splits[0])+dims[0]*(Cell(centroid.y, splits[1])+dims[1]*Cell(centroid.z, splits[2]));
+                if (c < first || c >= first+nOpen)
+                    continue;
+                if (!WriteTemp(cellFiles[c-first], header, sizeof(header)) ||
+                    !WriteTemp(cellFiles[c-first], &b.corners[corner], n*sizeof(int3)))
+                    return false;
+                cellFaces[c]++;
+            }
+            return true;
+        }, batchBytes);
+        for (int c = 0; c < nOpen; c++)
+            if (cellFiles[c])
+                fclose(cellFiles[c]);
+    }
+    // pass 3: write each cell
+    for (int c = 0, nOut = 0; ok && c < nCells; c++) {
+        if (!cellFaces[c])
+            continue;
+        MappedFile cell(cellNames[c].c_str());
+        char suffix[32];
+        sprintf(suffix, "_%d.obj", nOut++);
+        string name = string(outputPrefix)+suffix;
+        FILE *out = fopen(name.c_str(), "w");
+        if (!cell.data || !out) {
+            if (out) fclose(out);
+            ok = false;
+            break;
+        }
+        if (outputNames)
+            outputNames->push_back(name);
+        // re-index unique (vid, tid, nid) triplets in order of appearance
+        VidHash vidHash;
+        vector<int3> keys;
+        const int *p = (const int *) cell.data, *end = p+cell.size/sizeof(int);
+        for (const int *q = p; q < end; q += 2+3*q[0])
+            for (int k = 0; k < q[0]; k++) {
+                const int *t = q+2+3*k;
+                if (vidHash.Insert(t[0], t[1], t[2], keys.size()) == (int) keys.size())
+                    keys.push_back(int3(t[0], t[1], t[2]));
+            }
+        bool hasN = nN > 0, hasT = nT > 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            vec3 v = pts[keys[i].i1];
+            WriteFloats(out, "v", &v.x, 3);
+        }
+        for (size_t i = 0; hasT && i < keys.size(); i++) {
+            vec2 t = tex[keys[i].i2];
+            WriteFloats(out, "vt", &t.x, 2);
+        }
+        for (size_t i = 0; hasN && i < keys.size(); i++) {
+            vec3 n = nrms[keys[i].i3];
+            WriteFloats(out, "vn", &n.x, 3);
+        }
+        int group = 0;
+        for (const int *q = p; q < end; q += 2+3*q[0]) {
+            if (q[1] != group)
+                fprintf(out, "g %d\n", group = q[1]);
+            fprintf(out, "f");
+            for (int k = 0; k < q[0]; k++) {
+                const int *t = q+2+3*k;
+                int id = 1+vidHash.Find(t[0], t[1], t[2]);
+                if (hasT && hasN)
+                    fprintf(out, " %d/%d/%d", id, id, id);
+                else if (hasT)
+                    fprintf(out, " %d/%d", id, id);
+                else if (hasN)
+                    fprintf(out, " %d//%d", id, id);
+                else
+                    fprintf(out, " %d", id);
+            }
+            fprintf(out, "\n");
+        }
+        ok = fclose(out) == 0;
+    }
+    points.Close();
+    normals.Close();
+    uvs.Close();
+    remove(tmpV.c_str());
+    remove(tmpN.c_str());
+    remove(tmpT.c_str());
+    for (int c = 0; c < nCells; c++)
+        if (!cellNames[c].empty())
+            remove(cellNames[c].c_str());
+    return ok;
+}
+
+// STL
+
+namespace {
+
+class STLWelder {
+    // merge bitwise-coincident vertices (+0 and -0 equivalent) into an indexed mesh;
+    // vertex normals are the normalized sum of incident facet normals
+    VidHash vidHash;
+    vector<vec3> &points;
+    vector<int3> &triangles;
+    vector<vec3> *normals;
+    size_t firstPoint;
+    static int Bits(float f) {
+        int i;
+        memcpy(&i, &f, sizeof(int));
+        return i == (int) 0x80000000? 0 : i;
+    }
+    int Weld(const vec3 &p) {
+        int id = points.size(), g = vidHash.Insert(Bits(p.x), Bits(p.y), Bits(p.z), id);
+        if (g == id) {
+            points.push_back(p);
+            if (normals)
+                normals->push_back(vec3(0, 0, 0));
+        }
+        return g;
+    }
+public:
+    STLWelder(vector<vec3> &points, vector<int3> &triangles, vector<vec3> *normals, size_t nTriangles) :
+        vidHash(nTriangles/2+1), points(points), triangles(triangles), normals(normals), firstPoint(points.size()) {
+            // closed meshes have about half as many vertices as triangles
+            points.reserve(points.size()+nTriangles/2+1);
+            triangles.reserve(triangles.size()+nTriangles);
+            if (normals)
+                normals->reserve(normals->size()+nTriangles/2+1);
+    }
+    void AddFacet(vec3 *v, vec3 n) {
+        // orient facet to agree with its stored normal, as does ReadSTL
+        vec3 a(v[1]-v[0]), b(v[2]-v[1]), c(cross(a, b));
+        bool flip = dot(c, n) < 0;
+        int id1 = Weld(v[flip? 2 : 0]), id2 = Weld(v[1]), id3 = Weld(v[flip? 0 : 2]);
+        triangles.push_back(int3(id1, id2, id3));
+        if (normals) {
+            if (dot(n, n) == 0)                                 // unset in file: use right-hand rule
+                n = flip? -c : c;
+            float len = length(n);
+            if (len > 0) {
+                n /= len;
+                (*normals)[id1] += n;
+                (*normals)[id2] += n;
+                (*normals)[id3] += n;
+            }
+        }
+    }
+    void Finish() {
+        if (normals)
+            for (size_t i = firstPoint; i < normals->size(); i++) {
+                vec3 &n = (*normals)[i];
+                float len = length(n);
+                if (len > 0)
+                    n /= len;
+            }
+    }
+};
+
+bool IsBinarySTL(MappedFile &file, int &nTriangles) {
+    // binary if the triangle count in the header accounts for the file size
+    if (file.size < 84)
+        return false;
+    unsigned int n;
+    memcpy(&n, file.data+80, sizeof(n));
+    nTriangles = (int) n;
+    return n < 0x7fffffff && 84+50*(unsigned long long) n == file.size;
+}
+
+bool IsAsciiSTL(MappedFile &file) {
+    // many binary files also begin with "solid", so defer to the size check
+    int nTriangles;
+    const char *p = SkipBlanks(file.data, file.data+file.size), *e = SkipWord(p, file.data+file.size);
+    return IsKeyword(p, e, "solid") && !IsBinarySTL(file, nTriangles);
+}
+
+class TokenReader {
+    // whitespace-delimited tokens from a file read a buffer at a time
+    FILE *in;
+    char buf[1 << 16], token[256];
+    size_t pos = 0, len = 0;
+    bool Fill() {
+        pos = 0;
+        len = fread(buf, 1, sizeof(buf), in);
+        return len > 0;
+    }
+public:
+    int length = 0;
+    TokenReader(FILE *in) : in(in) { }
+    const char *Next() {
+        // return next token (truncated to 255 characters), or NULL at end of file
+        length = 0;
+        for (;; pos++) {
+            if (pos == len && !Fill())
+                return NULL;
+            if (!IsBlank(buf[pos]))
+                break;
+        }
+        for (;; pos++) {
+            if (pos == len && !Fill())
+                break;
+            if (IsBlank(buf[pos]))
+                break;
+            if (length < (int) sizeof(token)-1)
+                token[length++] = buf[pos];
+        }
+        token[length] = 0;
+        return token;
+    }
+    bool Is(const char *keyword) { return IsKeyword(token, token+length, keyword); }
+    bool Expect(const char *keyword) { return Next() && Is(keyword); }
+    bool Float(float &f) {
+        const char *p = Next();
+        return p && ParseFloat(p, token+length, f) && p == token+length;
+    }
+    bool Vec3(vec3 &v) { return Float(v.x) && Float(v.y) && Float(v.z); }
+};
+
+template<class FacetFn>
+int ParseAsciiSTL(FILE *in, FacetFn facet) {
+    // grammar:  solid name {facet normal n n n outer loop {vertex v v v} endloop endfacet} endsolid name
+    // polygonal loops are fanned into triangles; several solids may follow one another
+    TokenReader r(in);
+    int nFacets = 0;
+    vector<vec3> loop;
+    bool inSolid = false;
+    while (r.Next()) {
+        if (r.Is("solid"))
+            inSolid = true;
+        else if (r.Is("endsolid"))
+            inSolid = false;
+        else if (inSolid && r.Is("facet")) {
+            vec3 n, v;
+            if (!r.Expect("normal") || !r.Vec3(n) || !r.Expect("outer") || !r.Expect("loop")) {
+                printf("bad ASCII STL facet %d\n", nFacets);
+                return nFacets;
+            }
+            loop.resize(0);
+            while (r.Next() && r.Is("vertex")) {
+                if (!r.Vec3(v)) {
+                    printf("bad ASCII STL vertex in facet %d\n", nFacets);
+                    return nFacets;
+                }
+                loop.push_back(v);
+            }
+            if (!r.Is("endloop") || !r.Expect("endfacet")) {
+                printf("bad ASCII STL facet %d\n", nFacets);
+                return nFacets;
+            }
+            for (int i = 1; i < (int) loop.size()-1; i++, nFacets++) {
+                vec3 tri[] = {loop[0], loop[i], loop[i+1]};
+                facet(n, tri);
+            }
+        }
+        // else skip solid names
+    }
+    return nFacets;
+}
+
+} // end namespace
+
+bool IsAsciiSTL(const char *filename) {
+    MappedFile file(filename);
+    return file.data && IsAsciiSTL(file);
+}
+
+int ReadAsciiSTL(const char *filename, vector<vec3> &facets) {
+    FILE *in = fopen(filename, "rb");
+    if (!in)
+        return 0;
+    int n = ParseAsciiSTL(in, [&](vec3 &normal, vec3 *v) {
+        facets.push_back(normal);
+        for (int k = 0; k < 3; k++)
+            facets.push_back(v[k]);
+    });
+    fclose(in);
+    return n;
+}
+
+int ReadSTL(const char *filename, vector<vec3> &points, vector<int3> &triangles, vector<vec3> *normals) {
+    // binary layout: 80-byte header, 4-byte triangle count, then per triangle 50 bytes:
+    // normal (3 floats), three vertices (3 floats each), 2-byte attribute (ignored)
+    MappedFile file;
+    if (!file.Open(filename)) {
+        printf("can't open %s\n", filename);
+        return 0;
+    }
+    if (IsAsciiSTL(file)) {
+        file.Close();
+        FILE *in = fopen(filename, "rb");
+        if (!in)
+            return 0;
+        STLWelder welder(points, triangles, normals, 0);
+        int n = ParseAsciiSTL(in, [&](vec3 &normal, vec3 *v) { welder.AddFacet(v, normal); });
+        fclose(in);
+        welder.Finish();
+        return n;
+    }
+    int nTriangles = 0;
+    if (!IsBinarySTL(file, nTriangles)) {
+        if (file.size < 84) {
+            printf("%s: not an STL file\n", filename);
+            return 0;
+        }
+        // tolerate a count that disagrees with the file size by reading the complete facets present
+        long long nInFile = (long long) (file.size-84)/50;
+        if (nTriangles < 0 || nTriangles > nInFile) {
+            printf("%s: header claims %d triangles, file holds %lld\n", filename, nTriangles, nInFile);
+            nTriangles = (int) nInFile;
+        }
+    }
+    STLWelder welder(points, triangles, normals, nTriangles);
+    const char *facet = file.data+84;
+    for (int i = 0; i < nTriangles; i++, facet += 50) {
+        float f[12];
+        memcpy(f, facet, sizeof(f));                            // facets are not 4-byte aligned
+        vec3 v[] = {vec3(f+3), vec3(f+6), vec3(f+9)};
+        welder.AddFacet(v, vec3(f));
+    }
+    welder.Finish();
+    return nTriangles;
+}
+
+// PLY
+
+namespace {
+
+enum PlyType { PlyNone, PlyInt8, PlyUInt8, PlyInt16, PlyUInt16, PlyInt32, PlyUInt32, PlyFloat32, PlyFloat64 };
+
+enum PlyFormat { PlyAscii, PlyLittleEndian, PlyBigEndian };
+
+PlyType PlyTypeNamed(const char *name) {
+    const char *names[][2] = {{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+                              {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}};
+    for (int i = 0; i < 8; i++)
+        if (!strcmp(name, names[i][0]) || !strcmp(name, names[i][1]))
+            return (PlyType) (i+1);
+    return PlyNone;
+}
+
+int PlySize(PlyType t) {
+    static int sizes[] = {0, 1, 1, 2, 2, 4, 4, 4, 8};
+    return sizes[t];
+}
+
+struct PlyProperty {
+    string name;
+    PlyType type = PlyNone, countType = PlyNone;                // countType set if a list
+    int offset = 0;                                             // byte offset in a fixed-size binary record
+};
+
+struct PlyElement {
+    string name;
+    int count = 0, stride = 0;                                  // stride is 0 if records have lists
+    vector<PlyProperty> properties;
+    int Find(const char *n1, const char *n2 = NULL, const char *n3 = NULL) {
+        for (size_t i = 0; i < properties.size(); i++) {
+            const char *n = properties[i].name.c_str();
+            if (!strcmp(n, n1) || (n2 && !strcmp(n, n2)) || (n3 && !strcmp(n, n3)))
+                return i;
+        }
+        return -1;
+    }
+};
+
+bool ParsePlyHeader(MappedFile &file, PlyFormat &format, vector<PlyElement> &elements, const char *&body) {
+    const char *p = file.data, *end = p+file.size;
+    if (file.size < 4 || strncmp(p, "ply", 3) || (p[3] != '\n' && p[3] != '\r'))
+        return false;
+    bool hasFormat = false;
+    while (p < end) {
+        const char *eol = (const char *) memchr(p, '\n', end-p);
+        if (!eol)
+            return false;
+        string line(p, eol[-1] == '\r'? eol-1 : eol);
+        p = eol+1;
+        char w1[64] = "", w2[64] = "", w3[64] = "", w4[64] = "", w5[64] = "";
+        int nWords = sscanf(line.c_str(), "%63s %63s %63s %63s %63s", w1, w2, w3, w4, w5);
+        if (!strcmp(w1, "end_header")) {
+            body = p;
+            return hasFormat;
+        }
+        if (!strcmp(w1, "format") && nWords >= 2) {
+            hasFormat = true;
+            if (!strcmp(w2, "ascii")) format = PlyAscii;
+            else if (!strcmp(w2, "binary_little_endian")) format = PlyLittleEndian;
+            else if (!strcmp(w2, "binary_big_endian")) format = PlyBigEndian;
+            else return false;
+        }
+        if (!strcmp(w1, "element") && nWords == 3) {
+            PlyElement e;
+            e.name = w2;
+            e.count = atoi(w3);
+            elements.push_back(e);
+        }
+        if (!strcmp(w1, "property") && !elements.empty()) {
+            PlyElement &e = elements.back();
+            PlyProperty prop;
+            bool isList = !strcmp(w2, "list") && nWords == 5;
+            prop.countType = isList? PlyTypeNamed(w3) : PlyNone;
+            prop.type = PlyTypeNamed(isList? w4 : w2);
+            prop.name = isList? w5 : w3;
+            if (prop.type == PlyNone || (isList && prop.countType == PlyNone))
+                return false;
+            prop.offset = e.stride;
+            e.stride = isList || (e.stride == 0 && !e.properties.empty())? 0 : e.stride+PlySize(prop.type);
+            e.properties.push_back(prop);
+        }
+        // comment, obj_info ignored
+    }
+    return false;
+}
+
+class PlyValues {
+    // sequential reader of ASCII or binary scalars
+public:
+    const char *ptr, *end;
+    PlyFormat format;
+    PlyValues(const char *p, const char *e, PlyFormat f) : ptr(p), end(e), format(f) { }
+    bool Read(PlyType t, double &d) {
+        if (format == PlyAscii) {
+            if (t == PlyFloat32 || t == PlyFloat64) {
+                float f;
+                if (!ParseFloat(ptr, end, f))
+                    return false;
+                d = f;
+                return true;
+            }
+            int i;
+            if (!ParseInt(ptr, end, i))
+                return false;
+            d = i;
+            return true;
+        }
+        int size = PlySize(t);
+        if (ptr+size > end)
+            return false;
+        d = Decode(t, ptr);
+        ptr += size;
+        return true;
+    }
+    double Decode(PlyType t, const char *p) {
+        unsigned char b[8];
+        int size = PlySize(t);
+        for (int i = 0; i < size; i++)
+            b[i] = p[format == PlyBigEndian? size-1-i : i];     // assumes little-endian host
+        switch (t) {
+            case PlyInt8:    return (signed char) b[0];
+            case PlyUInt8:   return b[0];
+            case PlyInt16:   { short s; memcpy(&s, b, 2); return s; }
+            case PlyUInt16:  { unsigned short s; memcpy(&s, b, 2); return s; }
+            case PlyInt32:   { int i; memcpy(&i, b, 4); return i; }
+            case PlyUInt32:  { unsigned int i; memcpy(&i, b, 4); return i; }
+            case PlyFloat32: { float f; memcpy(&f, b, 4); return f; }
+            case PlyFloat64: { double d; memcpy(&d, b, 8); return d; }
+            default:         return 0;
+        }
+    }
+    bool Skip(PlyProperty &prop) {
+        double d, count = 1;
+        if (prop.countType != PlyNone && !Read(prop.countType, count))
+            return false;
+        if (format != PlyAscii && count >= 0) {
+            ptr += (int) count*PlySize(prop.type);
+            return ptr <= end;
+        }
+        for (int i = 0; i < (int) count; i++)
+            if (!Read(prop.type, d))
+                return false;
+        return true;
+    }
+};
+
+} // end namespace
+
+bool ReadPly(const char *filename, vector<vec3> &points, vector<int3> &triangles,
+             vector<vec3> *normals, vector<vec2> *uvs, vector<vec3> *colors, int nThreads) {
+    MappedFile file;
+    if (!file.Open(filename)) {
+        printf("can't open %s\n", filename);
+        return false;
+    }
+    PlyFormat format = PlyAscii;
+    vector<PlyElement> elements;
+    const char *body = NULL, *end = file.data+file.size;
+    if (!ParsePlyHeader(file, format, elements, body)) {
+        printf("%s: bad PLY header\n", filename);
+        return false;
+    }
+    int nOldPoints = points.size(), nBadFaces = 0;
+    PlyValues values(body, end, format);
+    for (size_t e = 0; e < elements.size(); e++) {
+        PlyElement &el = elements[e];
+        if (el.name == "vertex") {
+            // property indices (-1 if absent) of x, y, z, nx, ny, nz, u, v, red, green, blue
+            int slots[] = {el.Find("x"), el.Find("y"), el.Find("z"),
+                           el.Find("nx"), el.Find("ny"), el.Find("nz"),
+                           el.Find("u", "s", "texture_u"), el.Find("v", "t", "texture_v"),
+                           el.Find("red", "r"), el.Find("green", "g"), el.Find("blue", "b")};
+            if (slots[0] < 0 || slots[1] < 0 || slots[2] < 0) {
+                printf("%s: vertex lacks x, y, z\n", filename);
+                return false;
+            }
+            bool hasN = normals && slots[3] >= 0 && slots[4] >= 0 && slots[5] >= 0;
+            bool hasT = uvs && slots[6] >= 0 && slots[7] >= 0;
+            bool hasC = colors && slots[8] >= 0 && slots[9] >= 0 && slots[10] >= 0;
+            int n = el.count, nOld = nOldPoints;
+            points.resize(nOld+n);
+            if (hasN) normals->resize(nOld+n);
+            if (hasT) uvs->resize(nOld+n);
+            if (hasC) colors->resize(nOld+n);
+            // integer colors are 0-255, floating colors 0-1
+            float colorRange = hasC && el.properties[slots[8]].type <= PlyUInt8? 255.f : 1.f;
+            auto store = [&](int i, double *v) {
+                points[nOld+i] = vec3((float) v[0], (float) v[1], (float) v[2]);
+                if (hasN) (*normals)[nOld+i] = vec3((float) v[3], (float) v[4], (float) v[5]);
+                if (hasT) (*uvs)[nOld+i] = vec2((float) v[6], (float) v[7]);
+                if (hasC) (*colors)[nOld+i] = vec3((float) v[8], (float) v[9], (float) v[10])/colorRange;
+            };
+            if (el.stride > 0 && format != PlyAscii) {
+                // fixed-size records: decode directly from the mapped file, in parallel
+                if (values.ptr+(size_t) n*el.stride > end) {
+                    printf("%s: file too short\n", filename);
+                    return false;
+                }
+                const char *base = values.ptr;
+                ParallelRange(n, [&](int begin, int last) {
+                    for (int i = begin; i < last; i++) {
+                        const char *record = base+(size_t) i*el.stride;
+                        double v[11];
+                        for (int s = 0; s < 11; s++)
+                            if (slots[s] >= 0) {
+                                PlyProperty &prop = el.properties[slots[s]];
+                                if (prop.type == PlyFloat32 && format == PlyLittleEndian) {
+                                    float f;
+                                    memcpy(&f, record+prop.offset, 4);
+                                    v[s] = f;
+                                }
+                                else
+                                    v[s] = values.Decode(prop.type, record+prop.offset);
+                            }
+                        store(i, v);
+                    }
+                }, 1 << 14, nThreads);
+                values.ptr += (size_t) n*el.stride;
+            }
+            else
+                for (int i = 0; i < n; i++) {
+                    double v[11], d;
+                    for (int p = 0; p < (int) el.properties.size(); p++) {
+                        PlyProperty &prop = el.properties[p];
+                        int s = 0;
+                        while (s < 11 && slots[s] != p)
+                            s++;
+                        if (s == 11 || prop.countType != PlyNone) {
+                            if (!values.Skip(prop))
+                                return false;
+                        }
+                        else if (!values.Read(prop.type, d)) {
+                            printf("%s: bad vertex %d\n", filename, i);
+                            return false;
+                        }
+                        else
+                            v[s] = d;
+                    }
+                    store(i, v);
+                }
+        }
+        else if (el.name == "face") {
+            int listId = el.Find("vertex_indices", "vertex_index");
+            if (listId < 0 || el.properties[listId].countType == PlyNone) {
+                printf("%s: face lacks vertex_indices\n", filename);
+                return false;
+            }
+            int nPoints = points.size() - nOldPoints;
+            PlyProperty &list = el.properties[listId];
+            bool fastTriangles = format == PlyLittleEndian && el.properties.size() == 1 &&
+                                 list.countType == PlyUInt8 && (list.type == PlyInt32 || list.type == PlyUInt32);
+            vector<int> ids;
+            triangles.reserve(triangles.size()+el.count);
+            for (int f = 0; f < el.count; f++) {
+                if (fastTriangles && values.ptr+13 <= end && *values.ptr == 3) {
+                    // common case: uchar 3, int ids
+                    int3 t;
+                    memcpy(&t, values.ptr+1, 12);
+                    values.ptr += 13;
+                    if ((unsigned) t.i1 < (unsigned) nPoints && (unsigned) t.i2 < (unsigned) nPoints && (unsigned) t.i3 < (unsigned) nPoints)
+                        triangles.push_back(int3(t.i1+nOldPoints, t.i2+nOldPoints, t.i3+nOldPoints));
+                    else
+                        nBadFaces++;
+                    continue;
+                }
+                for (int p = 0; p < (int) el.properties.size(); p++) {
+                    PlyProperty &prop = el.properties[p];
+                    if (p != listId) {
+                        if (!values.Skip(prop))
+                            return false;
+                        continue;
+                    }
+                    double count, id;
+                    if (!values.Read(prop.countType, count)) {
+                        printf("%s: bad face %d\n", filename, f);
+                        return false;
+                    }
+                    ids.resize(0);
+                    bool ok = true;
+                    for (int i = 0; i < (int) count; i++) {
+                        if (!values.Read(prop.type, id)) {
+                            printf("%s: bad face %d\n", filename, f);
+                            return false;
+                        }
+                        ok = ok && id >= 0 && id < nPoints;
+                        ids.push_back((int) id+nOldPoints);
+                    }
+                    if (!ok || ids.size() < 3) {
+                        nBadFaces++;
+                        continue;
+                    }
+                    // fan polygon into triangles
+                    for (size_t i = 1; i+1 < ids.size(); i++)
+                        triangles.push_back(int3(ids[0], ids[i], ids[i+1]));
+                }
+            }
+        }
+        else
+            for (int i = 0; i < el.count; i++)
+                for (size_t p = 0; p < el.properties.size(); p++)
+                    if (!values.Skip(el.properties[p])) {
+                        printf("%s: bad %s element\n", filename, el.name.c_str());
+                        return false;
+                    }
+    }
+    if (nBadFaces)
+        printf("%s: skipped %d faces with bad vertex indices\n", filename, nBadFaces);
+    return true;
+}
+
+// Text Formatting
+
+namespace {
+
+int FormatUInt(char *out, unsigned long long u) {
+    // write decimal digits of u, return # chars
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = (char) ('0'+u%10);
+        u /= 10;
+    } while (u);
+    for (int i = 0; i < n; i++)
+        out[i] = tmp[n-1-i];
+    return n;
+}
+
+float DecimalToFloat(unsigned long long digits, int exponent) {
+    // as ParseFloat: exact integer and power of ten, one rounding in double, one to float
+    double d = (double) digits;
+    return (float) (exponent < 0? d/powersOf10[-exponent] : d*powersOf10[exponent]);
+}
+
+} // end namespace
+
+int FormatInt(char *out, int i) {
+    if (i < 0) {
+        *out = '-';
+        return 1+FormatUInt(out+1, (unsigned long long) -(long long) i);
+    }
+    return FormatUInt(out, (unsigned long long) i);
+}
+
+int FormatFloat(char *out, float f) {
+    // find fewest significant digits (1 to 9) that parse back to f, then print them in fixed
+    // notation for moderate exponents, else as d.ddde[-]xx; 9 digits always suffice for a float
+    if (f != f)
+        return sprintf(out, "nan");
+    if (f == 0)
+        return sprintf(out, f == 0 && 1/f < 0? "-0" : "0");
+    if (f-f != 0)
+        return sprintf(out, f < 0? "-inf" : "inf");
+    char *start = out;
+    if (f < 0) {
+        *out++ = '-';
+        f = -f;
+    }
+    int e10 = (int) floor(log10((double) f));           // f = d.ddd * 10^e10
+    unsigned long long digits = 0;
+    int nDigits = 0, exponent = 0;                      // f = digits * 10^exponent
+    for (nDigits = 1; nDigits <= 9; nDigits++) {
+        exponent = e10-nDigits+1;
+        if (exponent < -22 || exponent > 22)
+            break;
+        double scaled = exponent < 0? (double) f*powersOf10[-exponent] : (double) f/powersOf10[exponent];
+        digits = (unsigned long long) (scaled+.5);
+        if (DecimalToFloat(digits, exponent) == f)
+            break;
+    }
+    if (nDigits > 9 || exponent < -22 || exponent > 22)
+        return (int) (out-start)+sprintf(out, "%.9g", f);
+    char d[24];
+    nDigits = FormatUInt(d, digits);                    // rounding may have carried (eg, 9.99 -> 10.0)
+    while (nDigits > 1 && d[nDigits-1] == '0') {
+        nDigits--;
+        exponent++;
+    }
+    int point = nDigits+exponent;                       // digits before decimal point
+    if (point > 9 || point < -4) {
+        *out++ = d[0];
+        if (nDigits > 1) {
+            *out++ = '.';
+            memcpy(out, d+1, nDigits-1);
+            out += nDigits-1;
+        }
+        *out++ = 'e';
+        out += FormatInt(out, point-1);
+    }
+    else if (point <= 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = 0; i < -point; i++)
+            *out++ = '0';
+        memcpy(out, d, nDigits);
+        out += nDigits;
+    }
+    else {
+        for (int i = 0; i < point; i++)
+            *out++ = i < nDigits? d[i] : '0';
+        if (nDigits > point) {
+            *out++ = '.';
+            memcpy(out, d+point, nDigits-point);
+            out += nDigits-point;
+        }
+    }
+    return (int) (out-start);
+}
+
+// Buffered Output
+
+namespace {
+
+class OutBuffer {
+    // text or binary output accumulated in memory, written with one large write per flush
+public:
+    vector<char> buf;
+    size_t size = 0;
+    char *Reserve(size_t n) {
+        if (size+n > buf.size())
+            buf.resize(2*(size+n));
+        return &buf[size];
+    }
+    void Bytes(const void *data, size_t n) { memcpy(Reserve(n), data, n); size += n; }
+    void Str(const char *s) { Bytes(s, strlen(s)); }
+    void Char(char c) { *Reserve(1) = c; size++; }
+    void Int(int i) { size += FormatInt(Reserve(16), i); }
+    void Float(float f) { size += FormatFloat(Reserve(32), f); }
+    template<class T> void Binary(const T &t) { Bytes(&t, sizeof(T)); }
+    bool Flush(FILE *out) {
+        bool ok = !size || fwrite(&buf[0], 1, size, out) == size;
+        size = 0;
+        return ok;
+    }
+};
+
+template<class Format>
+bool WriteChunked(FILE *out, int n, Format format, int nThreads, int chunkSize = 1 << 16) {
+    // format items [0, n) in chunks, a round of chunks in parallel, and write the chunks in order
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    int nChunks = (n+chunkSize-1)/chunkSize, roundSize = 2*nThreads;
+    vector<OutBuffer> buffers(roundSize < nChunks? roundSize : nChunks);
+    for (int first = 0; first < nChunks; first += roundSize) {
+        int nRound = nChunks-first < roundSize? nChunks-first : roundSize;
+        ParallelFor(nRound, [&](int r) {
+            int begin = (first+r)*chunkSize, end = begin+chunkSize < n? begin+chunkSize : n;
+            for (int i = begin; i < end; i++)
+                format(buffers[r], i);
+        }, nThreads);
+        for (int r = 0; r < nRound; r++)
+            if (!buffers[r].Flush(out))
+                return false;
+    }
+    return true;
+}
+
+} // end namespace
+
+// Write OBJ, PLY, STL
+
+bool WriteObjBuffered(const char *filename, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
+                      vector<int3> *triangles, vector<int4> *quads, int nThreads) {
+    FILE *out = fopen(filename, "wb");
+    if (!out) {
+        printf("can't write %s\n", filename);
+        return false;
+    }
+    auto vec3Line = [](OutBuffer &b, const char *key, const vec3 &v) {
+        b.Str(key);
+        b.Float(v.x); b.Char(' '); b.Float(v.y); b.Char(' '); b.Float(v.z); b.Char('\n');
+    };
+    bool ok = WriteChunked(out, points.size(), [&](OutBuffer &b, int i) { vec3Line(b, "v ", points[i]); }, nThreads) &&
+              fputc('\n', out) != EOF &&
+              WriteChunked(out, normals.size(), [&](OutBuffer &b, int i) { vec3Line(b, "vn ", normals[i]); }, nThreads) &&
+              fputc('\n', out) != EOF &&
+              WriteChunked(out, uvs.size(), [&](OutBuffer &b, int i) {
+                  b.Str("vt "); b.Float(uvs[i].x); b.Char(' '); b.Float(uvs[i].y); b.Char('\n');
+              }, nThreads) &&
+              fputc('\n', out) != EOF;
+    // write triangles, quads (adding 1 to all vertex indices per OBJ format)
+    if (ok && triangles)
+        ok = WriteChunked(out, triangles->size(), [&](OutBuffer &b, int i) {
+            int3 &t = (*triangles)[i];
+            b.Str("f "); b.Int(t.i1+1); b.Char(' '); b.Int(t.i2+1); b.Char(' '); b.Int(t.i3+1); b.Char('\n');
+        }, nThreads) && fputc('\n', out) != EOF;
+    if (ok && quads)
+        ok = WriteChunked(out, quads->size(), [&](OutBuffer &b, int i) {
+            int4 &q = (*quads)[i];
+            b.Str("f "); b.Int(q.i1+1); b.Char(' '); b.Int(q.i2+1); b.Char(' '); b.Int(q.i3+1); b.Char(' '); b.Int(q.i4+1); b.Char('\n');
+        }, nThreads);
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        printf("error writing %s\n", filename);
+    return ok;
+}
+
+bool WritePly(const char *filename, vector<vec3> &points, vector<vec3> *normals, vector<vec2> *uvs,
+              vector<int3> &triangles, vector<vec3> *colors, int nThreads) {
+    // binary little-endian (native byte order on x86/x64)
+    int nPoints = points.size();
+    bool hasN = normals && (int) normals->size() == nPoints, hasT = uvs && (int) uvs->size() == nPoints;
+    bool hasC = colors && (int) colors->size() == nPoints;
+    FILE *out = fopen(filename, "wb");
+    if (!out) {
+        printf("can't write %s\n", filename);
+        return false;
+    }
+    OutBuffer header;
+    header.Str("ply\nformat binary_little_endian 1.0\ncomment written by WritePly\nelement vertex ");
+    header.Int(nPoints);
+    header.Str("\nproperty float x\nproperty float y\nproperty float z\n");
+    if (hasN)
+        header.Str("property float nx\nproperty float ny\nproperty float nz\n");
+    if (hasT)
+        header.Str("property float s\nproperty float t\n");
+    if (hasC)
+        header.Str("property uchar red\nproperty uchar green\nproperty uchar blue\n");
+    header.Str("element face ");
+    header.Int(triangles.size());
+    header.Str("\nproperty list uchar int vertex_indices\nend_header\n");
+    bool ok = header.Flush(out) &&
+              WriteChunked(out, nPoints, [&](OutBuffer &b, int i) {
+                  b.Binary(points[i]);
+                  if (hasN) b.Binary((*normals)[i]);
+                  if (hasT) b.Binary((*uvs)[i]);
+                  if (hasC)
+                      for (int k = 0; k < 3; k++) {
+                          float c = (*colors)[i][k];
+                          b.Char((char) (c <= 0? 0 : c >= 1? 255 : (int) (255*c+.5f)));
+                      }
+              }, nThreads) &&
+              WriteChunked(out, triangles.size(), [&](OutBuffer &b, int i) {
+                  b.Char(3);
+                  b.Binary(triangles[i]);
+              }, nThreads);
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        printf("error writing %s\n", filename);
+    return ok;
+}
+
+bool WriteSTL(const char *filename, vector<vec3> &points, vector<int3> &triangles, int nThreads) {
+    // binary: 80-byte header, triangle count, per triangle: normal, 3 vertices, 2-byte attribute
+    FILE *out = fopen(filename, "wb");
+    if (!out) {
+        printf("can't write %s\n", filename);
+        return false;
+    }
+    OutBuffer header;
+    char title[80] = "binary STL written by WriteSTL";
+    unsigned int nTriangles = triangles.size();
+    header.Bytes(title, 80);
+    header.Binary(nTriangles);
+    bool ok = header.Flush(out) &&
+              WriteChunked(out, nTriangles, [&](OutBuffer &b, int i) {
+                  int3 &t = triangles[i];
+                  vec3 &p1 = points[t.i1], &p2 = points[t.i2], &p3 = points[t.i3];
+                  vec3 n = cross(p2-p1, p3-p2);
+                  float len = length(n);
+                  unsigned short attribute = 0;
+                  b.Binary(len > 0? n/len : n);
+                  b.Binary(p1);
+                  b.Binary(p2);
+                  b.Binary(p3);
+                  b.Binary(attribute);
+              }, nThreads);
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        printf("error writing %s\n", filename);
+    return ok;
+}
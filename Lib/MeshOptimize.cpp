@@ -0,0 +1,507 @@
+// MeshOptimize.cpp - reorder mesh triangles and vertices for the GPU
+
+#include "MeshOptimize.h"
+#include "Parallel.h"
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+// Post-Transform Vertex Cache
+
+VertexCacheStats MeasureVertexCache(vector<int3> &triangles, int nVertices, int cacheSize,
+                                    int firstTriangle, int nTriangles) {
+    // a vertex is cached if fewer than cacheSize misses followed its own miss
+    VertexCacheStats stats;
+    if (nTriangles < 0)
+        nTriangles = triangles.size()-firstTriangle;
+    if (nTriangles <= 0)
+        return stats;
+    vector<int> missedAt(nVertices, -1);
+    int misses = 0, used = 0;
+    for (int t = firstTriangle; t < firstTriangle+nTriangles; t++)
+        for (int k = 0; k < 3; k++) {
+            int v = triangles[t][k];
+            if (missedAt[v] >= 0 && misses-missedAt[v] < cacheSize)
+                continue;
+            used += missedAt[v] < 0;
+            missedAt[v] = ++misses;
+        }
+    stats.acmr = (float) misses/nTriangles;
+    stats.atvr = used? (float) misses/used : 0;
+    return stats;
+}
+
+static void Tipsify(int3 *tris, int nTriangles, int cacheSize, vector<int> &local) {
+    // fan out all remaining triangles of the current vertex, then move to the candidate
+    // (a vertex of the emitted triangles) that is still cached after its remaining triangles are
+    // emitted and is oldest in the cache, else to a recently used vertex, else to the next triangle
+    // renumber the range's vertices locally, so work and memory follow the range, not the mesh
+    // (local is all -1 on entry and is restored on return, so callers can reuse it across ranges)
+    vector<int> live;                               // # triangles not yet emitted, per local vertex
+    vector<int3> localTris(nTriangles);
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++) {
+            int &l = local[tris[t][k]];
+            if (l < 0) {
+                l = live.size();
+                live.push_back(0);
+            }
+            live[l]++;
+            localTris[t][k] = l;
+        }
+    int n = live.size();
+    // triangles adjacent to each vertex
+    vector<int> offsets(n+1, 0), adjacent(3*nTriangles);
+    for (int v = 0; v < n; v++)
+        offsets[v+1] = offsets[v]+live[v];
+    vector<int> next(offsets.begin(), offsets.end()-1);
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            adjacent[next[localTris[t][k]]++] = t;
+    vector<int> cachedAt(n, 0), deadEnd, candidates;
+    vector<char> emitted(nTriangles, 0);
+    vector<int3> order;
+    order.reserve(nTriangles);
+    int time = cacheSize+1, cursor = 0, fan = 0;
+    while (fan >= 0) {
+        candidates.clear();
+        for (int a = offsets[fan]; a < offsets[fan+1]; a++) {
+            int t = adjacent[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            order.push_back(tris[t]);
+            for (int k = 0; k < 3; k++) {
+                int v = localTris[t][k];
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time-cachedAt[v] > cacheSize)
+                    cachedAt[v] = time++;
+            }
+        }
+        fan = -1;
+        int best = -1;
+        for (size_t c = 0; c < candidates.size(); c++) {
+            int v = candidates[c];
+            if (live[v] > 0) {
+                int age = time-cachedAt[v], priority = age+2*live[v] <= cacheSize? age : 0;
+                if (priority > best) {
+                    best = priority;
+                    fan = v;
+                }
+            }
+        }
+        while (fan < 0 && !deadEnd.empty()) {
+            int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0)
+                fan = v;
+        }
+        for (; fan < 0 && cursor < nTriangles; cursor++)
+            if (!emitted[cursor])
+                fan = localTris[cursor].i1;
+    }
+    for (int t = 0; t < nTriangles; t++) {
+        tris[t] = order[t];
+        for (int k = 0; k < 3; k++)
+            local[tris[t][k]] = -1;
+    }
+}
+
+void OptimizeVertexCache(vector<int3> &triangles, int nVertices, int cacheSize, int firstTriangle, int nTriangles) {
+    if (nTriangles < 0)
+        nTriangles = triangles.size()-firstTriangle;
+    if (nTriangles <= 0)
+        return;
+    vector<int> local(nVertices, -1);
+    Tipsify(&triangles[firstTriangle], nTriangles, cacheSize, local);
+}
+
+void OptimizeVertexCache(vector<int3> &triangles, int nVertices, vector<Meshlet> &meshlets, int cacheSize) {
+    // one local map per task, not per meshlet
+    ParallelRange((int) meshlets.size(), [&](int begin, int end) {
+        vector<int> local(nVertices, -1);
+        for (int m = begin; m < end; m++)
+            if (meshlets[m].nTriangles > 0)
+                Tipsify(&triangles[meshlets[m].firstTriangle], meshlets[m].nTriangles, cacheSize, local);
+    }, 1024);
+}
+
+// Overdraw
+
+namespace {
+
+class FifoCache {
+    // vertex cache simulation that can be emptied in constant time
+public:
+    FifoCache(int nVertices, int size) : missedAt(nVertices, 0), size(size) { }
+    int Misses(int3 &t) {
+        // draw t, return # vertices missed
+        int n = 0;
+        for (int k = 0; k < 3; k++) {
+            int &at = missedAt[t[k]];
+            if (at > flushedAt && misses-at < size)
+                continue;
+            at = ++misses;
+            n++;
+        }
+        return n;
+    }
+    void Flush() { flushedAt = misses; }
+private:
+    vector<int> missedAt;
+    int size, misses = 0, flushedAt = 0;
+};
+
+float Outward(int3 *tris, int nTriangles, vector<vec3> &points) {
+    // -1 if the triangles' winding encloses negative volume about their centroid (the shader is
+    // two-sided, so inward winding is legal), else 1
+    vec3 center;
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            center += points[tris[t][k]];
+    center *= 1.f/(3*nTriangles);
+    double volume = 0;
+    for (int t = 0; t < nTriangles; t++) {
+        vec3 p1 = points[tris[t].i1]-center, p2 = points[tris[t].i2]-center, p3 = points[tris[t].i3]-center;
+        volume += dot(p1, cross(p2, p3));
+    }
+    return volume < 0? -1.f : 1.f;
+}
+
+} // end namespace
+
+void OptimizeOverdraw(vector<int3> &triangles, vector<vec3> &points, float threshold, int cacheSize,
+                      int firstTriangle, int nTriangles) {
+    if (nTriangles < 0)
+        nTriangles = triangles.size()-firstTriangle;
+    if (nTriangles <= 0)
+        return;
+    int3 *tris = &triangles[firstTriangle];
+    FifoCache cache(points.size(), cacheSize);
+    // hard boundaries: triangles missing all three vertices, where the cache order restarts
+    vector<int> hard, clusters;
+    for (int t = 0; t < nTriangles; t++)
+        if (cache.Misses(tris[t]) == 3 || !t)
+            hard.push_back(t);
+    hard.push_back(nTriangles);
+    // soft boundaries: within each hard run, end a cluster once its ACMR is within threshold of the run's
+    for (size_t h = 0; h+1 < hard.size(); h++) {
+        int begin = hard[h], end = hard[h+1], misses = 0;
+        cache.Flush();
+        for (int t = begin; t < end; t++)
+            misses += cache.Misses(tris[t]);
+        float limit = threshold*misses/(end-begin);
+        cache.Flush();
+        misses = 0;
+        clusters.push_back(begin);
+        for (int t = begin, start = begin; t < end; t++) {
+            misses += cache.Misses(tris[t]);
+            if (t+1 < end && misses <= limit*(t+1-start)) {
+                clusters.push_back(start = t+1);
+                cache.Flush();
+                misses = 0;
+            }
+        }
+    }
+    int nClusters = clusters.size();
+    clusters.push_back(nTriangles);
+    // occlusion potential: distance the area-weighted cluster centroid lies in front of the range's
+    // centroid, along the cluster's average outward normal
+    vec3 center;
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            center += points[tris[t][k]];
+    center *= 1.f/(3*nTriangles);
+    float outward = Outward(tris, nTriangles, points);
+    vector<float> potential(nClusters);
+    vector<int> order(nClusters);
+    for (int c = 0; c < nClusters; c++) {
+        vec3 centroid, normal;
+        float area = 0;
+        for (int t = clusters[c]; t < clusters[c+1]; t++) {
+            vec3 &p1 = points[tris[t].i1], &p2 = points[tris[t].i2], &p3 = points[tris[t].i3];
+            vec3 n = cross(p2-p1, p3-p1);
+            float a = length(n);
+            centroid += (a/3)*(p1+p2+p3);
+            normal += n;
+            area += a;
+        }
+        float len = length(normal);
+        potential[c] = area > 0 && len > 0? outward*dot(centroid/area-center, normal/len) : -FLT_MAX;
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return potential[a] > potential[b]; });
+    vector<int3> sorted;
+    sorted.reserve(nTriangles);
+    for (int c = 0; c < nClusters; c++)
+        sorted.insert(sorted.end(), tris+clusters[order[c]], tris+clusters[order[c]+1]);
+    for (int t = 0; t < nTriangles; t++)
+        tris[t] = sorted[t];
+}
+
+OverdrawStats MeasureOverdraw(vector<vec3> &points, vector<int3> &triangles, int resolution, int nThreads) {
+    OverdrawStats stats;
+    if (points.empty() || triangles.empty())
+        return stats;
+    vec3 min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (size_t i = 0; i < points.size(); i++)
+        for (int k = 0; k < 3; k++) {
+            min[k] = points[i][k] < min[k]? points[i][k] : min[k];
+            max[k] = points[i][k] > max[k]? points[i][k] : max[k];
+        }
+    vec3 center = .5f*(min+max);
+    float radius = .5f*length(max-min);
+    if (radius <= 0)
+        return stats;
+    const int nViews = 14;
+    vec3 views[nViews] = {vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1),
+                          vec3(1, 1, 1), vec3(-1, -1, -1), vec3(1, 1, -1), vec3(-1, -1, 1),
+                          vec3(1, -1, 1), vec3(-1, 1, -1), vec3(-1, 1, 1), vec3(1, -1, -1)};
+    vector<long long> covered(nViews), shaded(nViews);
+    ParallelFor(nViews, [&](int view) {
+        // orthographic projection of the bounding sphere onto the viewport
+        vec3 d = normalize(views[view]), up = fabs(d.y) < .9f? vec3(0, 1, 0) : vec3(1, 0, 0);
+        vec3 u = normalize(cross(up, d)), v = cross(d, u);
+        float s = .5f*resolution/radius;
+        vector<float> depth((size_t) resolution*resolution, FLT_MAX);
+        long long nShaded = 0;
+        for (size_t t = 0; t < triangles.size(); t++) {
+            float x[3], y[3], z[3];
+            for (int k = 0; k < 3; k++) {
+                vec3 p = points[triangles[t][k]]-center;
+                x[k] = dot(p, u)*s+.5f*resolution;
+                y[k] = dot(p, v)*s+.5f*resolution;
+                z[k] = dot(p, d);
+            }
+            float area = (x[1]-x[0])*(y[2]-y[0])-(y[1]-y[0])*(x[2]-x[0]);
+            if (area == 0)
+                continue;
+            if (area < 0) {
+                std::swap(x[1], x[2]);
+                std::swap(y[1], y[2]);
+                std::swap(z[1], z[2]);
+                area = -area;
+            }
+            // pixel centers in the bounding box, edge functions stepped incrementally
+            int x0 = (int) ceilf(std::min(x[0], std::min(x[1], x[2]))-.5f), x1 = (int) floorf(std::max(x[0], std::max(x[1], x[2]))-.5f);
+            int y0 = (int) ceilf(std::min(y[0], std::min(y[1], y[2]))-.5f), y1 = (int) floorf(std::max(y[0], std::max(y[1], y[2]))-.5f);
+            x0 = x0 < 0? 0 : x0;
+            y0 = y0 < 0? 0 : y0;
+            x1 = x1 >= resolution? resolution-1 : x1;
+            y1 = y1 >= resolution? resolution-1 : y1;
+            float dx[3], dy[3], w0[3];
+            for (int e = 0; e < 3; e++) {
+                // edge opposite vertex e
+                int a = (e+1)%3, b = (e+2)%3;
+                dx[e] = y[a]-y[b];
+                dy[e] = x[b]-x[a];
+                w0[e] = (x0+.5f-x[a])*dx[e]+(y0+.5f-y[a])*dy[e];
+            }
+            for (int py = y0; py <= y1; py++) {
+                float w[3];
+                for (int e = 0; e < 3; e++)
+                    w[e] = w0[e]+(py-y0)*dy[e];
+                float *row = &depth[(size_t) py*resolution];
+                for (int px = x0; px <= x1; px++, w[0] += dx[0], w[1] += dx[1], w[2] += dx[2]) {
+                    if (w[0] < 0 || w[1] < 0 || w[2] < 0)
+                        continue;
+                    float f = (w[0]*z[0]+w[1]*z[1]+w[2]*z[2])/area;
+                    if (f < row[px]) {
+                        row[px] = f;
+                        nShaded++;
+                    }
+                }
+            }
+        }
+        long long nCovered = 0;
+        for (size_t i = 0; i < depth.size(); i++)
+            nCovered += depth[i] < FLT_MAX;
+        covered[view] = nCovered;
+        shaded[view] = nShaded;
+    }, nThreads);
+    for (int view = 0; view < nViews; view++) {
+        stats.covered += covered[view];
+        stats.shaded += shaded[view];
+    }
+    stats.overdraw = stats.covered? (float) stats.shaded/stats.covered : 0;
+    return stats;
+}
+
+// Vertex Fetch
+
+namespace {
+
+template<class T>
+void Permute(vector<T> &a, vector<int> &newIndex) {
+    vector<T> p(a.size());
+    for (size_t i = 0; i < a.size(); i++)
+        p[newIndex[i]] = a[i];
+    a.swap(p);
+}
+
+} // end namespace
+
+int OptimizeVertexFetch(vector<int3> &triangles, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs) {
+    int nPoints = points.size(), used = 0;
+    vector<int> newIndex(nPoints, -1);
+    for (size_t t = 0; t < triangles.size(); t++)
+        for (int k = 0; k < 3; k++) {
+            int &v = triangles[t][k];
+            if (newIndex[v] < 0)
+                newIndex[v] = used++;
+            v = newIndex[v];
+        }
+    for (int v = 0, unused = used; v < nPoints; v++)
+        if (newIndex[v] < 0)
+            newIndex[v] = unused++;
+    Permute(points, newIndex);
+    if (normals.size() == points.size())
+        Permute(normals, newIndex);
+    if (uvs.size() == points.size())
+        Permute(uvs, newIndex);
+    return used;
+}
+
+// Meshlets
+
+int BuildMeshlets(vector<int3> &triangles, vector<vec3> &points, vector<Meshlet> &meshlets,
+                  int maxVertices, int maxTriangles, int firstTriangle, int nTriangles) {
+    if (nTriangles < 0)
+        nTriangles = triangles.size()-firstTriangle;
+    if (nTriangles <= 0)
+        return 0;
+    int3 *tris = &triangles[firstTriangle];
+    int nPoints = points.size(), nMeshlets = 0;
+    // triangles around each vertex
+    vector<int> offsets(nPoints+1, 0), around(3*nTriangles);
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            offsets[tris[t][k]+1]++;
+    for (int v = 0; v < nPoints; v++)
+        offsets[v+1] += offsets[v];
+    vector<int> next(offsets.begin(), offsets.end()-1);
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            around[next[tris[t][k]]++] = t;
+    // unit outward normals
+    float outward = Outward(tris, nTriangles, points);
+    vector<vec3> normals(nTriangles);
+    for (int t = 0; t < nTriangles; t++) {
+        vec3 n = cross(points[tris[t].i2]-points[tris[t].i1], points[tris[t].i3]-points[tris[t].i1]);
+        float len = length(n);
+        normals[t] = len > 0? (outward/len)*n : n;
+    }
+    // grow meshlets
+    vector<char> used(nTriangles, 0);
+    vector<int> vertexMeshlet(nPoints, -1), candidateMeshlet(nTriangles, -1), candidates, vertices;
+    vector<int3> sorted;
+    sorted.reserve(nTriangles);
+    for (int seed = 0; (int) sorted.size() < nTriangles; nMeshlets++) {
+        while (used[seed])
+            seed++;
+        int id = meshlets.size();
+        Meshlet m;
+        m.firstTriangle = firstTriangle+sorted.size();
+        vec3 normalSum;
+        candidates.clear();
+        vertices.clear();
+        for (int t = seed; t >= 0;) {
+            used[t] = 1;
+            sorted.push_back(tris[t]);
+            normalSum += normals[t];
+            for (int k = 0; k < 3; k++) {
+                int v = tris[t][k];
+                if (vertexMeshlet[v] == id)
+                    continue;
+                vertexMeshlet[v] = id;
+                vertices.push_back(v);
+                for (int i = offsets[v]; i < offsets[v+1]; i++)
+                    if (!used[around[i]] && candidateMeshlet[around[i]] != id) {
+                        candidateMeshlet[around[i]] = id;
+                        candidates.push_back(around[i]);
+                    }
+            }
+            if (++m.nTriangles == maxTriangles)
+                break;
+            // next: the candidate adding fewest vertices, then facing most nearly as the meshlet
+            float len = length(normalSum), bestDot = -2;
+            vec3 axis = len > 0? normalSum/len : normalSum;
+            int bestNew = 4;
+            t = -1;
+            size_t n = 0;
+            for (size_t i = 0; i < candidates.size(); i++) {
+                int c = candidates[i];
+                if (used[c])
+                    continue;
+                candidates[n++] = c;
+                int nNew = (vertexMeshlet[tris[c].i1] != id)+(vertexMeshlet[tris[c].i2] != id)+(vertexMeshlet[tris[c].i3] != id);
+                if ((int) vertices.size()+nNew > maxVertices)
+                    continue;
+                float d = dot(normals[c], axis);
+                if (nNew < bestNew || (nNew == bestNew && d > bestDot)) {
+                    t = c;
+                    bestNew = nNew;
+                    bestDot = d;
+                }
+            }
+            candidates.resize(n);
+        }
+        // bounding sphere about the vertices' bounds
+        m.nVertices = vertices.size();
+        vec3 min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (int i = 0; i < m.nVertices; i++)
+            for (int k = 0; k < 3; k++) {
+                float c = points[vertices[i]][k];
+                min[k] = c < min[k]? c : min[k];
+                max[k] = c > max[k]? c : max[k];
+            }
+        m.center = .5f*(min+max);
+        for (int i = 0; i < m.nVertices; i++) {
+            float r = length(points[vertices[i]]-m.center);
+            m.radius = r > m.radius? r : m.radius;
+        }
+        // normal cone about the average normal; cutoff is the sine of its half angle
+        float len = length(normalSum), minDot = 1;
+        if (len > 0) {
+            m.coneAxis = normalSum/len;
+            for (size_t i = sorted.size()-m.nTriangles; i < sorted.size(); i++) {
+                int3 &t = sorted[i];
+                vec3 n = cross(points[t.i2]-points[t.i1], points[t.i3]-points[t.i1]);
+                float nLen = length(n);
+                if (nLen > 0) {
+                    float d = outward*dot(n, m.coneAxis)/nLen;
+                    minDot = d < minDot? d : minDot;
+                }
+            }
+        }
+        m.coneCutoff = len > 0 && minDot > 0? sqrtf(1-minDot*minDot) : 1;
+        meshlets.push_back(m);
+    }
+    for (int t = 0; t < nTriangles; t++)
+        tris[t] = sorted[t];
+    return nMeshlets;
+}
+
+void FrustumPlanes(mat4 &m, vec4 planes[6]) {
+    // rows of m combined as left, right, bottom, top, near, far planes (Gribb and Hartmann), scaled to unit normals
+    for (int i = 0; i < 6; i++) {
+        vec4 p = i%2? m[3]-m[i/2] : m[3]+m[i/2];
+        float len = length(vec3(p.x, p.y, p.z));
+        planes[i] = len > 0? p/len : p;
+    }
+}
+
+bool MeshletVisible(Meshlet &m, vec4 planes[6], vec3 eye, bool cullBackFacing) {
+    for (int i = 0; i < 6; i++)
+        if (dot(vec3(planes[i].x, planes[i].y, planes[i].z), m.center)+planes[i].w < -m.radius)
+            return false;
+    if (cullBackFacing && m.coneCutoff < 1) {
+        // every triangle faces away if the eye lies within the cone's reverse, widened by the radius
+        vec3 d = m.center-eye;
+        if (dot(d, m.coneAxis) >= m.coneCutoff*length(d)+m.radius)
+            return false;
+    }
+    return true;
+}
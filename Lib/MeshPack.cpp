@@ -0,0 +1,493 @@
+// MeshPack.cpp - quantized, entropy-coded mesh files
+
+#include "MeshPack.h"
+#include "MeshIO.h"
+#include "MeshProcess.h"
+#include "Parallel.h"
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const char packMagic[8] = {'M', 'E', 'S', 'H', 'P', 'A', 'K', 0};
+const unsigned int packVersion = 1;
+const int blockVertices = 1 << 16, blockTriangles = 1 << 16;
+
+struct PackHeader {
+    char magic[8];
+    unsigned int version, headerSize;
+    int nPoints, nTriangles, hasNormals, hasUvs;
+    float min[3], max[3];
+};
+
+struct PackBlock {
+    long long offset, size;
+};
+
+// header is followed by a PackBlock for each vertex block, then for each triangle block, then the blocks
+
+typedef vector<unsigned char> Bytes;
+
+template<class T>
+void Put(Bytes &out, const T &t) {
+    const unsigned char *p = (const unsigned char *) &t;
+    out.insert(out.end(), p, p+sizeof(T));
+}
+
+struct Input {
+    const unsigned char *ptr, *end;
+    Input(const char *p, size_t n) : ptr((const unsigned char *) p), end((const unsigned char *) p+n) { }
+    template<class T> bool Get(T &t) {
+        if (end-ptr < (long long) sizeof(T))
+            return false;
+        memcpy(&t, ptr, sizeof(T));
+        ptr += sizeof(T);
+        return true;
+    }
+};
+
+// Order-0 rANS Byte Coder
+
+const int probBits = 12, probScale = 1 << probBits;
+const unsigned int ransLow = 1u << 23;
+
+enum StreamMode { Stored, Constant, Range };
+
+void NormalizeFrequencies(const unsigned int *counts, int total, unsigned short *freqs) {
+    // scale counts to sum to probScale, keeping every occurring symbol at least 1
+    int sum = 0;
+    for (int s = 0; s < 256; s++) {
+        int f = counts[s]? (int) ((long long) counts[s]*probScale/total) : 0;
+        freqs[s] = (unsigned short) (counts[s] && f < 1? 1 : f);
+        sum += freqs[s];
+    }
+    while (sum != probScale) {
+        int largest = 0;
+        for (int s = 1; s < 256; s++)
+            if (freqs[s] > freqs[largest])
+                largest = s;
+        if (sum < probScale) {
+            freqs[largest] += probScale-sum;
+            sum = probScale;
+        }
+        else {
+            freqs[largest]--;
+            sum--;
+        }
+    }
+}
+
+void EncodeStream(const unsigned char *data, int n, Bytes &out) {
+    // mode byte, then stored bytes, a single repeated byte, or symbol frequencies and coded bytes
+    unsigned int counts[256] = {0};
+    for (int i = 0; i < n; i++)
+        counts[data[i]]++;
+    if (n && counts[data[0]] == (unsigned int) n) {
+        out.push_back(Constant);
+        out.push_back(data[0]);
+        return;
+    }
+    unsigned short freqs[256] = {0}, cum[256];
+    if (n)
+        NormalizeFrequencies(counts, n, freqs);
+    unsigned char present[32] = {0};
+    for (int s = 0, c = 0; n && s < 256; c += freqs[s++]) {
+        cum[s] = (unsigned short) c;
+        if (freqs[s])
+            present[s/8] |= 1 << (s%8);
+    }
+    // encode in reverse, writing backwards from the end of a worst-case sized buffer
+    Bytes coded(2*(size_t) n+8);
+    unsigned char *end = coded.data()+coded.size(), *ptr = end;
+    unsigned int x = ransLow;
+    for (int i = n-1; i >= 0; i--) {
+        unsigned int f = freqs[data[i]], xMax = ((ransLow >> probBits) << 8)*f;
+        while (x >= xMax) {
+            *--ptr = (unsigned char) x;
+            x >>= 8;
+        }
+        x = ((x/f) << probBits)+x%f+cum[data[i]];
+    }
+    for (int k = 3; k >= 0; k--)
+        *--ptr = (unsigned char) (x >> (8*k));
+    unsigned int codedSize = (unsigned int) (end-ptr);
+    int nPresent = 0;
+    for (int s = 0; s < 256; s++)
+        nPresent += freqs[s] > 0;
+    if (!n || codedSize+sizeof(present)+2*nPresent+4 >= (unsigned int) n) {
+        out.push_back(Stored);
+        out.insert(out.end(), data, data+n);
+        return;
+    }
+    out.push_back(Range);
+    out.insert(out.end(), present, present+sizeof(present));
+    for (int s = 0; s < 256; s++)
+        if (freqs[s])
+            Put(out, freqs[s]);
+    Put(out, codedSize);
+    out.insert(out.end(), ptr, end);
+}
+
+bool DecodeStream(Input &in, int n, unsigned char *data) {
+    unsigned char mode;
+    if (!in.Get(mode))
+        return false;
+    if (mode == Stored || mode == Constant) {
+        int nBytes = mode == Stored? n : 1;
+        if (in.end-in.ptr < nBytes)
+            return false;
+        if (mode == Stored)
+            memcpy(data, in.ptr, n);
+        else
+            memset(data, *in.ptr, n);
+        in.ptr += nBytes;
+        return true;
+    }
+    if (mode != Range || in.end-in.ptr < 32)
+        return false;
+    const unsigned char *present = in.ptr;
+    in.ptr += 32;
+    unsigned short freqs[256] = {0}, cum[256];
+    unsigned char symbols[probScale];
+    int c = 0;
+    for (int s = 0; s < 256; s++) {
+        if (present[s/8] & (1 << (s%8)) && (!in.Get(freqs[s]) || c+freqs[s] > probScale))
+            return false;
+        cum[s] = (unsigned short) c;
+        memset(symbols+c, s, freqs[s]);
+        c += freqs[s];
+    }
+    unsigned int codedSize;
+    if (c != probScale || !in.Get(codedSize) || codedSize < 4 || in.end-in.ptr < (long long) codedSize)
+        return false;
+    const unsigned char *ptr = in.ptr, *end = ptr+codedSize;
+    in.ptr = end;
+    unsigned int x = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (unsigned int) ptr[3] << 24;
+    ptr += 4;
+    for (int i = 0; i < n; i++) {
+        unsigned int slot = x & (probScale-1);
+        unsigned char s = symbols[slot];
+        data[i] = s;
+        x = freqs[s]*(x >> probBits)+slot-cum[s];
+        while (x < ransLow && ptr < end)
+            x = x << 8 | *ptr++;
+    }
+    return true;
+}
+
+// 16-bit Channels: delta, zigzag, split into low and high byte planes
+
+void EncodeChannel(const unsigned short *v, int n, Bytes &out) {
+    Bytes lo(n), hi(n);
+    unsigned short prev = 0;
+    for (int i = 0; i < n; i++) {
+        short d = (short) (v[i]-prev);
+        unsigned short z = (unsigned short) (((unsigned int) d << 1) ^ (unsigned int) (d >> 15));
+        lo[i] = (unsigned char) z;
+        hi[i] = (unsigned char) (z >> 8);
+        prev = v[i];
+    }
+    EncodeStream(lo.data(), n, out);
+    EncodeStream(hi.data(), n, out);
+}
+
+bool DecodeChannel(Input &in, int n, unsigned char *scratch, unsigned short *v) {
+    if (!DecodeStream(in, n, scratch) || !DecodeStream(in, n, scratch+n))
+        return false;
+    unsigned short prev = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned short z = (unsigned short) (scratch[i] | scratch[n+i] << 8);
+        prev += (unsigned short) ((z >> 1) ^ -(z & 1));
+        v[i] = prev;
+    }
+    return true;
+}
+
+// Attribute Quantization
+
+unsigned short Quantize(float f, float min, float range) {
+    float q = range > 0? (f-min)/range*65535.f+.5f : 0;
+    return (unsigned short) (q < 0? 0 : q > 65535? 65535 : q);
+}
+
+void OctEncode(vec3 n, unsigned short &u, unsigned short &v) {
+    // project onto octahedron |x|+|y|+|z| = 1, fold lower half over upper, map [-1,1] to 16 bits
+    float l1 = fabsf(n.x)+fabsf(n.y)+fabsf(n.z);
+    float x = l1 > 0? n.x/l1 : 0, y = l1 > 0? n.y/l1 : 0;
+    if (n.z < 0) {
+        float ox = x;
+        x = (1-fabsf(y))*(ox >= 0? 1 : -1);
+        y = (1-fabsf(ox))*(y >= 0? 1 : -1);
+    }
+    u = Quantize(x, -1, 2);
+    v = Quantize(y, -1, 2);
+}
+
+vec3 OctDecode(unsigned short u, unsigned short v) {
+    float x = u*(2.f/65535.f)-1, y = v*(2.f/65535.f)-1, z = 1-fabsf(x)-fabsf(y);
+    if (z < 0) {
+        float ox = x;
+        x = (1-fabsf(y))*(ox >= 0? 1 : -1);
+        y = (1-fabsf(ox))*(y >= 0? 1 : -1);
+    }
+    float len = sqrtf(x*x+y*y+z*z);
+    return vec3(x/len, y/len, z/len);
+}
+
+unsigned short FloatToHalf(float f) {
+    // round to nearest even; overflow to infinity, underflow through subnormals to zero
+    unsigned int x;
+    memcpy(&x, &f, 4);
+    unsigned int sign = (x >> 16) & 0x8000, mant = x & 0x7fffff;
+    int exp = (int) ((x >> 23) & 0xff)-127+15;
+    if (((x >> 23) & 0xff) == 0xff)
+        return (unsigned short) (sign | 0x7c00 | (mant? 0x200 : 0));
+    if (exp >= 31)
+        return (unsigned short) (sign | 0x7c00);
+    if (exp <= 0) {
+        if (exp < -10)
+            return (unsigned short) sign;
+        mant |= 0x800000;
+        int shift = 14-exp;
+        unsigned int h = mant >> shift, rem = mant & ((1u << shift)-1), half = 1u << (shift-1);
+        if (rem > half || (rem == half && (h & 1)))
+            h++;
+        return (unsigned short) (sign | h);
+    }
+    unsigned int h = (unsigned int) exp << 10 | mant >> 13, rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++;                                            // a carry correctly bumps the exponent
+    return (unsigned short) (sign | h);
+}
+
+float HalfToFloat(unsigned short h) {
+    unsigned int sign = (unsigned int) (h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff, x;
+    if (exp == 0) {
+        float f = mant*(1.f/16777216.f);
+        return sign? -f : f;
+    }
+    x = sign | (exp == 31? 0x7f800000 : (exp+112) << 23) | mant << 13;
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+// Triangle Indices: zigzag deltas as variable-length integers
+
+inline unsigned int ZigZag(int d) { return ((unsigned int) d << 1) ^ (unsigned int) (d >> 31); }
+
+inline int UnZigZag(unsigned int z) { return (int) (z >> 1) ^ -(int) (z & 1); }
+
+void PutVarint(Bytes &out, unsigned int u) {
+    for (; u >= 128; u >>= 7)
+        out.push_back((unsigned char) (u | 128));
+    out.push_back((unsigned char) u);
+}
+
+bool GetVarint(const unsigned char *&ptr, const unsigned char *end, unsigned int &u) {
+    u = 0;
+    for (int shift = 0; ptr < end && shift < 35; shift += 7) {
+        unsigned char b = *ptr++;
+        u |= (unsigned int) (b & 127) << shift;
+        if (b < 128)
+            return true;
+    }
+    return false;
+}
+
+// Blocks
+
+void EncodeVertices(PackHeader &h, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
+                    int begin, int n, Bytes &out) {
+    vector<unsigned short> c1(n), c2(n);
+    for (int k = 0; k < 3; k++) {
+        for (int i = 0; i < n; i++)
+            c1[i] = Quantize(points[begin+i][k], h.min[k], h.max[k]-h.min[k]);
+        EncodeChannel(c1.data(), n, out);
+    }
+    if (h.hasNormals) {
+        for (int i = 0; i < n; i++)
+            OctEncode(normals[begin+i], c1[i], c2[i]);
+        EncodeChannel(c1.data(), n, out);
+        EncodeChannel(c2.data(), n, out);
+    }
+    if (h.hasUvs) {
+        for (int i = 0; i < n; i++) {
+            c1[i] = FloatToHalf(uvs[begin+i].x);
+            c2[i] = FloatToHalf(uvs[begin+i].y);
+        }
+        EncodeChannel(c1.data(), n, out);
+        EncodeChannel(c2.data(), n, out);
+    }
+}
+
+bool DecodeVertices(PackHeader &h, Input in, vec3 *points, vec3 *normals, vec2 *uvs, int n) {
+    // decode each channel into a plane, then dequantize planes into the output arrays
+    int nChannels = 3+2*h.hasNormals+2*h.hasUvs;
+    vector<unsigned short> planes(nChannels*(size_t) n);
+    Bytes scratch(2*(size_t) n);
+    for (int c = 0; c < nChannels; c++)
+        if (!DecodeChannel(in, n, scratch.data(), &planes[c*(size_t) n]))
+            return false;
+    const unsigned short *x = &planes[0], *y = x+n, *z = y+n, *c = z+n;
+    float s[3];
+    for (int k = 0; k < 3; k++)
+        s[k] = (h.max[k]-h.min[k])/65535.f;
+    for (int i = 0; i < n; i++)
+        points[i] = vec3(h.min[0]+x[i]*s[0], h.min[1]+y[i]*s[1], h.min[2]+z[i]*s[2]);
+    if (h.hasNormals) {
+        for (int i = 0; i < n; i++)
+            normals[i] = OctDecode(c[i], c[n+i]);
+        c += 2*n;
+    }
+    if (h.hasUvs)
+        for (int i = 0; i < n; i++)
+            uvs[i] = vec2(HalfToFloat(c[i]), HalfToFloat(c[n+i]));
+    return true;
+}
+
+void EncodeTriangles(vector<int3> &triangles, int begin, int n, Bytes &out) {
+    // first index relative to previous triangle's first, others relative to the first
+    Bytes bytes;
+    bytes.reserve(4*(size_t) n);
+    int prev = 0;
+    for (int i = 0; i < n; i++) {
+        int3 &t = triangles[begin+i];
+        PutVarint(bytes, ZigZag(t.i1-prev));
+        PutVarint(bytes, ZigZag(t.i2-t.i1));
+        PutVarint(bytes, ZigZag(t.i3-t.i1));
+        prev = t.i1;
+    }
+    Put(out, (unsigned int) bytes.size());
+    EncodeStream(bytes.data(), bytes.size(), out);
+}
+
+bool DecodeTriangles(Input in, int3 *triangles, int n, int nPoints) {
+    unsigned int nBytes;
+    if (!in.Get(nBytes) || nBytes > 15*(unsigned int) n)
+        return false;
+    Bytes bytes(nBytes);
+    if (!DecodeStream(in, nBytes, bytes.data()))
+        return false;
+    const unsigned char *ptr = bytes.data(), *end = ptr+nBytes;
+    int prev = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned int z1, z2, z3;
+        if (!GetVarint(ptr, end, z1) || !GetVarint(ptr, end, z2) || !GetVarint(ptr, end, z3))
+            return false;
+        int i1 = prev+UnZigZag(z1), i2 = i1+UnZigZag(z2), i3 = i1+UnZigZag(z3);
+        if ((unsigned) i1 >= (unsigned) nPoints || (unsigned) i2 >= (unsigned) nPoints || (unsigned) i3 >= (unsigned) nPoints)
+            return false;
+        triangles[i] = int3(i1, i2, i3);
+        prev = i1;
+    }
+    return true;
+}
+
+} // end namespace
+
+bool WritePackedMesh(const char *filename, vector<vec3> &points, vector<vec3> &normals,
+                     vector<vec2> &uvs, vector<int3> &triangles, int nThreads) {
+    PackHeader h;
+    memset(&h, 0, sizeof(h));                       // magic left zero until blocks are written
+    h.version = packVersion;
+    h.headerSize = sizeof(PackHeader);
+    h.nPoints = points.size();
+    h.nTriangles = triangles.size();
+    h.hasNormals = normals.size() == points.size();
+    h.hasUvs = uvs.size() == points.size();
+    vec3 min, max;
+    ComputeBounds(points, min, max, nThreads);
+    for (int k = 0; k < 3; k++) {
+        h.min[k] = h.nPoints? min[k] : 0;
+        h.max[k] = h.nPoints? max[k] : 0;
+    }
+    int nVertexBlocks = (h.nPoints+blockVertices-1)/blockVertices;
+    int nTriangleBlocks = (h.nTriangles+blockTriangles-1)/blockTriangles;
+    vector<Bytes> blocks(nVertexBlocks+nTriangleBlocks);
+    ParallelFor(blocks.size(), [&](int b) {
+        if (b < nVertexBlocks) {
+            int begin = b*blockVertices, n = h.nPoints-begin < blockVertices? h.nPoints-begin : blockVertices;
+            EncodeVertices(h, points, normals, uvs, begin, n, blocks[b]);
+        }
+        else {
+            int begin = (b-nVertexBlocks)*blockTriangles;
+            int n = h.nTriangles-begin < blockTriangles? h.nTriangles-begin : blockTriangles;
+            EncodeTriangles(triangles, begin, n, blocks[b]);
+        }
+    }, nThreads);
+    vector<PackBlock> table(blocks.size());
+    long long offset = sizeof(PackHeader)+table.size()*sizeof(PackBlock);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        table[b].offset = offset;
+        table[b].size = blocks[b].size();
+        offset += table[b].size;
+    }
+    FILE *out = fopen(filename, "wb");
+    if (!out) {
+        printf("can't write %s\n", filename);
+        return false;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1 &&
+              (table.empty() || fwrite(table.data(), sizeof(PackBlock), table.size(), out) == table.size());
+    for (size_t b = 0; ok && b < blocks.size(); b++)
+        ok = blocks[b].empty() || fwrite(blocks[b].data(), 1, blocks[b].size(), out) == blocks[b].size();
+    // header rewritten last, so a partial file is never mistaken for a valid one
+    memcpy(h.magic, packMagic, sizeof(packMagic));
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        printf("error writing %s\n", filename);
+        remove(filename);
+    }
+    return ok;
+}
+
+bool ReadPackedMesh(const char *filename, vector<vec3> &points, vector<vec3> &normals,
+                    vector<vec2> &uvs, vector<int3> &triangles, int nThreads) {
+    MappedFile file(filename);
+    if (!file.data || file.size < sizeof(PackHeader))
+        return false;
+    PackHeader h;
+    memcpy(&h, file.data, sizeof(h));
+    if (memcmp(h.magic, packMagic, sizeof(packMagic)) || h.version != packVersion || h.headerSize != sizeof(PackHeader) ||
+        h.nPoints < 0 || h.nTriangles < 0) {
+        printf("%s: not a packed mesh (or of another version)\n", filename);
+        return false;
+    }
+    int nVertexBlocks = (h.nPoints+blockVertices-1)/blockVertices;
+    int nTriangleBlocks = (h.nTriangles+blockTriangles-1)/blockTriangles;
+    vector<PackBlock> table(nVertexBlocks+nTriangleBlocks);
+    size_t tableEnd = sizeof(PackHeader)+table.size()*sizeof(PackBlock);
+    if (tableEnd > file.size)
+        return false;
+    if (!table.empty())
+        memcpy(table.data(), file.data+sizeof(PackHeader), table.size()*sizeof(PackBlock));
+    for (size_t b = 0; b < table.size(); b++)
+        if (table[b].offset < (long long) tableEnd || table[b].size < 0 || table[b].offset+table[b].size > (long long) file.size)
+            return false;
+    points.resize(h.nPoints);
+    normals.resize(h.hasNormals? h.nPoints : 0);
+    uvs.resize(h.hasUvs? h.nPoints : 0);
+    triangles.resize(h.nTriangles);
+    std::atomic<bool> ok(true);
+    ParallelFor(table.size(), [&](int b) {
+        Input in(file.data+table[b].offset, (size_t) table[b].size);
+        if (b < nVertexBlocks) {
+            int begin = b*blockVertices, n = h.nPoints-begin < blockVertices? h.nPoints-begin : blockVertices;
+            if (!DecodeVertices(h, in, &points[begin], h.hasNormals? &normals[begin] : NULL, h.hasUvs? &uvs[begin] : NULL, n))
+                ok = false;
+        }
+        else {
+            int begin = (b-nVertexBlocks)*blockTriangles;
+            int n = h.nTriangles-begin < blockTriangles? h.nTriangles-begin : blockTriangles;
+            if (!DecodeTriangles(in, &triangles[begin], n, h.nPoints))
+                ok = false;
+        }
+    }, nThreads);
+    if (!ok)
+        printf("%s: corrupt packed mesh\n", filename);
+    return ok;
+}
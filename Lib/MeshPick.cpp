@@ -0,0 +1,151 @@
+// MeshPick.cpp - GPU picking: mesh and triangle ids rendered offscreen, read back without stalling
+
+#include "MeshPick.h"
+#include <limits.h>
+#include <stdio.h>
+
+MeshPicker::~MeshPicker() {
+    Release();
+}
+
+bool MeshPicker::Begin(int cursorX, int cursorY, int w, int h) {
+    if (cursorX < 0 || cursorX >= w || cursorY < 0 || cursorY >= h)
+        return false;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDraw);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+    if (!framebuffer || w != width || h != height) {
+        if (!framebuffer) {
+            glGenFramebuffers(1, &framebuffer);
+            glGenRenderbuffers(1, &idBuffer);
+            glGenRenderbuffers(1, &depthBuffer);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, idBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RG32UI, w, h);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, idBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        width = w;
+        height = h;
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("MeshPicker.Begin: can't make id framebuffer\n");
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDraw);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+            Release();
+            return false;
+        }
+    }
+    else
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    glGetIntegerv(GL_SCISSOR_BOX, previousScissor);
+    previousScissorTest = glIsEnabled(GL_SCISSOR_TEST);
+    previousDepthTest = glIsEnabled(GL_DEPTH_TEST);
+    // clear and draw only the region read back
+    Readback &r = region;
+    r.cx = cursorX;
+    r.cy = cursorY;
+    r.x = cursorX-radius > 0? cursorX-radius : 0;
+    r.y = cursorY-radius > 0? cursorY-radius : 0;
+    r.w = (cursorX+radius < w? cursorX+radius+1 : w)-r.x;
+    r.h = (cursorY+radius < h? cursorY+radius+1 : h)-r.y;
+    glViewport(0, 0, w, h);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(r.x, r.y, r.w, r.h);
+    GLuint none[4] = {0, 0, 0, 0};
+    GLfloat farthest = 1;
+    glClearBufferuiv(GL_COLOR, 0, none);
+    glClearBufferfv(GL_DEPTH, 0, &farthest);
+    glEnable(GL_DEPTH_TEST);
+    return true;
+}
+
+void MeshPicker::End() {
+    // copy the region to a pixel buffer, with a fence to tell when it's done, then restore state
+    Readback &r = readbacks[serial%pickBuffers];
+    if (!r.buffer)
+        glGenBuffers(1, &r.buffer);
+    if (r.fence)
+        glDeleteSync(r.fence);
+    GLuint buffer = r.buffer;
+    r = region;
+    r.buffer = buffer;
+    r.serial = ++serial;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (size_t) r.w*r.h*2*sizeof(GLuint), NULL, GL_STREAM_READ);
+    glReadPixels(r.x, r.y, r.w, r.h, GL_RG_INTEGER, GL_UNSIGNED_INT, (void *) 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDraw);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    glScissor(previousScissor[0], previousScissor[1], previousScissor[2], previousScissor[3]);
+    if (!previousScissorTest)
+        glDisable(GL_SCISSOR_TEST);
+    if (!previousDepthTest)
+        glDisable(GL_DEPTH_TEST);
+}
+
+bool MeshPicker::Poll(PickHit &hit) {
+    // the newest finished readback supersedes any older
+    Readback *done = NULL;
+    for (int i = 0; i < pickBuffers; i++) {
+        Readback &r = readbacks[i];
+        if (!r.fence)
+            continue;
+        GLenum status = glClientWaitSync(r.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if ((status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) && (!done || r.serial > done->serial))
+            done = &r;
+    }
+    if (!done)
+        return false;
+    for (int i = 0; i < pickBuffers; i++)
+        if (readbacks[i].fence && readbacks[i].serial <= done->serial) {
+            glDeleteSync(readbacks[i].fence);
+            readbacks[i].fence = 0;
+        }
+    hit = PickHit();
+    hit.x = done->cx;
+    hit.y = done->cy;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, done->buffer);
+    size_t size = (size_t) done->w*done->h*2*sizeof(GLuint);
+    const GLuint *ids = (const GLuint *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (ids) {
+        int nearest = INT_MAX;
+        for (int j = 0; j < done->h; j++)
+            for (int i = 0; i < done->w; i++) {
+                const GLuint *id = ids+2*(j*done->w+i);
+                int px = done->x+i, py = done->y+j, dx = px-done->cx, dy = py-done->cy;
+                if (id[0] && dx*dx+dy*dy < nearest) {
+                    nearest = dx*dx+dy*dy;
+                    hit.mesh = id[0]-1;
+                    hit.triangle = id[1];
+                    hit.x = px;
+                    hit.y = py;
+                }
+            }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+
+void MeshPicker::Release() {
+    for (int i = 0; i < pickBuffers; i++) {
+        Readback &r = readbacks[i];
+        if (r.fence)
+            glDeleteSync(r.fence);
+        if (r.buffer)
+            glDeleteBuffers(1, &r.buffer);
+        r = Readback();
+    }
+    if (framebuffer) {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &idBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+    }
+    framebuffer = idBuffer = depthBuffer = 0;
+    width = height = 0;
+}
@@ -0,0 +1,691 @@
+// MeshProcess.cpp - parallel operations over mesh arrays
+
+#include "MeshProcess.h"
+#include "Parallel.h"
+#include <float.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(MESH_SSE2) && defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Bounds and Normalization
+
+namespace {
+
+const int fitGrain = 1 << 16;               // points per task
+
+inline const float *PointAt(const float *xyz, size_t stride, int i) {
+    return (const float *) ((const char *) xyz+stride*i);
+}
+
+void BoundsRange(const float *xyz, size_t stride, int begin, int end, float *min, float *max) {
+    // widen min[3], max[3] by points begin to end
+    int i = begin;
+#ifdef MESH_SSE2
+    if (stride == 3*sizeof(float) && end-begin >= 8) {
+        // consecutive registers hold x y z x y z ..., so the lane at float offset e of a block holds axis e%3
+        const float *p = xyz+3*(size_t) begin;
+        float lanes[2][24];
+  #ifdef __AVX__
+        const int width = 8;
+        __m256 lo[3], hi[3];
+        for (int r = 0; r < 3; r++) {
+            lo[r] = _mm256_set1_ps(FLT_MAX);
+            hi[r] = _mm256_set1_ps(-FLT_MAX);
+        }
+        for (; i+width <= end; i += width, p += 3*width)
+            for (int r = 0; r < 3; r++) {
+                __m256 v = _mm256_loadu_ps(p+r*width);
+                lo[r] = _mm256_min_ps(v, lo[r]);    // v first, so a NaN in v keeps the running value
+                hi[r] = _mm256_max_ps(v, hi[r]);
+            }
+        for (int r = 0; r < 3; r++) {
+            _mm256_storeu_ps(lanes[0]+r*width, lo[r]);
+            _mm256_storeu_ps(lanes[1]+r*width, hi[r]);
+        }
+  #else
+        const int width = 4;
+        __m128 lo[3], hi[3];
+        for (int r = 0; r < 3; r++) {
+            lo[r] = _mm_set1_ps(FLT_MAX);
+            hi[r] = _mm_set1_ps(-FLT_MAX);
+        }
+        for (; i+width <= end; i += width, p += 3*width)
+            for (int r = 0; r < 3; r++) {
+                __m128 v = _mm_loadu_ps(p+r*width);
+                lo[r] = _mm_min_ps(v, lo[r]);
+                hi[r] = _mm_max_ps(v, hi[r]);
+            }
+        for (int r = 0; r < 3; r++) {
+            _mm_storeu_ps(lanes[0]+r*width, lo[r]);
+            _mm_storeu_ps(lanes[1]+r*width, hi[r]);
+        }
+  #endif
+        for (int e = 0; e < 3*width; e++) {
+            min[e%3] = lanes[0][e] < min[e%3]? lanes[0][e] : min[e%3];
+            max[e%3] = lanes[1][e] > max[e%3]? lanes[1][e] : max[e%3];
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        const float *p = PointAt(xyz, stride, i);
+        for (int k = 0; k < 3; k++) {
+            min[k] = p[k] < min[k]? p[k] : min[k];
+            max[k] = p[k] > max[k]? p[k] : max[k];
+        }
+    }
+}
+
+inline unsigned short QuantizeUnit(float f, float k) {
+    // f*k in -32767.5,+32767.5 to 0,65535, rounding as cvtps does
+    long q = lrintf(f*k-.5f);
+    return (unsigned short) ((q < -32768? -32768 : q > 32767? 32767 : q)+32768);
+}
+
+void FitRange(float *xyz, size_t stride, int begin, int end, vec3 center, float s, float k, unsigned short *quantized) {
+    // points begin to end become s*(p-center); quantized (if non-null) gets QuantizeUnit of each coordinate
+    int i = begin;
+#ifdef MESH_SSE2
+    if (stride == 3*sizeof(float)) {
+        // four points per iteration in three registers; center repeats with period three across them
+        float *p = xyz+3*(size_t) begin;
+        unsigned short *q = quantized? quantized+3*(size_t) begin : NULL;
+        __m128 c[3] = {_mm_setr_ps(center.x, center.y, center.z, center.x),
+                       _mm_setr_ps(center.y, center.z, center.x, center.y),
+                       _mm_setr_ps(center.z, center.x, center.y, center.z)};
+        __m128 scale = _mm_set1_ps(s), qScale = _mm_set1_ps(k), half = _mm_set1_ps(.5f);
+        __m128i flip = _mm_set1_epi16((short) 0x8000);
+        for (; i+4 <= end; i += 4, p += 12) {
+            __m128 v[3];
+            for (int r = 0; r < 3; r++) {
+                v[r] = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p+4*r), c[r]), scale);
+                _mm_storeu_ps(p+4*r, v[r]);
+            }
+            if (q) {
+                // signed saturating pack, then offset to unsigned by flipping the sign bit
+                __m128i n0 = _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(v[0], qScale), half));
+                __m128i n1 = _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(v[1], qScale), half));
+                __m128i n2 = _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(v[2], qScale), half));
+                _mm_storeu_si128((__m128i *) q, _mm_xor_si128(_mm_packs_epi32(n0, n1), flip));
+                _mm_storel_epi64((__m128i *) (q+8), _mm_xor_si128(_mm_packs_epi32(n2, n2), flip));
+                q += 12;
+            }
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        float *p = (float *) PointAt(xyz, stride, i);
+        for (int k3 = 0; k3 < 3; k3++) {
+            p[k3] = (p[k3]-center[k3])*s;
+            if (quantized)
+                quantized[3*(size_t) i+k3] = QuantizeUnit(p[k3], k);
+        }
+    }
+}
+
+int FitTasks(int count, int nThreads) {
+    int nTasks = (count+fitGrain-1)/fitGrain;
+    return nTasks < 4*nThreads? nTasks : 4*nThreads;
+}
+
+} // end namespace
+
+void ComputeBounds(const float *xyz, int count, size_t stride, vec3 &min, vec3 &max, int nThreads) {
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    int nTasks = FitTasks(count, nThreads);
+    vector<vec3> mins(nTasks, vec3(FLT_MAX, FLT_MAX, FLT_MAX)), maxs(nTasks, vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+    ParallelFor(nTasks, [&](int t) {
+        int begin = (int) ((long long) count*t/nTasks), end = (int) ((long long) count*(t+1)/nTasks);
+        BoundsRange(xyz, stride, begin, end, &mins[t].x, &maxs[t].x);
+    }, nThreads);
+    min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int t = 0; t < nTasks; t++)
+        for (int k = 0; k < 3; k++) {
+            min[k] = mins[t][k] < min[k]? mins[t][k] : min[k];
+            max[k] = maxs[t][k] > max[k]? maxs[t][k] : max[k];
+        }
+}
+
+void ComputeBounds(vector<vec3> &points, vec3 &min, vec3 &max, int nThreads) {
+    ComputeBounds(points.size()? &points[0].x : NULL, points.size(), sizeof(vec3), min, max, nThreads);
+}
+
+UnitFit FitToUnit(float *xyz, int count, size_t stride, float fitScale, unsigned short *quantized, int nThreads) {
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    UnitFit fit;
+    ComputeBounds(xyz, count, stride, fit.min, fit.max, nThreads);
+    if (!count)
+        return fit;
+    fit.center = .5f*(fit.min+fit.max);
+    float maxRange = 0;
+    for (int k = 0; k < 3; k++)
+        maxRange = fit.max[k]-fit.min[k] > maxRange? fit.max[k]-fit.min[k] : maxRange;
+    fit.scale = maxRange > 0? fitScale*2.f/maxRange : 1;
+    float k = fitScale > 0? 32767.5f/fitScale : 0;
+    int nTasks = FitTasks(count, nThreads);
+    ParallelFor(nTasks, [&](int t) {
+        int begin = (int) ((long long) count*t/nTasks), end = (int) ((long long) count*(t+1)/nTasks);
+        FitRange(xyz, stride, begin, end, fit.center, fit.scale, k, quantized);
+    }, nThreads);
+    return fit;
+}
+
+UnitFit FitToUnit(vector<vec3> &points, float fitScale, unsigned short *quantized, int nThreads) {
+    return FitToUnit(points.size()? &points[0].x : NULL, points.size(), sizeof(vec3), fitScale, quantized, nThreads);
+}
+
+// Structure-of-Arrays Points
+
+void ToSoA(vector<vec3> &points, PointsSoA &soa, int nThreads) {
+    int n = points.size();
+    soa.x.resize(n);
+    soa.y.resize(n);
+    soa.z.resize(n);
+    ParallelRange(n, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            soa.x[i] = points[i].x;
+            soa.y[i] = points[i].y;
+            soa.z[i] = points[i].z;
+        }
+    }, fitGrain, nThreads);
+}
+
+void FromSoA(PointsSoA &soa, vector<vec3> &points, int nThreads) {
+    int n = soa.Size();
+    points.resize(n);
+    ParallelRange(n, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            points[i] = vec3(soa.x[i], soa.y[i], soa.z[i]);
+    }, fitGrain, nThreads);
+}
+
+void ComputeBounds(PointsSoA &soa, vec3 &min, vec3 &max, int nThreads) {
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    int count = soa.Size(), nTasks = FitTasks(count, nThreads);
+    float *axes[] = {soa.x.data(), soa.y.data(), soa.z.data()};
+    vector<vec3> mins(nTasks, vec3(FLT_MAX, FLT_MAX, FLT_MAX)), maxs(nTasks, vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+    ParallelFor(nTasks, [&](int t) {
+        int begin = (int) ((long long) count*t/nTasks), end = (int) ((long long) count*(t+1)/nTasks);
+        for (int k = 0; k < 3; k++) {
+            const float *a = axes[k];
+            float lo = FLT_MAX, hi = -FLT_MAX;
+            int i = begin;
+#ifdef MESH_SSE2
+            __m128 vLo = _mm_set1_ps(FLT_MAX), vHi = _mm_set1_ps(-FLT_MAX);
+            for (; i+4 <= end; i += 4) {
+                __m128 v = _mm_loadu_ps(a+i);
+                vLo = _mm_min_ps(v, vLo);
+                vHi = _mm_max_ps(v, vHi);
+            }
+            float lanes[2][4];
+            _mm_storeu_ps(lanes[0], vLo);
+            _mm_storeu_ps(lanes[1], vHi);
+            for (int j = 0; j < 4; j++) {
+                lo = lanes[0][j] < lo? lanes[0][j] : lo;
+                hi = lanes[1][j] > hi? lanes[1][j] : hi;
+            }
+#endif
+            for (; i < end; i++) {
+                lo = a[i] < lo? a[i] : lo;
+                hi = a[i] > hi? a[i] : hi;
+            }
+            mins[t][k] = lo;
+            maxs[t][k] = hi;
+        }
+    }, nThreads);
+    min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int t = 0; t < nTasks; t++)
+        for (int k = 0; k < 3; k++) {
+            min[k] = mins[t][k] < min[k]? mins[t][k] : min[k];
+            max[k] = maxs[t][k] > max[k]? maxs[t][k] : max[k];
+        }
+}
+
+void TransformPoints(mat4 &m, vector<vec3> &points, int nThreads) {
+    ParallelRange(points.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec3 p = points[i];
+            for (int k = 0; k < 3; k++)
+                points[i][k] = m[k].x*p.x+m[k].y*p.y+(m[k].z*p.z+m[k].w);   // grouped as the SoA version
+        }
+    }, fitGrain, nThreads);
+}
+
+void TransformPoints(mat4 &m, PointsSoA &soa, int nThreads) {
+    ParallelRange(soa.Size(), [&](int begin, int end) {
+        float *x = soa.x.data(), *y = soa.y.data(), *z = soa.z.data();
+        int i = begin;
+#ifdef MESH_SSE2
+        // four points per iteration, each matrix element broadcast across lanes
+        __m128 r[3][4];
+        for (int k = 0; k < 3; k++)
+            for (int j = 0; j < 4; j++)
+                r[k][j] = _mm_set1_ps(m[k][j]);
+        for (; i+4 <= end; i += 4) {
+            __m128 px = _mm_loadu_ps(x+i), py = _mm_loadu_ps(y+i), pz = _mm_loadu_ps(z+i), out[3];
+            for (int k = 0; k < 3; k++)
+                out[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[k][0], px), _mm_mul_ps(r[k][1], py)),
+                                    _mm_add_ps(_mm_mul_ps(r[k][2], pz), r[k][3]));
+            _mm_storeu_ps(x+i, out[0]);
+            _mm_storeu_ps(y+i, out[1]);
+            _mm_storeu_ps(z+i, out[2]);
+        }
+#endif
+        for (; i < end; i++) {
+            float px = x[i], py = y[i], pz = z[i];
+            x[i] = m[0].x*px+m[0].y*py+(m[0].z*pz+m[0].w);
+            y[i] = m[1].x*px+m[1].y*py+(m[1].z*pz+m[1].w);
+            z[i] = m[2].x*px+m[2].y*py+(m[2].z*pz+m[2].w);
+        }
+    }, fitGrain, nThreads);
+}
+
+// Interleaved Vertices
+
+void InterleaveVertices(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
+                        int first, int count, float *out, int nThreads) {
+    ParallelRange(count, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            float *o = out+(size_t) interleavedFloats*i;
+            vec3 &p = points[first+i], &n = normals[first+i];
+            vec2 &t = uvs[first+i];
+            o[0] = p.x; o[1] = p.y; o[2] = p.z;
+            o[3] = n.x; o[4] = n.y; o[5] = n.z;
+            o[6] = t.x; o[7] = t.y;
+        }
+    }, fitGrain, nThreads);
+}
+
+// Vertex Normals
+
+namespace {
+
+// face normals are computed a batch of triangles at a time, into separate arrays per component: each
+// corner's points are loaded and transposed so 8 (AVX) or 4 (SSE2) triangles are done per instruction;
+// any remainder is done one at a time by the same operations, so results don't depend on lanes
+
+const int faceBatch = 64;                   // triangles per batch
+
+struct FaceBatch {
+    float n[3][faceBatch];                  // weighted normal of each triangle
+    float w[3][faceBatch];                  // weight of each corner: its angle, or 1
+};
+
+inline float Splat(float f, float) { return f; }
+inline float Add(float a, float b) { return a+b; }
+inline float Sub(float a, float b) { return a-b; }
+inline float Mul(float a, float b) { return a*b; }
+inline float Div(float a, float b) { return a/b; }
+inline float Min(float a, float b) { return a < b? a : b; }
+inline float Max(float a, float b) { return a > b? a : b; }
+inline float Abs(float a) { return fabsf(a); }
+inline bool Lt(float a, float b) { return a < b; }
+inline float Select(bool m, float a, float b) { return m? a : b; }
+
+#ifdef MESH_SSE2
+inline __m128 Point(vec3 &v) {
+    // x, y, z, 0 (without reading past z)
+    return _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *) &v.x), _mm_load_ss(&v.z));
+}
+inline void Gather4(vector<vec3> &points, const int3 *triangles, int k, __m128 xyz[3]) {
+    // corner k of 4 triangles, transposed to x, y, z lanes
+    __m128 a = Point(points[triangles[0][k]]), b = Point(points[triangles[1][k]]);
+    __m128 c = Point(points[triangles[2][k]]), d = Point(points[triangles[3][k]]);
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    xyz[0] = a;
+    xyz[1] = b;
+    xyz[2] = c;
+}
+#ifdef __AVX__
+const int nLanes = 8;
+typedef __m256 Floats;
+inline void Gather(vector<vec3> &points, const int3 *triangles, int k, Floats xyz[3]) {
+    __m128 lo[3], hi[3];
+    Gather4(points, triangles, k, lo);
+    Gather4(points, triangles+4, k, hi);
+    for (int i = 0; i < 3; i++)
+        xyz[i] = _mm256_insertf128_ps(_mm256_castps128_ps256(lo[i]), hi[i], 1);
+}
+inline void Store(float *p, Floats a) { _mm256_storeu_ps(p, a); }
+inline Floats Splat(float f, Floats) { return _mm256_set1_ps(f); }
+inline Floats Add(Floats a, Floats b) { return _mm256_add_ps(a, b); }
+inline Floats Sub(Floats a, Floats b) { return _mm256_sub_ps(a, b); }
+inline Floats Mul(Floats a, Floats b) { return _mm256_mul_ps(a, b); }
+inline Floats Div(Floats a, Floats b) { return _mm256_div_ps(a, b); }
+inline Floats Min(Floats a, Floats b) { return _mm256_min_ps(a, b); }
+inline Floats Max(Floats a, Floats b) { return _mm256_max_ps(a, b); }
+inline Floats Abs(Floats a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+inline Floats Sqrt(Floats a) { return _mm256_sqrt_ps(a); }
+inline Floats Lt(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Floats Le(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline Floats Select(Floats m, Floats a, Floats b) { return _mm256_blendv_ps(b, a, m); }
+#else
+const int nLanes = 4;
+typedef __m128 Floats;
+inline void Gather(vector<vec3> &points, const int3 *triangles, int k, Floats xyz[3]) {
+    Gather4(points, triangles, k, xyz);
+}
+inline void Store(float *p, Floats a) { _mm_storeu_ps(p, a); }
+inline Floats Splat(float f, Floats) { return _mm_set1_ps(f); }
+inline Floats Add(Floats a, Floats b) { return _mm_add_ps(a, b); }
+inline Floats Sub(Floats a, Floats b) { return _mm_sub_ps(a, b); }
+inline Floats Mul(Floats a, Floats b) { return _mm_mul_ps(a, b); }
+inline Floats Div(Floats a, Floats b) { return _mm_div_ps(a, b); }
+inline Floats Min(Floats a, Floats b) { return _mm_min_ps(a, b); }
+inline Floats Max(Floats a, Floats b) { return _mm_max_ps(a, b); }
+inline Floats Abs(Floats a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+inline Floats Sqrt(Floats a) { return _mm_sqrt_ps(a); }
+inline Floats Lt(Floats a, Floats b) { return _mm_cmplt_ps(a, b); }
+inline Floats Le(Floats a, Floats b) { return _mm_cmple_ps(a, b); }
+inline Floats Select(Floats m, Floats a, Floats b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+#endif
+#endif
+
+template<class F>
+inline F Angle(F y, F x) {
+    // atan2(y, x) for y >= 0: reduce to atan(a), 0 <= a <= 1, then Cephes' atanf polynomial
+    // (within 3 ulp of atan2f)
+    F ax = Abs(x), zero = Splat(0, x), one = Splat(1, x);
+    F a = Div(Min(ax, y), Max(Max(ax, y), Splat(FLT_MIN, x)));
+    auto big = Lt(Splat(.414213562f, x), a);            // beyond tan(pi/8): use atan(a) = pi/4+atan((a-1)/(a+1))
+    a = Select(big, Div(Sub(a, one), Add(a, one)), a);
+    F z = Mul(a, a), p = Splat(8.05374449538e-2f, x);
+    p = Add(Mul(p, z), Splat(-1.38776856032e-1f, x));
+    p = Add(Mul(p, z), Splat(1.99777106478e-1f, x));
+    p = Add(Mul(p, z), Splat(-3.33329491539e-1f, x));
+    F r = Add(Select(big, Splat(.785398163f, x), zero), Add(Mul(Mul(p, z), a), a));
+    r = Select(Lt(ax, y), Sub(Splat(1.57079633f, x), r), r);
+    return Select(Lt(x, zero), Sub(Splat(3.14159265f, x), r), r);
+}
+
+void FaceNormal(vector<vec3> &points, const int3 &t, NormalWeight weight, FaceBatch &b, int i) {
+    // weighted normal and corner weights of triangle i of a batch
+    vec3 &p1 = points[t.i1], &p2 = points[t.i2], &p3 = points[t.i3];
+    vec3 e1(p2-p1), e2(p3-p2), e3(p1-p3), n(cross(e1, e2));
+    float len = sqrtf(n.x*n.x+n.y*n.y+n.z*n.z);
+    // cross product length is twice the area; area weighting keeps it, others divide it out
+    n *= len <= 0? 0 : weight == WeightArea? .5f : 1/len;
+    for (int k = 0; k < 3; k++)
+        b.n[k][i] = n[k];
+    if (weight == WeightAngle) {
+        // angle from |e x f| (= len for every corner) and e.f
+        b.w[0][i] = Angle(len, -dot(e3, e1));
+        b.w[1][i] = Angle(len, -dot(e1, e2));
+        b.w[2][i] = Angle(len, -dot(e2, e3));
+    }
+    else
+        b.w[0][i] = b.w[1][i] = b.w[2][i] = 1;
+}
+
+#ifdef MESH_SSE2
+void FaceLanes(vector<vec3> &points, const int3 *triangles, int i, NormalWeight weight, FaceBatch &b) {
+    // as FaceNormal, for triangles i, i+1, ... of a batch, one per lane
+    typedef Floats F;
+    F c[9], zero = Splat(0, F());
+    for (int k = 0; k < 3; k++)
+        Gather(points, triangles+i, k, c+3*k);
+    F e1[3], e2[3], e3[3];
+    for (int k = 0; k < 3; k++) {
+        e1[k] = Sub(c[3+k], c[k]);
+        e2[k] = Sub(c[6+k], c[3+k]);
+        e3[k] = Sub(c[k], c[6+k]);
+    }
+    F n[3] = {Sub(Mul(e1[1], e2[2]), Mul(e1[2], e2[1])),
+              Sub(Mul(e1[2], e2[0]), Mul(e1[0], e2[2])),
+              Sub(Mul(e1[0], e2[1]), Mul(e1[1], e2[0]))};
+    F len = Sqrt(Add(Add(Mul(n[0], n[0]), Mul(n[1], n[1])), Mul(n[2], n[2])));
+    // cross product length is twice the area; area weighting keeps it, others divide it out
+    F scale = weight == WeightArea? Splat(.5f, zero) : Div(Splat(1, zero), len);
+    scale = Select(Le(len, zero), zero, scale);
+    for (int k = 0; k < 3; k++)
+        Store(b.n[k]+i, Mul(n[k], scale));
+    if (weight == WeightAngle) {
+        // angle from |e x f| (= len for every corner) and e.f
+        F *edges[] = {e3, e1, e2, e3};
+        for (int k = 0; k < 3; k++) {
+            F *e = edges[k], *f = edges[k+1];
+            F d = Add(Add(Mul(e[0], f[0]), Mul(e[1], f[1])), Mul(e[2], f[2]));
+            Store(b.w[k]+i, Angle(len, Sub(zero, d)));
+        }
+    }
+    else
+        for (int k = 0; k < 3; k++)
+            Store(b.w[k]+i, Splat(1, zero));
+}
+#endif
+
+void FaceNormals(vector<vec3> &points, const int3 *triangles, int count, NormalWeight weight, FaceBatch &b) {
+    // set b for count (at most faceBatch) consecutive triangles
+    int i = 0;
+#ifdef MESH_SSE2
+    for (; i+nLanes <= count; i += nLanes)
+        FaceLanes(points, triangles, i, weight, b);
+#endif
+    for (; i < count; i++)
+        FaceNormal(points, triangles[i], weight, b, i);
+}
+
+void Accumulate(vector<vec3> &points, vector<int3> &triangles, int begin, int end, NormalWeight weight,
+                vec3 *sums, int firstVertex) {
+    // add contributions of triangles begin to end to sums, which begin at vertex firstVertex
+    FaceBatch b;
+    for (int first = begin; first < end; first += faceBatch) {
+        int count = end-first < faceBatch? end-first : faceBatch;
+        FaceNormals(points, &triangles[first], count, weight, b);
+        for (int i = 0; i < count; i++) {
+            int3 &t = triangles[first+i];
+            vec3 n(b.n[0][i], b.n[1][i], b.n[2][i]);
+            for (int k = 0; k < 3; k++)
+                sums[t[k]-firstVertex] += b.w[k][i]*n;
+        }
+    }
+}
+
+inline void UnitOrZ(vec3 &n) {
+    float len = sqrtf(n.x*n.x+n.y*n.y+n.z*n.z);
+    n = len > 0? n/len : vec3(0, 0, 1);
+}
+
+} // end namespace
+
+void ComputeVertexNormals(vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals,
+                          NormalWeight weight, int nThreads) {
+    // triangles are split into tasks; a task's sums go to a private array spanning the vertex ids
+    // it uses, and each vertex range then adds the few spans covering it (vertex ids of nearby
+    // triangles are usually close); if spans overlap heavily, corners are instead bucketed by
+    // vertex range and each range sums its own buckets
+    if (nThreads <= 0)
+        nThreads = NumThreads();
+    int nPoints = points.size(), nTriangles = triangles.size();
+    normals.assign(nPoints, vec3(0, 0, 0));
+    if (nThreads == 1 || nTriangles < 1 << 16) {
+        if (nTriangles)
+            Accumulate(points, triangles, 0, nTriangles, weight, &normals[0], 0);
+        for (int v = 0; v < nPoints; v++)
+            UnitOrZ(normals[v]);
+        return;
+    }
+    int nTasks = 4*nThreads, nRanges = nTasks, rangeSize = (nPoints+nRanges-1)/nRanges;
+    auto taskBegin = [&](int task) { return (int) ((long long) nTriangles*task/nTasks); };
+    vector<int2> spans(nTasks);                         // min, max vertex id of each task
+    ParallelFor(nTasks, [&](int task) {
+        int lo = nPoints, hi = -1;
+        for (int t = taskBegin(task); t < taskBegin(task+1); t++)
+            for (int k = 0; k < 3; k++) {
+                int v = triangles[t][k];
+                lo = v < lo? v : lo;
+                hi = v > hi? v : hi;
+            }
+        spans[task] = int2(lo, hi);
+    }, nThreads);
+    long long spanTotal = 0;
+    for (int task = 0; task < nTasks; task++)
+        spanTotal += spans[task].i2-spans[task].i1+1;
+    if (spanTotal <= 3LL*nPoints) {
+        vector<vector<vec3>> sums(nTasks);
+        ParallelFor(nTasks, [&](int task) {
+            int2 span = spans[task];
+            if (span.i2 < span.i1)
+                return;
+            sums[task].assign(span.i2-span.i1+1, vec3(0, 0, 0));
+            Accumulate(points, triangles, taskBegin(task), taskBegin(task+1), weight, &sums[task][0], span.i1);
+        }, nThreads);
+        ParallelFor(nRanges, [&](int r) {
+            int vBegin = r*rangeSize, vEnd = vBegin+rangeSize < nPoints? vBegin+rangeSize : nPoints;
+            for (int task = 0; task < nTasks; task++) {
+                int2 span = spans[task];
+                int b = span.i1 > vBegin? span.i1 : vBegin, e = span.i2+1 < vEnd? span.i2+1 : vEnd;
+                for (int v = b; v < e; v++)
+                    normals[v] += sums[task][v-span.i1];
+            }
+            for (int v = vBegin; v < vEnd; v++)
+                UnitOrZ(normals[v]);
+        }, nThreads);
+        return;
+    }
+    // face normals and weights, once for the three corners
+    int nBatches = (nTriangles+faceBatch-1)/faceBatch;
+    vector<FaceBatch> faces(nBatches);
+    ParallelRange(nBatches, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            int first = i*faceBatch;
+            FaceNormals(points, &triangles[first], nTriangles-first < faceBatch? nTriangles-first : faceBatch, weight, faces[i]);
+        }
+    }, 64, nThreads);
+    // count corners per (task, range), prefix sum (buckets ordered by range, then task), scatter corner ids
+    vector<int> counts((size_t) nTasks*nRanges, 0);
+    ParallelFor(nTasks, [&](int task) {
+        int *count = &counts[(size_t) task*nRanges];
+        for (int t = taskBegin(task); t < taskBegin(task+1); t++)
+            for (int k = 0; k < 3; k++)
+                count[triangles[t][k]/rangeSize]++;
+    }, nThreads);
+    vector<size_t> offsets(counts.size()+1);
+    size_t total = 0;
+    for (int r = 0; r < nRanges; r++)
+        for (int task = 0; task < nTasks; task++) {
+            offsets[(size_t) task*nRanges+r] = total;
+            total += counts[(size_t) task*nRanges+r];
+        }
+    vector<int> corners(total);                         // 3*triangle+corner
+    ParallelFor(nTasks, [&](int task) {
+        vector<size_t> next(&offsets[(size_t) task*nRanges], &offsets[(size_t) task*nRanges]+nRanges);
+        for (int t = taskBegin(task); t < taskBegin(task+1); t++)
+            for (int k = 0; k < 3; k++)
+                corners[next[triangles[t][k]/rangeSize]++] = 3*t+k;
+    }, nThreads);
+    ParallelFor(nRanges, [&](int r) {
+        // range r's buckets are contiguous, from task 0's bucket r to task 0's bucket r+1
+        int vBegin = r*rangeSize, vEnd = vBegin+rangeSize < nPoints? vBegin+rangeSize : nPoints;
+        size_t cEnd = r+1 < nRanges? offsets[r+1] : total;
+        for (size_t c = offsets[r]; c < cEnd; c++) {
+            int t = corners[c]/3, k = corners[c]%3, i = t%faceBatch;
+            FaceBatch &b = faces[t/faceBatch];
+            normals[triangles[t][k]] += b.w[k][i]*vec3(b.n[0][i], b.n[1][i], b.n[2][i]);
+        }
+        for (int v = vBegin; v < vEnd; v++)
+            UnitOrZ(normals[v]);
+    }, nThreads);
+}
+
+// Tangents
+
+int ComputeTangents(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                    vector<vec4> &tangents, int nThreads) {
+    int nPoints = points.size(), nTriangles = triangles.size();
+    tangents.clear();
+    if (normals.size() != points.size() || uvs.size() != points.size())
+        return -1;
+    // per triangle: unit dP/du and dP/dv, area, and the handedness at each corner (0 if uvs degenerate)
+    vector<vec3> faceU(nTriangles), faceV(nTriangles);
+    vector<float> areas(nTriangles);
+    vector<signed char> hands(3*(size_t) nTriangles);
+    ParallelRange(nTriangles, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            int3 &tri = triangles[t];
+            vec3 e1 = points[tri.i2]-points[tri.i1], e2 = points[tri.i3]-points[tri.i1];
+            vec2 d1 = uvs[tri.i2]-uvs[tri.i1], d2 = uvs[tri.i3]-uvs[tri.i1];
+            float det = d1.x*d2.y-d2.x*d1.y;
+            vec3 u = e1*d2.y-e2*d1.y, v = e2*d1.x-e1*d2.x;
+            float lu = length(u), lv = length(v);
+            bool valid = det != 0 && lu > 0 && lv > 0;
+            faceU[t] = valid? u/(det < 0? -lu : lu) : vec3(0, 0, 0);
+            faceV[t] = valid? v/(det < 0? -lv : lv) : vec3(0, 0, 0);
+            areas[t] = valid? length(cross(e1, e2)) : 0;
+            for (int k = 0; k < 3; k++)
+                hands[3*t+k] = !valid? 0 : dot(cross(normals[tri[k]], faceU[t]), faceV[t]) < 0? -1 : 1;
+        }
+    }, 1 << 14, nThreads);
+    // corners around each vertex
+    vector<int> offsets(nPoints+1, 0), corners(3*(size_t) nTriangles);
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            offsets[triangles[t][k]+1]++;
+    for (int v = 0; v < nPoints; v++)
+        offsets[v+1] += offsets[v];
+    {
+        vector<int> next(offsets.begin(), offsets.end()-1);
+        for (int t = 0; t < nTriangles; t++)
+            for (int k = 0; k < 3; k++)
+                corners[next[triangles[t][k]]++] = 3*t+k;
+    }
+    // split vertices with corners of both handednesses
+    vector<char> mixed(nPoints, 0);
+    ParallelRange(nPoints, [&](int begin, int end) {
+        for (int v = begin; v < end; v++) {
+            int signs = 0;
+            for (int i = offsets[v]; i < offsets[v+1]; i++)
+                signs |= hands[corners[i]] < 0? 2 : hands[corners[i]] > 0? 1 : 0;
+            mixed[v] = signs == 3;
+        }
+    }, 1 << 14, nThreads);
+    vector<int> copyOf(nPoints, -1);
+    for (int v = 0; v < nPoints; v++)
+        if (mixed[v]) {
+            copyOf[v] = points.size();
+            points.push_back(points[v]);
+            normals.push_back(normals[v]);
+            uvs.push_back(uvs[v]);
+        }
+    int nAdded = points.size()-nPoints;
+    // sum each vertex's corners (negative ones to its copy, if split), then orthogonalize
+    tangents.resize(points.size());
+    ParallelRange(nPoints, [&](int begin, int end) {
+        for (int v = begin; v < end; v++)
+            for (int side = 0; side < (mixed[v]? 2 : 1); side++) {
+                int w = side? copyOf[v] : v;
+                vec3 u, dv, &n = normals[v];
+                for (int i = offsets[v]; i < offsets[v+1]; i++) {
+                    int c = corners[i], t = c/3;
+                    if (side? hands[c] > 0 : mixed[v] && hands[c] < 0)
+                        continue;
+                    u += areas[t]*faceU[t];
+                    dv += areas[t]*faceV[t];
+                }
+                u -= dot(u, n)*n;
+                float len = length(u);
+                if (len <= 0) {
+                    // any direction orthogonal to the normal
+                    u = cross(n, fabs(n.x) < .9f? vec3(1, 0, 0) : vec3(0, 1, 0));
+                    len = length(u);
+                }
+                u = len > 0? u/len : vec3(1, 0, 0);
+                tangents[w] = vec4(u.x, u.y, u.z, dot(cross(n, u), dv) < 0? -1.f : 1.f);
+            }
+    }, 1 << 14, nThreads);
+    for (int t = 0; t < nTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            if (mixed[triangles[t][k]] && hands[3*t+k] < 0)
+                triangles[t][k] = copyOf[triangles[t][k]];
+    return nAdded;
+}
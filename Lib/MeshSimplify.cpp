@@ -0,0 +1,526 @@
+// MeshSimplify.cpp - quadric error mesh simplification and detail levels
+
+#include "MeshProcess.h"
+#include "MeshSimplify.h"
+#include "Parallel.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+const int cellTriangles = 1 << 16;          // triangles per cell, if nCells is 0
+const int minCellTriangles = 1 << 12;       // below this many per cell, only the serial pass runs
+const float borderWeight = 10;              // border plane weight, relative to squared edge length
+
+struct Quadric {
+    // sum of w*(n.p+d)^2 over planes (n, d) of weight w, as the upper half of a symmetric 4x4 matrix,
+    // and the sum of face weights (areas)
+    float xx = 0, xy = 0, xz = 0, xd = 0, yy = 0, yz = 0, yd = 0, zz = 0, zd = 0, dd = 0, weight = 0;
+    void AddPlane(vec3 n, float d, float w) {
+        xx += w*n.x*n.x; xy += w*n.x*n.y; xz += w*n.x*n.z; xd += w*n.x*d;
+        yy += w*n.y*n.y; yz += w*n.y*n.z; yd += w*n.y*d;
+        zz += w*n.z*n.z; zd += w*n.z*d;
+        dd += w*d*d;
+    }
+    void Add(const Quadric &q) {
+        xx += q.xx; xy += q.xy; xz += q.xz; xd += q.xd; yy += q.yy; yz += q.yz; yd += q.yd;
+        zz += q.zz; zd += q.zd; dd += q.dd; weight += q.weight;
+    }
+    float Error(const vec3 &p) const {
+        float e = xx*p.x*p.x+yy*p.y*p.y+zz*p.z*p.z+dd+2*(xy*p.x*p.y+xz*p.x*p.z+yz*p.y*p.z+xd*p.x+yd*p.y+zd*p.z);
+        return e > 0? e : 0;
+    }
+};
+
+struct Candidate {
+    float cost = FLT_MAX;                   // mean squared distance after moving a vertex onto b
+    int b = -1;
+};
+
+struct Scratch {
+    // per-cell working arrays, and a binary heap of vertices ordered by their best candidate
+    vector<int> neighbors, others, around, heap;
+    vector<int2> wedgeMap;
+    vector<std::pair<float, int>> candidates;
+    float maxCost = 0;
+};
+
+class Simplifier {
+public:
+    Simplifier(vector<vec3> &points, vector<int3> &triangles, int nCells, int nThreads);
+    void Reduce(int targetTriangles, float maxError);
+    void Snapshot(LodLevel &level);
+    int live = 0;
+private:
+    vector<vec3> &points;
+    vector<int3> tris;                      // original vertex ids, rewritten as vertices collapse
+    vector<int3> welded;                    // welded ids of tris
+    vector<char> triDead;
+    vector<int> triCell;
+    int nWelded = 0, nCells = 1, nThreads = 0;
+    vector<int> weldOf;                     // welded id of each original vertex
+    vector<int> position;                   // an original vertex of each welded id
+    vector<Quadric> quadrics;
+    vector<vector<int>> adjacent;           // triangles (possibly dead) around each welded vertex
+    vector<char> dead, border;
+    vector<int> cellOf;                     // cell of each welded vertex, -1 if shared by cells
+    vector<vector<int>> cellVertices;
+    vector<int> cellLive;
+    vector<Candidate> best;                 // cheapest collapse of each welded vertex
+    vector<int> heapPos;                    // index of each welded vertex in its cell's heap, or -1
+    float maxCost = 0;
+    Scratch serial;                         // heap of all live vertices, kept between serial passes
+    bool seeded = false;
+    int Welded(int t, int k) { return welded[t][k]; }
+    bool Contains(int t, int w) { return welded[t].i1 == w || welded[t].i2 == w || welded[t].i3 == w; }
+    bool Before(int v1, int v2) { return best[v1].cost != best[v2].cost? best[v1].cost < best[v2].cost : v1 < v2; }
+    void SiftUp(Scratch &s, int i);
+    void SiftDown(Scratch &s, int i);
+    void HeapUpdate(Scratch &s, int v);
+    void HeapRemove(Scratch &s, int v);
+    void Neighbors(int a, vector<int> &neighbors);
+    bool Valid(int a, int b, int cell, Scratch &s);
+    void Best(int a, int cell, Scratch &s, bool validate = false);
+    int Collapse(int a, int b, Scratch &s);
+    void Seed(vector<int> &vertices, int cell, Scratch &s);
+    void Drain(int cell, int targetTriangles, float maxCostLimit, Scratch &s);
+};
+
+Simplifier::Simplifier(vector<vec3> &points, vector<int3> &triangles, int nCellsRequested, int nThreadsRequested)
+    : points(points), tris(triangles), nThreads(nThreadsRequested) {
+    int nPoints = points.size(), nTris = triangles.size();
+    // weld vertices with identical positions (sorted, so ids don't depend on hashing)
+    vector<int> order(nPoints);
+    for (int i = 0; i < nPoints; i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int i, int j) {
+        int c = memcmp(&points[i], &points[j], sizeof(vec3));
+        return c != 0? c < 0 : i < j;
+    });
+    weldOf.resize(nPoints);
+    for (int i = 0; i < nPoints; i++) {
+        if (!i || memcmp(&points[order[i]], &points[order[i-1]], sizeof(vec3))) {
+            position.push_back(order[i]);
+            nWelded++;
+        }
+        weldOf[order[i]] = nWelded-1;
+    }
+    // triangles around each welded vertex; triangles degenerate after welding are dropped
+    triDead.assign(nTris, 0);
+    welded.resize(nTris);
+    adjacent.resize(nWelded);
+    for (int t = 0; t < nTris; t++) {
+        int w0 = weldOf[tris[t].i1], w1 = weldOf[tris[t].i2], w2 = weldOf[tris[t].i3];
+        welded[t] = int3(w0, w1, w2);
+        if (w0 == w1 || w1 == w2 || w2 == w0) {
+            triDead[t] = 1;
+            continue;
+        }
+        adjacent[w0].push_back(t);
+        adjacent[w1].push_back(t);
+        adjacent[w2].push_back(t);
+        live++;
+    }
+    // face quadrics, border planes, and border flags (edges with one triangle, or more than two)
+    quadrics.resize(nWelded);
+    border.assign(nWelded, 0);
+    dead.assign(nWelded, 0);
+    best.resize(nWelded);
+    heapPos.assign(nWelded, -1);
+    for (int t = 0; t < nTris; t++) {
+        if (triDead[t])
+            continue;
+        vec3 &p1 = points[tris[t].i1], &p2 = points[tris[t].i2], &p3 = points[tris[t].i3];
+        vec3 n = cross(p2-p1, p3-p1);
+        float len = length(n);
+        if (len <= 0)
+            continue;
+        n = n/len;
+        float d = -dot(n, p1), area = .5f*len;
+        for (int k = 0; k < 3; k++) {
+            Quadric &q = quadrics[Welded(t, k)];
+            q.AddPlane(n, d, area);
+            q.weight += area;
+        }
+        for (int k = 0; k < 3; k++) {
+            int a = Welded(t, k), b = Welded(t, (k+1)%3), count = 0;
+            for (size_t i = 0; i < adjacent[a].size(); i++)
+                count += !triDead[adjacent[a][i]] && Contains(adjacent[a][i], b);
+            if (count == 1) {
+                // plane through the edge, perpendicular to the triangle
+                vec3 &pa = points[tris[t][k]], e = points[tris[t][(k+1)%3]]-pa, m = cross(e, n);
+                float mLen = length(m);
+                if (mLen > 0) {
+                    m = m/mLen;
+                    quadrics[a].AddPlane(m, -dot(m, pa), borderWeight*dot(e, e));
+                    quadrics[b].AddPlane(m, -dot(m, pa), borderWeight*dot(e, e));
+                }
+            }
+            if (count != 2)
+                border[a] = border[b] = 1;
+        }
+    }
+    // partition triangles into cells of consecutive Morton order of their centroids
+    nCells = nCellsRequested > 0? nCellsRequested : (live+cellTriangles-1)/cellTriangles;
+    nCells = nCells < 1? 1 : nCells > live/64+1? live/64+1 : nCells;
+    triCell.assign(nTris, 0);
+    cellLive.assign(nCells, 0);
+    cellOf.assign(nWelded, 0);
+    if (nCells > 1) {
+        // quantize in a cube about the bounds, so a thin axis doesn't scatter the order
+        vec3 min, max;
+        ComputeBounds(points, min, max, nThreads);
+        float range = 0;
+        for (int k = 0; k < 3; k++)
+            range = max[k]-min[k] > range? max[k]-min[k] : range;
+        vector<unsigned int> codes(nTris, 0);
+        vector<int> sorted;
+        for (int t = 0; t < nTris; t++) {
+            if (triDead[t])
+                continue;
+            vec3 c = (points[tris[t].i1]+points[tris[t].i2]+points[tris[t].i3])/3;
+            for (int k = 0; k < 3; k++) {
+                unsigned int q = range > 0? (unsigned int) ((c[k]-min[k])/range*1023.f+.5f) : 0;
+                for (int bit = 0; bit < 10; bit++)
+                    codes[t] |= ((q >> bit) & 1) << (3*bit+k);
+            }
+            sorted.push_back(t);
+        }
+        std::sort(sorted.begin(), sorted.end(), [&](int i, int j) { return codes[i] != codes[j]? codes[i] < codes[j] : i < j; });
+        for (size_t i = 0; i < sorted.size(); i++)
+            triCell[sorted[i]] = (int) ((long long) i*nCells/sorted.size());
+    }
+    for (int t = 0; t < nTris; t++)
+        cellLive[triCell[t]] += !triDead[t];
+    cellVertices.resize(nCells);
+    for (int w = 0; w < nWelded; w++) {
+        int cell = adjacent[w].empty()? -1 : triCell[adjacent[w][0]];
+        for (size_t i = 1; i < adjacent[w].size() && cell >= 0; i++)
+            if (triCell[adjacent[w][i]] != cell)
+                cell = -1;
+        cellOf[w] = cell;
+        if (cell >= 0)
+            cellVertices[cell].push_back(w);
+    }
+}
+
+void Simplifier::Neighbors(int a, vector<int> &neighbors) {
+    // other welded vertices of a's live triangles (sorted, unique); also drop a's dead triangles
+    vector<int> &adj = adjacent[a];
+    neighbors.clear();
+    size_t n = 0;
+    for (size_t i = 0; i < adj.size(); i++) {
+        int t = adj[i];
+        if (triDead[t])
+            continue;
+        adj[n++] = t;
+        for (int k = 0; k < 3; k++)
+            if (Welded(t, k) != a)
+                neighbors.push_back(Welded(t, k));
+    }
+    adj.resize(n);
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+}
+
+bool Simplifier::Valid(int a, int b, int cell, Scratch &s) {
+    // can a move onto b? (s.neighbors must hold a's neighbors)
+    if (dead[a] || dead[b] || a == b || (cell >= 0 && (cellOf[a] != cell || cellOf[b] != cell)))
+        return false;
+    vector<int> &adj = adjacent[a];
+    int nEdge = 0;
+    s.wedgeMap.clear();
+    for (size_t i = 0; i < adj.size(); i++) {
+        int t = adj[i];
+        if (triDead[t] || !Contains(t, b))
+            continue;
+        nEdge++;
+        // wedge of a in t goes to wedge of b in t
+        int va = -1, vb = -1;
+        for (int k = 0; k < 3; k++) {
+            if (Welded(t, k) == a)
+                va = tris[t][k];
+            if (Welded(t, k) == b)
+                vb = tris[t][k];
+        }
+        s.wedgeMap.push_back(int2(va, vb));
+    }
+    // borders move only along themselves; an edge of more than two triangles doesn't move
+    if (!nEdge || nEdge > 2 || (border[a] && nEdge != 1))
+        return false;
+    // wedges sharing a side must agree, and every wedge of a must have somewhere to go
+    for (size_t i = 0; i < s.wedgeMap.size(); i++)
+        for (size_t j = 0; j < i; j++)
+            if (s.wedgeMap[i].i1 == s.wedgeMap[j].i1 && s.wedgeMap[i].i2 != s.wedgeMap[j].i2)
+                return false;
+    vec3 &pb = points[position[b]];
+    for (size_t i = 0; i < adj.size(); i++) {
+        int t = adj[i];
+        if (triDead[t] || Contains(t, b))
+            continue;
+        vec3 p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = q[k] = points[tris[t][k]];
+            if (Welded(t, k) == a) {
+                bool mapped = false;
+                for (size_t m = 0; m < s.wedgeMap.size() && !mapped; m++)
+                    mapped = s.wedgeMap[m].i1 == tris[t][k];
+                if (!mapped)
+                    return false;
+                q[k] = pb;
+            }
+        }
+        // reject flipped or collapsed triangles
+        if (dot(cross(p[1]-p[0], p[2]-p[0]), cross(q[1]-q[0], q[2]-q[0])) <= 0)
+            return false;
+    }
+    // link condition: a and b share only the vertices opposite their edge, else the surface pinches
+    Neighbors(b, s.others);
+    int shared = 0;
+    for (size_t i = 0, j = 0; i < s.neighbors.size() && j < s.others.size();) {
+        if (s.neighbors[i] == s.others[j]) {
+            shared++;
+            i++;
+            j++;
+        }
+        else if (s.neighbors[i] < s.others[j])
+            i++;
+        else
+            j++;
+    }
+    return shared == nEdge;
+}
+
+void Simplifier::SiftUp(Scratch &s, int i) {
+    int v = s.heap[i];
+    for (int parent; i > 0 && Before(v, s.heap[parent = (i-1)/2]); i = parent) {
+        s.heap[i] = s.heap[parent];
+        heapPos[s.heap[i]] = i;
+    }
+    s.heap[i] = v;
+    heapPos[v] = i;
+}
+
+void Simplifier::SiftDown(Scratch &s, int i) {
+    int v = s.heap[i], n = s.heap.size();
+    for (int child; (child = 2*i+1) < n; i = child) {
+        if (child+1 < n && Before(s.heap[child+1], s.heap[child]))
+            child++;
+        if (!Before(s.heap[child], v))
+            break;
+        s.heap[i] = s.heap[child];
+        heapPos[s.heap[i]] = i;
+    }
+    s.heap[i] = v;
+    heapPos[v] = i;
+}
+
+void Simplifier::HeapUpdate(Scratch &s, int v) {
+    // insert v, or move it after its best candidate changed
+    if (heapPos[v] < 0) {
+        s.heap.push_back(v);
+        SiftUp(s, s.heap.size()-1);
+        return;
+    }
+    SiftUp(s, heapPos[v]);
+    SiftDown(s, heapPos[v]);
+}
+
+void Simplifier::HeapRemove(Scratch &s, int v) {
+    int i = heapPos[v];
+    if (i < 0)
+        return;
+    heapPos[v] = -1;
+    int last = s.heap.back();
+    s.heap.pop_back();
+    if (last == v)
+        return;
+    s.heap[i] = last;
+    heapPos[last] = i;
+    HeapUpdate(s, last);
+}
+
+void Simplifier::Best(int a, int cell, Scratch &s, bool validate) {
+    // set a's cheapest collapse and its place in the heap; if validate, its cheapest valid collapse
+    // (else validity is checked when a reaches the top of the heap, which most vertices never do)
+    if (dead[a] || (cell >= 0 && cellOf[a] != cell)) {
+        HeapRemove(s, a);
+        return;
+    }
+    Neighbors(a, s.neighbors);
+    s.candidates.clear();
+    Quadric &qa = quadrics[a];
+    for (size_t i = 0; i < s.neighbors.size(); i++) {
+        int b = s.neighbors[i];
+        if (cell >= 0 && cellOf[b] != cell)
+            continue;
+        vec3 &pb = points[position[b]];
+        float weight = qa.weight+quadrics[b].weight;
+        s.candidates.push_back(std::make_pair(weight > 0? (qa.Error(pb)+quadrics[b].Error(pb))/weight : 0, b));
+    }
+    std::sort(s.candidates.begin(), s.candidates.end());
+    best[a] = Candidate();
+    for (size_t i = 0; i < s.candidates.size(); i++)
+        if (!validate || Valid(a, s.candidates[i].second, cell, s)) {
+            best[a].cost = s.candidates[i].first;
+            best[a].b = s.candidates[i].second;
+            break;
+        }
+    if (best[a].b < 0)
+        HeapRemove(s, a);
+    else
+        HeapUpdate(s, a);
+}
+
+int Simplifier::Collapse(int a, int b, Scratch &s) {
+    // move a onto b (Valid has just set wedgeMap); return # triangles removed
+    int removed = 0;
+    vector<int> &adj = adjacent[a];
+    for (size_t i = 0; i < adj.size(); i++) {
+        int t = adj[i];
+        if (triDead[t])
+            continue;
+        if (Contains(t, b)) {
+            triDead[t] = 1;
+            cellLive[triCell[t]]--;
+            removed++;
+            continue;
+        }
+        for (int k = 0; k < 3; k++)
+            if (Welded(t, k) == a) {
+                welded[t][k] = b;
+                for (size_t m = 0; m < s.wedgeMap.size(); m++)
+                    if (s.wedgeMap[m].i1 == tris[t][k]) {
+                        tris[t][k] = s.wedgeMap[m].i2;
+                        break;
+                    }
+            }
+        adjacent[b].push_back(t);
+    }
+    quadrics[b].Add(quadrics[a]);
+    dead[a] = 1;
+    HeapRemove(s, a);
+    vector<int>().swap(adj);
+    return removed;
+}
+
+void Simplifier::Seed(vector<int> &vertices, int cell, Scratch &s) {
+    // heap the vertices (of cell, or any if cell < 0) by their best collapse
+    s.heap.clear();
+    for (size_t i = 0; i < vertices.size(); i++)
+        heapPos[vertices[i]] = -1;
+    for (size_t i = 0; i < vertices.size(); i++)
+        if (!dead[vertices[i]])
+            Best(vertices[i], cell, s);
+}
+
+void Simplifier::Drain(int cell, int targetTriangles, float maxCostLimit, Scratch &s) {
+    // collapse cheapest first until targetTriangles remain (in cell, or overall if cell < 0)
+    int nLive = cell >= 0? cellLive[cell] : live;
+    while (nLive > targetTriangles && !s.heap.empty()) {
+        int a = s.heap[0], b = best[a].b;
+        float cost = best[a].cost;
+        if (cost > maxCostLimit)
+            break;
+        Neighbors(a, s.neighbors);
+        if (!Valid(a, b, cell, s)) {
+            Best(a, cell, s, true);
+            continue;
+        }
+        nLive -= Collapse(a, b, s);
+        s.maxCost = cost > s.maxCost? cost : s.maxCost;
+        // b's quadric and surroundings changed: refresh b and its neighbors
+        Neighbors(b, s.around);
+        s.around.push_back(b);
+        for (size_t i = 0; i < s.around.size(); i++)
+            if (cell < 0 || cellOf[s.around[i]] == cell)
+                Best(s.around[i], cell, s);
+    }
+    if (cell < 0)
+        live = nLive;
+}
+
+void Simplifier::Reduce(int targetTriangles, float maxError) {
+    float maxCostLimit = maxError < FLT_MAX? maxError*maxError : FLT_MAX;
+    if (nCells > 1 && live > targetTriangles && live >= minCellTriangles*nCells) {
+        // cells in parallel, with shared vertices fixed; a cost bound, from the cells' initial candidates,
+        // limits them to about half the collapses needed, taken in roughly global cost order, so cells
+        // with little detail aren't forced to their share of the target
+        vector<Scratch> scratch(nCells);
+        ParallelFor(nCells, [&](int c) { Seed(cellVertices[c], c, scratch[c]); }, nThreads);
+        vector<float> costs;
+        for (int c = 0; c < nCells; c++)
+            for (size_t i = 0; i < scratch[c].heap.size(); i++)
+                costs.push_back(best[scratch[c].heap[i]].cost);
+        size_t k = (live-targetTriangles)/4;
+        k = k < costs.size()/2? k : costs.size()/2;
+        float bound = costs.empty()? 0 : maxCostLimit;
+        if (!costs.empty()) {
+            std::nth_element(costs.begin(), costs.begin()+k, costs.end());
+            bound = costs[k] < bound? costs[k] : bound;
+        }
+        vector<int> targets(nCells);
+        for (int c = 0; c < nCells; c++)
+            targets[c] = (int) ((long long) cellLive[c]*targetTriangles/live);
+        ParallelFor(nCells, [&](int c) { Drain(c, targets[c], bound, scratch[c]); }, nThreads);
+        seeded = false;
+        live = 0;
+        for (int c = 0; c < nCells; c++) {
+            live += cellLive[c];
+            maxCost = scratch[c].maxCost > maxCost? scratch[c].maxCost : maxCost;
+        }
+    }
+    // then all vertices, serially; the heap stays valid until cells next change the mesh
+    if (!seeded) {
+        vector<int> all;
+        for (int w = 0; w < nWelded; w++)
+            if (!dead[w])
+                all.push_back(w);
+        Seed(all, -1, serial);
+        seeded = true;
+    }
+    serial.maxCost = maxCost;
+    Drain(-1, targetTriangles, maxCostLimit, serial);
+    maxCost = serial.maxCost;
+}
+
+void Simplifier::Snapshot(LodLevel &level) {
+    level.triangles.clear();
+    level.sources.clear();
+    for (int t = 0; t < (int) tris.size(); t++)
+        if (!triDead[t]) {
+            level.triangles.push_back(tris[t]);
+            level.sources.push_back(t);
+        }
+    level.error = sqrtf(maxCost);
+}
+
+} // end namespace
+
+float Simplify(vector<vec3> &points, vector<int3> &triangles, LodLevel &level, int targetTriangles,
+               float maxError, int nCells, int nThreads) {
+    Simplifier s(points, triangles, nCells, nThreads);
+    s.Reduce(targetTriangles, maxError);
+    s.Snapshot(level);
+    return level.error;
+}
+
+int SimplifyLods(vector<vec3> &points, vector<int3> &triangles, vector<LodLevel> &levels,
+                 float ratio, int minTriangles, int nCells, int nThreads) {
+    levels.clear();
+    Simplifier s(points, triangles, nCells, nThreads);
+    for (int previous = s.live; previous > minTriangles;) {
+        int target = (int) (ratio*previous);
+        target = target < minTriangles? minTriangles : target;
+        if (target >= previous)
+            break;
+        s.Reduce(target, FLT_MAX);
+        if (s.live > previous-previous/10)
+            break;
+        levels.resize(levels.size()+1);
+        s.Snapshot(levels.back());
+        previous = s.live;
+    }
+    return levels.size();
+}